@@ -0,0 +1,70 @@
+// Module for memory whose lifetime is a song, not a single object.
+// An arena hands out memory from big blocks and gives it all back at once:
+// reset it when the song changes and the next song reuses the same blocks,
+// so memory stays flat however many times the song changes.
+// A pool hands out fixed-size objects (chord steps) and takes them back one
+// at a time, keeping freed ones for the next alloc.
+// Neither is thread safe: each arena or pool belongs to one thread.
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stddef.h>
+
+// Most songs fit in one block
+#define ARENA_DEFAULT_BLOCK_SIZE (16 * 1024)
+
+typedef struct arenaBlock arenaBlock_t;
+
+typedef struct {
+    arenaBlock_t *pFirst;
+    // Where allocs come from; blocks after it are spare
+    arenaBlock_t *pCurrent;
+    size_t blockSize;
+    // Handed out since the last reset
+    size_t usedBytes;
+} arena_t;
+
+typedef struct poolBlock poolBlock_t;
+
+typedef struct {
+    poolBlock_t *pBlocks;
+    void *pFreeList;
+    int numInUse;
+    size_t objectSize;
+    int objectsPerBlock;
+} pool_t;
+
+// Blocks are only allocated on first use
+void Arena_init(arena_t *pArena, size_t blockSize);
+// Frees every block; the arena can be used again
+void Arena_cleanup(arena_t *pArena);
+// Make everything allocated so far free, keeping the blocks
+void Arena_reset(arena_t *pArena);
+
+// Aligned for any type. Exits if out of memory, as malloc failing on the
+// board means the app cannot carry on anyway.
+void *Arena_alloc(arena_t *pArena, size_t size);
+char *Arena_strdup(arena_t *pArena, const char *text);
+
+void Pool_init(pool_t *pPool, size_t objectSize, int objectsPerBlock);
+// Frees every block, including objects never released
+void Pool_cleanup(pool_t *pPool);
+void *Pool_alloc(pool_t *pPool);
+void Pool_release(pool_t *pPool, void *pObject);
+
+// Totals over every arena and pool
+typedef struct {
+    // Blocks malloc'd, in bytes
+    unsigned long reservedBytes;
+    // Most any one arena has handed out at once, or any pool had in use
+    // when it was cleaned up; a song that needs more than its arena's
+    // block size shows up here
+    unsigned long peakUsedBytes;
+    unsigned long blocks;
+    unsigned long resets;
+} arenaStats_t;
+
+void Arena_getStats(arenaStats_t *pStats);
+
+#endif
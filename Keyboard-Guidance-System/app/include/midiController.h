@@ -5,6 +5,7 @@
 #ifndef MIDICONTROLLER_H
 #define MIDICONTROLLER_H
 
+#include <stdint.h>
 #include "hal/midiReader.h"
 #include "hal/audioGenerator.h"
 
@@ -20,6 +21,8 @@ enum songs {
 };
 
 // init and cleanup
+// Load the note sounds first; that can run alongside the other modules' init
+void MidiController_loadSounds(void);
 void MidiController_init(void);
 void MidiController_cleanup(void);
 
@@ -38,5 +41,26 @@ void MidiController_cycleSongRight();
 void MidiController_cycleSongLeft();
 // gets the current song
 int MidiController_getCurrentSong();
+// gets the display name of a song
+const char * MidiController_getSongName(int song);
+
+// Snapshot of the guidance state, for remote UIs
+typedef struct {
+    int song;
+    // Position in the song, and its length in notes
+    int stepIndex;
+    int stepCount;
+    // Last note played, or -1 if none yet since the song started
+    int lastNote;
+    bool wasLastNoteCorrect;
+    // From the note arriving to the controller having handled it
+    int lastNoteLatencyUs;
+    // Bumped on every change, so readers can tell if anything is new
+    uint32_t changeCount;
+} midiControllerStatus_t;
+
+// Copies the latest status. Never blocks the guidance loop: the snapshot is
+// published under a sequence lock and readers retry if it changes mid-copy.
+void MidiController_getStatus(midiControllerStatus_t *pStatus);
 
 #endif
@@ -0,0 +1,55 @@
+// Module to take MIDI notes over UDP (port 12346), so remote players or a
+// test rig can drive guidance like the USB keyboard does.
+// Packets go through a jitter buffer that releases them at a steady delay
+// behind the sender's clock, sized from the measured network jitter.
+
+#ifndef _NET_MIDI_H_
+#define _NET_MIDI_H_
+
+#include <stdint.h>
+
+#define NET_MIDI_PORT 12346
+
+// Packet layout, little-endian:
+//   0      magic NET_MIDI_MAGIC
+//   1      version NET_MIDI_VERSION
+//   2      flags: NET_MIDI_FLAG_ACK asks for an ack once played out
+//   3      number of MIDI events, at most NET_MIDI_MAX_EVENTS
+//   4-5    sequence number, one per packet
+//   6-7    reserved
+//   8-11   sender timestamp in us, any epoch
+//   12-    events: 3 bytes each, raw MIDI (status, note, velocity)
+// Acks are a header with magic NET_MIDI_ACK_MAGIC, no events, and the
+// sequence number and timestamp of the packet played out.
+#define NET_MIDI_MAGIC 'M'
+#define NET_MIDI_ACK_MAGIC 'A'
+#define NET_MIDI_VERSION 1
+#define NET_MIDI_FLAG_ACK 0x01
+#define NET_MIDI_HEADER_LEN 12
+#define NET_MIDI_EVENT_LEN 3
+#define NET_MIDI_MAX_EVENTS 8
+#define NET_MIDI_MAX_PACKET_LEN (NET_MIDI_HEADER_LEN + NET_MIDI_MAX_EVENTS * NET_MIDI_EVENT_LEN)
+
+typedef struct {
+    uint64_t packetsReceived;
+    uint64_t packetsPlayed;
+    // Never arrived before a later packet was due
+    uint64_t packetsLost;
+    // Arrived after their slot had been played or skipped
+    uint64_t packetsLate;
+    uint64_t packetsDuplicate;
+    uint64_t packetsMalformed;
+    // Note-ons the controller was still busy for, as with the local reader
+    uint64_t notesDropped;
+    // Current estimate, and the delay the buffer is holding packets for
+    int jitterUs;
+    int playoutDelayUs;
+} netMidiStats_t;
+
+// init and cleanup functions
+void NetMidi_init(void);
+void NetMidi_cleanup(void);
+
+void NetMidi_getStats(netMidiStats_t *pStats);
+
+#endif
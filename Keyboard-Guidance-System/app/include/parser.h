@@ -1,8 +1,12 @@
 // module to parse notes from a txt file into array
 // program will read the note line by line 
+// Everything parsed lives in the arena passed in: reset the arena to free
+// a whole song at once. Chords come from a pool, one per line.
 #ifndef _FILE_PARSER_H_
 #define _FILE_PARSER_H_
 
+#include "arena.h"
+
 //Store each line of the text file to each element of the lines array
 typedef struct {
     char **lines;
@@ -10,10 +14,15 @@ typedef struct {
 } StringArray;
 
 // function to parse the file by line break
-StringArray Parser_parseFileByLineBreak(char *);
+// Gives no lines if the file cannot be read
+StringArray Parser_parseFileByLineBreak(const char *filePath, arena_t *pArena);
 // parse the file to get individual notes
-enum note* Parse_parseStringArrayForNotes(StringArray);
+enum note* Parse_parseStringArrayForNotes(StringArray, arena_t *pArena);
 // parse the file to set up chord structure
-struct chord** Parser_parseStringArrayForChords(StringArray);
+// Chords are allocated from pChordPool (objects of sizeof(struct chord)),
+// their notes from the arena. Changes the lines.
+struct chord** Parser_parseStringArrayForChords(StringArray, arena_t *pArena, pool_t *pChordPool);
+// give the chords back to the pool; the arena memory goes at its next reset
+void Parser_releaseChords(struct chord **chords, int numChords, pool_t *pChordPool);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,45 @@
+// Module to run all non-audio work on one thread, from one epoll set.
+// Modules register the fds they wait on and the timers they need, and their
+// callbacks are run one at a time on the reactor thread. Nothing spins or
+// sleeps, so the CPU is idle until there is something to do.
+// Callbacks must not block, and may be woken with nothing to read.
+
+#ifndef _REACTOR_H_
+#define _REACTOR_H_
+
+#include <stdint.h>
+#include <sys/epoll.h>
+
+typedef void (*reactorFdCallback_t)(int fd, uint32_t events, void *pContext);
+typedef void (*reactorTimerCallback_t)(void *pContext);
+
+typedef struct reactorTimer reactorTimer_t;
+
+// init and cleanup functions
+void Reactor_init(void);
+void Reactor_cleanup(void);
+
+// Run callbacks on the calling thread until shutdown is triggered
+void Reactor_run(void);
+
+// Call callback whenever fd reports any of events (EPOLLIN etc.)
+// name is only used in the timing report at cleanup.
+// Fds and timers can be added from any thread, even once Reactor_run() has
+// started, as modules still starting up do.
+void Reactor_addFd(const char *name, int fd, uint32_t events,
+    reactorFdCallback_t callback, void *pContext);
+// Only from the reactor thread, or before/after Reactor_run()
+void Reactor_removeFd(int fd);
+
+// Timers start disarmed
+reactorTimer_t *Reactor_addTimer(const char *name, reactorTimerCallback_t callback, void *pContext);
+// Fire at deadlineNs on the monotonic clock (see getMonotonicTimeInNs()),
+// then every intervalNs if that is not 0
+void Reactor_armTimer(reactorTimer_t *pTimer, long long deadlineNs, long long intervalNs);
+void Reactor_disarmTimer(reactorTimer_t *pTimer);
+// Deadlines covered by the callback now running: above 1 means it fell behind
+uint64_t Reactor_getTimerExpirations(const reactorTimer_t *pTimer);
+// Only from the reactor thread, or before/after Reactor_run()
+void Reactor_removeTimer(reactorTimer_t *pTimer);
+
+#endif
@@ -19,4 +19,8 @@ bool Shutdown_isShutdown(void);
 // Waits for shutdown signal to be received
 void Shutdown_waitForShutdown(void);
 
+// eventfd that becomes readable once shutdown has been triggered, so threads
+// blocked in poll/epoll can wake up for it. Never read from it.
+int Shutdown_getEventFd(void);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,44 @@
+// Module to start the other modules in dependency order.
+// Each stage is one module's init. Stages whose dependencies are done run
+// at the same time on a few worker threads, so a slow one (config-pin,
+// loading WAV files, opening ALSA, spawning amidi) does not hold up the
+// rest. Stages list what must finish before them: what they use during
+// init, and what their reactor callbacks call into, since the reactor runs
+// while later stages are still starting.
+// Ready is signalled when the stages needed to play a note are done: it is
+// printed, marked in the trace, and told to systemd when run as a
+// Type=notify service (NOTIFY_SOCKET). Once every stage is done, the time
+// each took is printed.
+
+#ifndef _STARTUP_H_
+#define _STARTUP_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define STARTUP_MAX_STAGES 32
+// Stage indexes this stage has to wait for, e.g.
+// STARTUP_AFTER(STAGE_AUDIO) | STARTUP_AFTER(STAGE_MIDI)
+#define STARTUP_AFTER(stage) ((uint32_t) 1 << (stage))
+
+typedef struct {
+    const char *name;
+    void (*init)(void);
+    uint32_t after;
+    // Part of the path from a key press to a sound: the app is "ready"
+    // as soon as these are done
+    bool isNeededForReady;
+} startupStage_t;
+
+// Start running the stages, and return without waiting for them.
+// Exits if a stage depends on itself, or on a stage that does not exist.
+// pStages must stay valid until Startup_wait().
+void Startup_start(const startupStage_t *pStages, int numStages);
+
+// Wait until every stage is done
+void Startup_wait(void);
+
+// Time from Startup_start() to ready, or -1 if not ready yet
+long long Startup_getReadyUs(void);
+
+#endif
@@ -12,4 +12,7 @@ void customSleep(long seconds, long nanoseconds);
 // Get current time in milliseconds
 long long getTimeInMs(void);
 
+// Monotonic clock in nanoseconds, for deadlines and measuring intervals
+long long getMonotonicTimeInNs(void);
+
 #endif
\ No newline at end of file
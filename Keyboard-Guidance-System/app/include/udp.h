@@ -1,4 +1,4 @@
-// This module listen to port 12345 for incoming UDP packets (use a thread). 
+// This module listen to port 12345 for incoming UDP packets (on the reactor thread).
 // It treats each packet as a command to respond to: 
 // reply back to the sender with one or more UDP packets containing the “return” message (plain text).
 // currently has issues when interacting with MIDI events 
@@ -17,9 +17,33 @@ enum Command {
     UDP_POPSONG,
     MAX_NUMBER_OF_COMMANDS,
     STOP,
-    BLANK
+    BLANK,
+    SUBSCRIBE,
+    UNSUBSCRIBE,
+    STATS,
+    TRACE
 };
 
+// Status frames streamed to clients that sent "subscribe [intervalMs]".
+// Little-endian, UDP_STATUS_FRAME_LEN bytes:
+//   0      magic UDP_STATUS_MAGIC
+//   1      version UDP_STATUS_VERSION
+//   2-3    frame sequence number, to spot lost frames
+//   4      song
+//   5      last note played, or UDP_STATUS_NO_NOTE
+//   6      flags: UDP_STATUS_FLAG_CORRECT if the last note was right
+//   7      reserved
+//   8-9    step index in the song
+//   10-11  number of steps in the song
+//   12-15  latency of the last note through the controller, in us
+//   16-19  status change count
+// A subscription lasts a minute; subscribe again to renew it.
+#define UDP_STATUS_FRAME_LEN 20
+#define UDP_STATUS_MAGIC 'K'
+#define UDP_STATUS_VERSION 1
+#define UDP_STATUS_NO_NOTE 0xFF
+#define UDP_STATUS_FLAG_CORRECT 0x01
+
 void UDP_init(void);
 void UDP_cleanup(void);
 
@@ -0,0 +1,30 @@
+// Module for blocking work the reactor must not wait on: file I/O such as
+// reading /proc or writing a trace dump. One thread runs the jobs in the
+// order they were posted, from a fixed-size queue, so posting a job never
+// allocates and never waits on the work itself.
+
+#ifndef _WORKER_H_
+#define _WORKER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define WORKER_MAX_JOBS 8
+// Most context a job can carry
+#define WORKER_MAX_CONTEXT 1024
+
+typedef void (*workerJob_t)(void *pContext);
+
+// Starts the thread. Call after Trace_init(), so it leaves SIGUSR1 to the
+// reactor like every other thread.
+void Worker_init(void);
+// Runs the jobs already posted, then stops the thread
+void Worker_cleanup(void);
+
+// Run job on the worker with a copy of size bytes from pContext (which may
+// be NULL if size is 0).
+// Returns false, and runs nothing, if the queue is full or the worker is
+// not running. Safe from any thread.
+bool Worker_post(workerJob_t job, const void *pContext, size_t size);
+
+#endif
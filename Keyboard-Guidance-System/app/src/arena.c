@@ -0,0 +1,214 @@
+// Arena and pool allocators, and the memory counters for both
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "arena.h"
+
+#define ALIGNMENT _Alignof(max_align_t)
+
+struct arenaBlock {
+    arenaBlock_t *pNext;
+    size_t size;
+    size_t used;
+    max_align_t data[];
+};
+
+struct poolBlock {
+    poolBlock_t *pNext;
+    max_align_t data[];
+};
+
+// Arenas live on different threads, and the UDP stats reader shares these.
+// They only change when a block comes or goes, or an arena is reset, so
+// allocs stay free of atomics.
+static _Atomic unsigned long reservedBytes;
+static _Atomic unsigned long peakUsedBytes;
+static _Atomic unsigned long numBlocks;
+static _Atomic unsigned long numResets;
+
+static size_t alignUp(size_t size)
+{
+    return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+}
+
+static void *allocOrDie(size_t size)
+{
+    void *pMemory = malloc(size);
+    if (pMemory == NULL) {
+        printf("ERROR: Out of memory allocating %zu bytes\n", size);
+        exit(EXIT_FAILURE);
+    }
+    atomic_fetch_add_explicit(&reservedBytes, size, memory_order_relaxed);
+    atomic_fetch_add_explicit(&numBlocks, 1, memory_order_relaxed);
+    return pMemory;
+}
+
+static void freeBlock(void *pMemory, size_t size)
+{
+    free(pMemory);
+    atomic_fetch_sub_explicit(&reservedBytes, size, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&numBlocks, 1, memory_order_relaxed);
+}
+
+static void updatePeak(unsigned long used)
+{
+    unsigned long peak = atomic_load_explicit(&peakUsedBytes, memory_order_relaxed);
+    while (used > peak && !atomic_compare_exchange_weak_explicit(&peakUsedBytes, &peak, used,
+        memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+void Arena_init(arena_t *pArena, size_t blockSize)
+{
+    pArena->pFirst = NULL;
+    pArena->pCurrent = NULL;
+    pArena->blockSize = alignUp(blockSize);
+    pArena->usedBytes = 0;
+}
+
+// Mark every block empty, and go back to the first
+static void emptyBlocks(arena_t *pArena)
+{
+    pArena->usedBytes = 0;
+    for (arenaBlock_t *pBlock = pArena->pFirst; pBlock != NULL; pBlock = pBlock->pNext) {
+        pBlock->used = 0;
+    }
+    pArena->pCurrent = pArena->pFirst;
+}
+
+void Arena_cleanup(arena_t *pArena)
+{
+    emptyBlocks(pArena);
+    arenaBlock_t *pBlock = pArena->pFirst;
+    while (pBlock != NULL) {
+        arenaBlock_t *pNext = pBlock->pNext;
+        freeBlock(pBlock, sizeof(arenaBlock_t) + pBlock->size);
+        pBlock = pNext;
+    }
+    pArena->pFirst = NULL;
+    pArena->pCurrent = NULL;
+}
+
+void Arena_reset(arena_t *pArena)
+{
+    emptyBlocks(pArena);
+    atomic_fetch_add_explicit(&numResets, 1, memory_order_relaxed);
+}
+
+// Use the next spare block if it is big enough, or put a new one in
+// after the current block. Allocs bigger than a block get one to themselves.
+static arenaBlock_t *nextBlock(arena_t *pArena, size_t size)
+{
+    arenaBlock_t *pCurrent = pArena->pCurrent;
+    arenaBlock_t *pSpare = pCurrent == NULL ? pArena->pFirst : pCurrent->pNext;
+    if (pSpare != NULL && pSpare->size >= size) {
+        return pSpare;
+    }
+
+    size_t blockSize = size > pArena->blockSize ? size : pArena->blockSize;
+    arenaBlock_t *pBlock = allocOrDie(sizeof(arenaBlock_t) + blockSize);
+    pBlock->size = blockSize;
+    pBlock->used = 0;
+    pBlock->pNext = pSpare;
+    if (pCurrent == NULL) {
+        pArena->pFirst = pBlock;
+    } else {
+        pCurrent->pNext = pBlock;
+    }
+    return pBlock;
+}
+
+void *Arena_alloc(arena_t *pArena, size_t size)
+{
+    size = alignUp(size > 0 ? size : 1);
+    arenaBlock_t *pBlock = pArena->pCurrent;
+    if (pBlock == NULL || pBlock->size - pBlock->used < size) {
+        pBlock = nextBlock(pArena, size);
+        pArena->pCurrent = pBlock;
+    }
+    void *pMemory = (char *) pBlock->data + pBlock->used;
+    pBlock->used += size;
+    pArena->usedBytes += size;
+    // Arenas filled once and kept, such as the songs, are never reset
+    updatePeak(pArena->usedBytes);
+    return pMemory;
+}
+
+char *Arena_strdup(arena_t *pArena, const char *text)
+{
+    size_t length = strlen(text) + 1;
+    return memcpy(Arena_alloc(pArena, length), text, length);
+}
+
+void Pool_init(pool_t *pPool, size_t objectSize, int objectsPerBlock)
+{
+    // Free objects hold the free list link
+    if (objectSize < sizeof(void *)) {
+        objectSize = sizeof(void *);
+    }
+    pPool->pBlocks = NULL;
+    pPool->pFreeList = NULL;
+    pPool->numInUse = 0;
+    pPool->objectSize = alignUp(objectSize);
+    pPool->objectsPerBlock = objectsPerBlock > 0 ? objectsPerBlock : 1;
+}
+
+static size_t poolBlockSize(const pool_t *pPool)
+{
+    return sizeof(poolBlock_t) + pPool->objectSize * pPool->objectsPerBlock;
+}
+
+void Pool_cleanup(pool_t *pPool)
+{
+    updatePeak(pPool->numInUse * pPool->objectSize);
+    poolBlock_t *pBlock = pPool->pBlocks;
+    while (pBlock != NULL) {
+        poolBlock_t *pNext = pBlock->pNext;
+        freeBlock(pBlock, poolBlockSize(pPool));
+        pBlock = pNext;
+    }
+    pPool->pBlocks = NULL;
+    pPool->pFreeList = NULL;
+    pPool->numInUse = 0;
+}
+
+void *Pool_alloc(pool_t *pPool)
+{
+    if (pPool->pFreeList == NULL) {
+        poolBlock_t *pBlock = allocOrDie(poolBlockSize(pPool));
+        pBlock->pNext = pPool->pBlocks;
+        pPool->pBlocks = pBlock;
+        // Thread the new objects onto the free list, first one on top
+        for (int i = pPool->objectsPerBlock - 1; i >= 0; i--) {
+            void *pObject = (char *) pBlock->data + i * pPool->objectSize;
+            *(void **) pObject = pPool->pFreeList;
+            pPool->pFreeList = pObject;
+        }
+    }
+    void *pObject = pPool->pFreeList;
+    pPool->pFreeList = *(void **) pObject;
+    pPool->numInUse++;
+    return pObject;
+}
+
+void Pool_release(pool_t *pPool, void *pObject)
+{
+    if (pObject == NULL) {
+        return;
+    }
+    *(void **) pObject = pPool->pFreeList;
+    pPool->pFreeList = pObject;
+    pPool->numInUse--;
+}
+
+void Arena_getStats(arenaStats_t *pStats)
+{
+    pStats->reservedBytes = atomic_load_explicit(&reservedBytes, memory_order_relaxed);
+    pStats->peakUsedBytes = atomic_load_explicit(&peakUsedBytes, memory_order_relaxed);
+    pStats->blocks = atomic_load_explicit(&numBlocks, memory_order_relaxed);
+    pStats->resets = atomic_load_explicit(&numResets, memory_order_relaxed);
+}
@@ -9,7 +9,15 @@
 
 #include "shutdown.h"
 #include "udp.h"
+#include "netMidi.h"
+#include "reactor.h"
+#include "timeDelay.h"
+#include "startup.h"
+#include "worker.h"
 
+#include <hal/halBackend.h>
+#include <hal/trace.h>
+#include <hal/statsPage.h>
 #include <hal/audioGenerator.h>
 #include <hal/ledDriver.h>
 #include <hal/colours.h>
@@ -18,26 +26,93 @@
 #include <hal/segDisplay.h>
 #include <midiController.h>
 
+// One LED per key, C to C8
+#define NUM_KEY_LEDS 14
+
+// Runs one module's init and reports how long it took
+#define TIMED_INIT(call) \
+    do { \
+        long long initStartNs = getMonotonicTimeInNs(); \
+        call; \
+        printf("Startup: %-28s %7lld us\n", #call, \
+            (getMonotonicTimeInNs() - initStartNs) / 1000); \
+    } while (0)
+
+// Modules started on the startup workers
+enum stage {
+    STAGE_LEDS,
+    STAGE_AUDIO,
+    STAGE_SOUNDS,
+    STAGE_MIDI_READER,
+    STAGE_NET_MIDI,
+    STAGE_CONTROLLER,
+    STAGE_JOYSTICK,
+    STAGE_DISPLAY,
+    STAGE_UDP,
+    NUM_STAGES
+};
+
+static void initLeds(void)
+{
+    LED_init(NUM_KEY_LEDS);
+}
+
+// What each stage comes after: what its init uses, and what its reactor
+// callbacks call, as those run as soon as it has started
+static const startupStage_t stages[NUM_STAGES] = {
+    [STAGE_LEDS] = {"leds", initLeds, 0, true},
+    [STAGE_AUDIO] = {"audio", audioGenerator_init, 0, true},
+    [STAGE_SOUNDS] = {"sounds", MidiController_loadSounds, 0, true},
+    [STAGE_MIDI_READER] = {"midi reader", MidiReader_init, 0, true},
+    [STAGE_NET_MIDI] = {"net midi", NetMidi_init, STARTUP_AFTER(STAGE_MIDI_READER), false},
+    [STAGE_CONTROLLER] = {"midi controller", MidiController_init,
+        STARTUP_AFTER(STAGE_LEDS) | STARTUP_AFTER(STAGE_AUDIO)
+        | STARTUP_AFTER(STAGE_SOUNDS) | STARTUP_AFTER(STAGE_MIDI_READER), true},
+    [STAGE_JOYSTICK] = {"joystick", Joystick_init, STARTUP_AFTER(STAGE_CONTROLLER), false},
+    [STAGE_DISPLAY] = {"segment display", SegmentDisplay_init, STARTUP_AFTER(STAGE_CONTROLLER), false},
+    [STAGE_UDP] = {"udp", UDP_init,
+        STARTUP_AFTER(STAGE_CONTROLLER) | STARTUP_AFTER(STAGE_NET_MIDI) | STARTUP_AFTER(STAGE_AUDIO), false},
+};
+
 int main(void){
-    LED_init();
-    Joystick_init();
-    audioGenerator_init();
-    MidiReader_init();
-    MidiController_init();
-    SegmentDisplay_init();
-    UDP_init();
-    Shutdown_init();
-
-	Shutdown_waitForShutdown();
+    long long startupNs = getMonotonicTimeInNs();
+    // Before anything counts: entries added earlier would not be shared
+    TIMED_INIT(StatsPage_init());
+    // Everything but audio runs on the reactor, so it comes first
+    TIMED_INIT(Reactor_init());
+    // Before any thread starts, so they all leave SIGUSR1 to the reactor
+    TIMED_INIT(Trace_init());
+    // Hardware or simulation: decides how every HAL module below starts
+    TIMED_INIT(HalBackend_init());
+    TIMED_INIT(Shutdown_init());
+    // File I/O the reactor hands off; after Trace_init() for the signal mask
+    TIMED_INIT(Worker_init());
+    printf("Startup: %-28s %7lld us\n", "before the stages", (getMonotonicTimeInNs() - startupNs) / 1000);
+
+    // The reactor runs the modules already started while the rest start
+    Startup_start(stages, NUM_STAGES);
+
+    // Runs until shutdown
+    Reactor_run();
+    // A stop during startup still leaves every module to clean up
+    Startup_wait();
     Shutdown_cleanup();
+    // Nothing posts once the reactor has stopped; finish what was posted
+    // while the modules it uses are still up
+    Worker_cleanup();
 
     UDP_cleanup();
     LED_cleanup();
     Joystick_cleanup();
     audioGenerator_cleanup();
+    NetMidi_cleanup();
     MidiReader_cleanup();
     MidiController_cleanup();
     SegmentDisplay_cleanup();
+    Trace_cleanup();
+    Reactor_cleanup();
+    HalBackend_cleanup();
+    StatsPage_cleanup();
 
     return 0;
     
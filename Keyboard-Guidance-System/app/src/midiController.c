@@ -4,17 +4,26 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
 
 #include "midiController.h"
 #include "parser.h"
+#include "arena.h"
 #include "timeDelay.h"
 #include "shutdown.h"
+#include "reactor.h"
 #include "hal/ledDriver.h"
+#include "hal/segDisplay.h"
 #include "hal/colours.h"
+#include "hal/trace.h"
+#include "hal/statsPage.h"
 
 #define MAX_NOTES 13
 
-static pthread_t midiThread;
+// Written when the song changes, so the LEDs are redrawn
+static int wakeFd = -1;
 static wavedata_t sounds[MAX_NOTES];
 
 // default start song
@@ -29,8 +38,65 @@ static bool newSongSetFlag;
 static enum note *parsedNotes;
 static StringArray parsedStringArray;
 
+// Every song is parsed at init, each into an arena of its own, so changing
+// song on the reactor only switches to another song's lines and notes.
+// Nothing is allocated in the arenas after init.
+typedef struct {
+    arena_t arena;
+    StringArray lines;
+    enum note *pNotes;
+} parsedSong_t;
+static parsedSong_t parsedSongs[NUM_SONGS];
+
 struct chord chord;
 
+// Status published for MidiController_getStatus(). Writers (the guidance
+// loop, and whoever changes song) serialise on statusMutex; readers never
+// lock. statusSeq is odd while an update is in progress.
+static midiControllerStatus_t status;
+static _Atomic uint32_t statusSeq;
+static pthread_mutex_t statusMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void beginStatusUpdate(void)
+{
+    pthread_mutex_lock(&statusMutex);
+    atomic_fetch_add_explicit(&statusSeq, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static void endStatusUpdate(void)
+{
+    status.changeCount++;
+    atomic_fetch_add_explicit(&statusSeq, 1, memory_order_release);
+    pthread_mutex_unlock(&statusMutex);
+}
+
+void MidiController_getStatus(midiControllerStatus_t *pStatus)
+{
+    while (true) {
+        uint32_t seq = atomic_load_explicit(&statusSeq, memory_order_acquire);
+        if (seq & 1) {
+            continue;
+        }
+        *pStatus = status;
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&statusSeq, memory_order_relaxed) == seq) {
+            return;
+        }
+    }
+}
+
+// Record a note the player just played
+static void publishNotePlayed(int note, bool isCorrect, long long noteTimeNs)
+{
+    beginStatusUpdate();
+    status.stepIndex = currentNoteToPlayedIndex;
+    status.lastNote = note;
+    status.wasLastNoteCorrect = isCorrect;
+    status.lastNoteLatencyUs = (getMonotonicTimeInNs() - noteTimeNs) / 1000;
+    endStatusUpdate();
+}
+
 // notes properties
 struct notes_map {
     enum note note;
@@ -84,68 +150,73 @@ static char* getFilePath(enum note note) {
     return "";
 }
 
-static void* midiControllerthreadFunction() {
-    // flag to keep of new notes to play
-//    testNotesFunction();
-    int playNote = 0;
-    bool alreadyPlayed = false;
-    // Clear all LEDs at the beginning of playBack in case there are some LEDs still on
-    turnOffAllLEDs();
-
-    // printf("First note to play: %s\n", MidiReader_noteToString(parsedNotes[currentNoteToPlayedIndex] + 60));
-    while(!Shutdown_isShutdown()) {
-
-        // if new song has been set
-        if(newSongSetFlag){
-            newSongSetFlag = false;
-            turnOffAllLEDs();
-        }
-
-        // Clear previous note LED
-        if (currentNoteToPlayedIndex != 0){
-            changeColourLED(CLEAR, parsedNotes[currentNoteToPlayedIndex - 1]);
+// Check a note the player has just played
+static void handlePlayedNote(void) {
+    noteToPlay = MidiReader_getNoteToPlay();
+    // play it 
+    audioGenerator_queueSound(&sounds[noteToPlay]);
+    //Check if note to play is the same as the expected note
+
+    // printf("Now play: %s\n", MidiReader_noteToString(parsedNotes[currentNoteToPlayedIndex] + 60));
+    // Light up the current note to play
+    if (noteToPlay == parsedNotes[currentNoteToPlayedIndex]){
+        currentNoteToPlayedIndex++;
+        publishNotePlayed(noteToPlay, true, MidiReader_getNoteTimeNs());
+        STATS_ADD("controller.notesCorrect", 1);
+        printf("Note played correctly! Moving on to next note: %s\n", MidiReader_noteToString(parsedNotes[currentNoteToPlayedIndex] + 60));
+        // printf("song index: %d, song size: %d\n", currentNoteToPlayedIndex, parsedStringArray.size);
+        
+        // If current note index exceed the buffer size, looping back
+        // IE the song is finished playing
+        if (currentNoteToPlayedIndex == parsedStringArray.size){
+            // reset it to whatever piece theyre playing right now
+            printf("Song finished! Looping back... \n");
+            LED_finishAnimation();
+            MidiController_setSong(currentSong);
         }
+    } 
+    // wrong note played, flash LEDs
+    else {
+        printf("Wrong note played! Please try again\n");
+        printf("Expected note: %s\n", MidiReader_noteToString(parsedNotes[currentNoteToPlayedIndex] + 60));
+        LED_triggerBlink(BRIGHT_RED, 13);
+        publishNotePlayed(noteToPlay, false, MidiReader_getNoteTimeNs());
+        STATS_ADD("controller.notesWrong", 1);
+    }
+}
 
-        // Light up the current note to play
-        changeColourLED(WHITE, parsedNotes[currentNoteToPlayedIndex]);
-
-        // theres a new note from midi reader that needs to be played
-        if (MidiReader_getNeedToPlayNote()) {
-            // play it 
-            noteToPlay = MidiReader_getNoteToPlay();
-            audioGenerator_queueSound(&sounds[noteToPlay]);
-            //Check if note to play is the same as the expected note
-
-            // printf("Now play: %s\n", MidiReader_noteToString(parsedNotes[currentNoteToPlayedIndex] + 60));
-            // Light up the current note to play
-            if (noteToPlay == parsedNotes[currentNoteToPlayedIndex]){
-                currentNoteToPlayedIndex++;
-                printf("Note played correctly! Moving on to next note: %s\n", MidiReader_noteToString(parsedNotes[currentNoteToPlayedIndex] + 60));
-                // printf("song index: %d, song size: %d\n", currentNoteToPlayedIndex, parsedStringArray.size);
-                
-                // If current note index exceed the buffer size, looping back
-                // IE the song is finished playing
-                if (currentNoteToPlayedIndex == parsedStringArray.size){
-                    // reset it to whatever piece theyre playing right now
-                    printf("Song finished! Looping back... \n");
-                    LED_finishAnimation();
-                    MidiController_setSong(currentSong);
-                }
-            } 
-            // wrong note played, flash LEDs
-            else {
-                printf("Wrong note played! Please try again\n");
-                printf("Expected note: %s\n", MidiReader_noteToString(parsedNotes[currentNoteToPlayedIndex] + 60));
-                LED_triggerBlink(BRIGHT_RED, 13);
-            }
+// Runs on the reactor when a note comes in from the MIDI reader, or the
+// song changes; nothing runs in between
+static void serviceController(int fd, uint32_t events, void *pContext) {
+    (void) events;
+    (void) pContext;
+    eventfd_t count;
+    eventfd_read(fd, &count);
+
+    // theres a new note from midi reader that needs to be played
+    if (MidiReader_getNeedToPlayNote()) {
+        TRACE_BEGIN("controller step");
+        handlePlayedNote();
+        // set the flag to false
+        MidiReader_setNeedToPlayNote(false);
+        // Someone is playing, so keep the song number lit
+        SegmentDisplay_wake();
+        TRACE_END("controller step");
+    }
 
-            // set the flag to false
-            MidiReader_setNeedToPlayNote(false);
-        }
+    // if new song has been set
+    if(newSongSetFlag){
+        newSongSetFlag = false;
+        turnOffAllLEDs();
+    }
 
-        sleepForMs(1);
+    // Clear previous note LED
+    if (currentNoteToPlayedIndex != 0){
+        changeColourLED(CLEAR, parsedNotes[currentNoteToPlayedIndex - 1]);
     }
-    return NULL;
+
+    // Light up the current note to play
+    changeColourLED(WHITE, parsedNotes[currentNoteToPlayedIndex]);
 }
 
 // function to check if the note has been played correctly
@@ -176,8 +247,17 @@ void MidiController_setNotePlayed(enum note inputNote) {
 }
 
 // init and cleanup
-void MidiController_init(void) {
+void MidiController_loadSounds(void) {
     loadWaveFiles();
+}
+
+void MidiController_init(void) {
+    for (int song = 0; song < NUM_SONGS; song++) {
+        parsedSong_t *pSong = &parsedSongs[song];
+        Arena_init(&pSong->arena, ARENA_DEFAULT_BLOCK_SIZE);
+        pSong->lines = Parser_parseFileByLineBreak(songList[song].songPath, &pSong->arena);
+        pSong->pNotes = Parse_parseStringArrayForNotes(pSong->lines, &pSong->arena);
+    }
 
     printf("Press Joystick left or right to cycle through songs!\n");
 
@@ -185,16 +265,27 @@ void MidiController_init(void) {
     int defaultSong = TWINKLE;
     
     // printf("First song: %s\n", songList[defaultSong].songName);
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeFd < 0) {
+        perror("ERROR: Unable to create MIDI controller eventfd");
+        exit(EXIT_FAILURE);
+    }
+    // Clears all LEDs in case there are some still on, then lights the
+    // first note, once the reactor runs. The song has to be set before
+    // notes are handled, as the reactor may already be running.
     MidiController_setSong(defaultSong);
-
-    newSongSetFlag = false;
-
-    pthread_create(&midiThread, NULL, midiControllerthreadFunction, NULL);
+    Reactor_addFd("midi controller notes", MidiReader_getNoteEventFd(), EPOLLIN, serviceController, NULL);
+    Reactor_addFd("midi controller songs", wakeFd, EPOLLIN, serviceController, NULL);
 }
 
 void MidiController_cleanup(void) {
-    pthread_join(midiThread, NULL);
+    Reactor_removeFd(MidiReader_getNoteEventFd());
+    Reactor_removeFd(wakeFd);
+    close(wakeFd);
     freeWaveFiles();
+    for (int song = 0; song < NUM_SONGS; song++) {
+        Arena_cleanup(&parsedSongs[song].arena);
+    }
     printf("midi controller cleanup done!\n");
 
 }
@@ -227,15 +318,32 @@ int MidiController_getCurrentSong(){
     return currentSong;
 }
 
+const char * MidiController_getSongName(int song){
+    assert(song >= 0 && song < NUM_SONGS);
+    return songList[song].songName;
+}
+
 // sets new song
 void MidiController_setSong(int newSong){
-    // get it as array from parser
+    // parsed at init, so no file is read here
     currentSong = newSong;
-    parsedStringArray = Parser_parseFileByLineBreak(songList[currentSong].songPath);
-    parsedNotes = Parse_parseStringArrayForNotes(parsedStringArray);
+    parsedStringArray = parsedSongs[currentSong].lines;
+    parsedNotes = parsedSongs[currentSong].pNotes;
     // reset index
     currentNoteToPlayedIndex = 0;
     newSongSetFlag = true;
+    eventfd_write(wakeFd, 1);
+    SegmentDisplay_wake();
+
+    beginStatusUpdate();
+    status.song = currentSong;
+    status.stepIndex = 0;
+    status.stepCount = parsedStringArray.size;
+    status.lastNote = -1;
+    status.wasLastNoteCorrect = false;
+    status.lastNoteLatencyUs = 0;
+    endStatusUpdate();
+
     printf("Song: %s\n", songList[currentSong].songName);
     printf("First note to play: %s\n", MidiReader_noteToString(parsedNotes[currentNoteToPlayedIndex] + 60));
 }
@@ -0,0 +1,351 @@
+// Module to take MIDI notes over UDP, through an adaptive jitter buffer
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "netMidi.h"
+#include "timeDelay.h"
+#include "reactor.h"
+#include "hal/midiReader.h"
+#include "hal/trace.h"
+#include "hal/statsPage.h"
+
+#define NS_PER_US 1000LL
+
+// Packets held at most; sequence numbers further ahead start a new stream
+#define BUFFER_SLOTS 64
+// Packets are held for this many times the jitter estimate, within limits
+#define JITTER_FACTOR 4
+#define MIN_PLAYOUT_DELAY_US 2000
+#define MAX_PLAYOUT_DELAY_US 100000
+// The fastest transit seen is re-measured over this many packets, so the
+// buffer follows clock drift and route changes instead of a stale minimum
+#define TRANSIT_WINDOW 256
+
+#define MIDI_STATUS_MASK 0xF0
+#define MIDI_NOTE_ON 0x90
+
+struct BufferedPacket {
+    bool isValid;
+    uint16_t seq;
+    uint32_t senderUs;
+    long long playoutNs;
+    bool wantsAck;
+    struct sockaddr_in sender;
+    int numEvents;
+    unsigned char events[NET_MIDI_MAX_EVENTS * NET_MIDI_EVENT_LEN];
+};
+
+static int socketFd = -1;
+static reactorTimer_t *pPlayoutTimer;
+
+// Jitter buffer, only touched on the reactor thread. A packet sits in the
+// slot for its sequence number until it is played out.
+static struct BufferedPacket buffer[BUFFER_SLOTS];
+static bool isStreamStarted;
+// Next packet to play out, and one past the newest received
+static uint16_t nextSeq;
+static uint16_t endSeq;
+
+// Sender clock, extended past the 32-bit wrap
+static uint32_t lastSenderUs;
+static long long senderNs;
+// Transit is arrival time minus sender time: both clocks have their own
+// epoch, so only its changes mean anything
+static long long baseTransitNs;
+static long long windowMinTransitNs;
+static int windowCount;
+static long long lastTransitNs;
+// Mean deviation of transit, as RTP receivers estimate it
+static long long jitterNs;
+
+static netMidiStats_t stats;
+static pthread_mutex_t statsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint16_t getLe16(const unsigned char *pBuffer)
+{
+    return pBuffer[0] | (pBuffer[1] << 8);
+}
+
+static uint32_t getLe32(const unsigned char *pBuffer)
+{
+    return getLe16(pBuffer) | ((uint32_t) getLe16(pBuffer + 2) << 16);
+}
+
+static long long getPlayoutDelayNs(void)
+{
+    long long delayNs = JITTER_FACTOR * jitterNs;
+    if (delayNs < MIN_PLAYOUT_DELAY_US * NS_PER_US) {
+        delayNs = MIN_PLAYOUT_DELAY_US * NS_PER_US;
+    } else if (delayNs > MAX_PLAYOUT_DELAY_US * NS_PER_US) {
+        delayNs = MAX_PLAYOUT_DELAY_US * NS_PER_US;
+    }
+    return delayNs;
+}
+
+// First packet, or the sender restarted: forget what is buffered
+static void startStream(uint16_t seq, uint32_t senderUs, long long transitNs)
+{
+    for (int i = 0; i < BUFFER_SLOTS; i++) {
+        buffer[i].isValid = false;
+    }
+    isStreamStarted = true;
+    nextSeq = seq;
+    endSeq = seq;
+    lastSenderUs = senderUs;
+    senderNs = senderUs * NS_PER_US;
+    baseTransitNs = transitNs;
+    windowMinTransitNs = transitNs;
+    windowCount = 0;
+    lastTransitNs = transitNs;
+    jitterNs = 0;
+}
+
+static void updateTransit(long long transitNs)
+{
+    long long deviationNs = llabs(transitNs - lastTransitNs);
+    jitterNs += (deviationNs - jitterNs) / 16;
+    lastTransitNs = transitNs;
+    STATS_SET("netMidi.jitterUs", jitterNs / NS_PER_US);
+
+    if (transitNs < baseTransitNs) {
+        baseTransitNs = transitNs;
+    }
+    if (transitNs < windowMinTransitNs) {
+        windowMinTransitNs = transitNs;
+    }
+    if (++windowCount == TRANSIT_WINDOW) {
+        baseTransitNs = windowMinTransitNs;
+        windowMinTransitNs = LLONG_MAX;
+        windowCount = 0;
+    }
+}
+
+// Validate a datagram and put it in its slot. Caller holds statsMutex.
+static void bufferPacket(const unsigned char *pData, int length,
+    const struct sockaddr_in *pSender, long long arrivalNs)
+{
+    if (length < NET_MIDI_HEADER_LEN
+            || pData[0] != NET_MIDI_MAGIC
+            || pData[1] != NET_MIDI_VERSION
+            || pData[3] > NET_MIDI_MAX_EVENTS
+            || length < NET_MIDI_HEADER_LEN + pData[3] * NET_MIDI_EVENT_LEN) {
+        stats.packetsMalformed++;
+        return;
+    }
+    uint16_t seq = getLe16(&pData[4]);
+    uint32_t senderUs = getLe32(&pData[8]);
+    stats.packetsReceived++;
+    STATS_ADD("netMidi.packetsReceived", 1);
+
+    int16_t ahead = seq - nextSeq;
+    if (!isStreamStarted || ahead >= BUFFER_SLOTS || ahead < -BUFFER_SLOTS) {
+        startStream(seq, senderUs, arrivalNs - senderUs * NS_PER_US);
+        ahead = 0;
+    }
+    if (ahead < 0) {
+        stats.packetsLate++;
+        STATS_ADD("netMidi.packetsLate", 1);
+        return;
+    }
+    struct BufferedPacket *pSlot = &buffer[seq % BUFFER_SLOTS];
+    if (pSlot->isValid) {
+        stats.packetsDuplicate++;
+        return;
+    }
+
+    // Packets can arrive out of order, so step the clock by the signed difference
+    senderNs += (int32_t) (senderUs - lastSenderUs) * NS_PER_US;
+    lastSenderUs = senderUs;
+    updateTransit(arrivalNs - senderNs);
+
+    pSlot->isValid = true;
+    pSlot->seq = seq;
+    pSlot->senderUs = senderUs;
+    pSlot->playoutNs = senderNs + baseTransitNs + getPlayoutDelayNs();
+    pSlot->wantsAck = (pData[2] & NET_MIDI_FLAG_ACK) != 0;
+    pSlot->sender = *pSender;
+    pSlot->numEvents = pData[3];
+    memcpy(pSlot->events, &pData[NET_MIDI_HEADER_LEN], pData[3] * NET_MIDI_EVENT_LEN);
+    if ((int16_t) (seq + 1 - endSeq) > 0) {
+        endSeq = seq + 1;
+    }
+}
+
+static void sendAck(const struct BufferedPacket *pPacket)
+{
+    unsigned char ack[NET_MIDI_HEADER_LEN] = {
+        NET_MIDI_ACK_MAGIC, NET_MIDI_VERSION, 0, 0,
+        pPacket->seq & 0xFF, pPacket->seq >> 8, 0, 0,
+        pPacket->senderUs & 0xFF, (pPacket->senderUs >> 8) & 0xFF,
+        (pPacket->senderUs >> 16) & 0xFF, pPacket->senderUs >> 24,
+    };
+    // Best effort, like the packets themselves
+    sendto(socketFd, ack, sizeof(ack), MSG_DONTWAIT,
+        (const struct sockaddr *) &pPacket->sender, sizeof(pPacket->sender));
+}
+
+// Note-ons go to the controller the same way the local keyboard's do;
+// other messages are ignored, as they are for the keyboard.
+static void playPacket(const struct BufferedPacket *pPacket)
+{
+    TRACE_INSTANT("net midi playout", pPacket->seq);
+    for (int i = 0; i < pPacket->numEvents; i++) {
+        const unsigned char *pEvent = &pPacket->events[i * NET_MIDI_EVENT_LEN];
+        bool isNoteOn = (pEvent[0] & MIDI_STATUS_MASK) == MIDI_NOTE_ON && pEvent[2] > 0;
+        if (isNoteOn && !MidiReader_submitNote(pEvent[1])) {
+            stats.notesDropped++;
+        }
+    }
+    if (pPacket->wantsAck) {
+        sendAck(pPacket);
+    }
+    stats.packetsPlayed++;
+}
+
+// When the first packet after a gap is due, as the gap is there
+static long long getNextPlayoutNs(void)
+{
+    for (uint16_t seq = nextSeq; seq != endSeq; seq++) {
+        if (buffer[seq % BUFFER_SLOTS].isValid) {
+            return buffer[seq % BUFFER_SLOTS].playoutNs;
+        }
+    }
+    return LLONG_MAX;
+}
+
+// Play out everything that is due, in sequence order. A missing packet is
+// waited for until the one after it is due, then counted lost.
+// Returns when the next packet is due, or -1 if the buffer is empty.
+// Caller holds statsMutex.
+static long long playDuePackets(long long nowNs)
+{
+    while (nextSeq != endSeq) {
+        struct BufferedPacket *pSlot = &buffer[nextSeq % BUFFER_SLOTS];
+        if (pSlot->isValid) {
+            if (pSlot->playoutNs > nowNs) {
+                return pSlot->playoutNs;
+            }
+            playPacket(pSlot);
+            pSlot->isValid = false;
+        } else {
+            long long nextPlayoutNs = getNextPlayoutNs();
+            if (nextPlayoutNs > nowNs) {
+                return nextPlayoutNs;
+            }
+            stats.packetsLost++;
+            STATS_ADD("netMidi.packetsLost", 1);
+        }
+        nextSeq++;
+    }
+    return -1;
+}
+
+// Play out what is due, and set the timer for whatever is next
+static void servicePlayout(void *pContext)
+{
+    (void) pContext;
+    pthread_mutex_lock(&statsMutex);
+    long long nextPlayoutNs = playDuePackets(getMonotonicTimeInNs());
+    pthread_mutex_unlock(&statsMutex);
+    if (nextPlayoutNs >= 0) {
+        Reactor_armTimer(pPlayoutTimer, nextPlayoutNs, 0);
+    } else {
+        Reactor_disarmTimer(pPlayoutTimer);
+    }
+}
+
+static void receivePackets(int fd, uint32_t events, void *pContext)
+{
+    (void) events;
+    (void) pContext;
+    unsigned char packet[NET_MIDI_MAX_PACKET_LEN];
+    while (true) {
+        struct sockaddr_in sender;
+        socklen_t senderLength = sizeof(sender);
+        int length = recvfrom(fd, packet, sizeof(packet), MSG_DONTWAIT,
+            (struct sockaddr *) &sender, &senderLength);
+        if (length < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("Net MIDI: receive error");
+            }
+            break;
+        }
+        long long arrivalNs = getMonotonicTimeInNs();
+        pthread_mutex_lock(&statsMutex);
+        bufferPacket(packet, length, &sender, arrivalNs);
+        pthread_mutex_unlock(&statsMutex);
+    }
+    servicePlayout(NULL);
+}
+
+void NetMidi_getStats(netMidiStats_t *pStats)
+{
+    pthread_mutex_lock(&statsMutex);
+    *pStats = stats;
+    pStats->jitterUs = jitterNs / NS_PER_US;
+    pStats->playoutDelayUs = getPlayoutDelayNs() / NS_PER_US;
+    pthread_mutex_unlock(&statsMutex);
+}
+
+// init and cleanup functions
+void NetMidi_init(void)
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(NET_MIDI_PORT);
+
+    socketFd = socket(PF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (socketFd < 0) {
+        perror("Net MIDI: unable to create socket");
+        exit(EXIT_FAILURE);
+    }
+    if (bind(socketFd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        perror("Net MIDI: unable to bind");
+        exit(EXIT_FAILURE);
+    }
+
+    // So the stats page shows them at 0 rather than not at all
+    STATS_ADD("netMidi.packetsReceived", 0);
+    STATS_ADD("netMidi.packetsLost", 0);
+    STATS_ADD("netMidi.packetsLate", 0);
+
+    // Packets arm the playout timer, so it has to exist first
+    pPlayoutTimer = Reactor_addTimer("net midi playout", servicePlayout, NULL);
+    Reactor_addFd("net midi", socketFd, EPOLLIN, receivePackets, NULL);
+}
+
+void NetMidi_cleanup(void)
+{
+    Reactor_removeTimer(pPlayoutTimer);
+    Reactor_removeFd(socketFd);
+    close(socketFd);
+
+    netMidiStats_t finalStats;
+    NetMidi_getStats(&finalStats);
+    if (finalStats.packetsReceived > 0) {
+        printf("Net MIDI: %llu received, %llu played, %llu lost, %llu late, "
+            "%llu duplicate, %llu malformed, %llu notes dropped; "
+            "jitter %d us, playout delay %d us\n",
+            (unsigned long long) finalStats.packetsReceived,
+            (unsigned long long) finalStats.packetsPlayed,
+            (unsigned long long) finalStats.packetsLost,
+            (unsigned long long) finalStats.packetsLate,
+            (unsigned long long) finalStats.packetsDuplicate,
+            (unsigned long long) finalStats.packetsMalformed,
+            (unsigned long long) finalStats.notesDropped,
+            finalStats.jitterUs, finalStats.playoutDelayUs);
+    }
+    printf("Net MIDI cleanup done\n");
+}
@@ -69,50 +69,45 @@ static void trimWhitespace(char *str) {
 }
 
 // creates a chord from a given line
-static struct chord* createChord(enum note* notes, int numNotes) {
-    struct chord* chord = (struct chord*)malloc(sizeof(struct chord));
-    if (chord == NULL) {
-        fprintf(stderr, "Memory allocation failed for chord.\n");
-        return NULL;
-    }
-
+static struct chord* createChord(enum note* notes, int numNotes, pool_t *pChordPool) {
+    struct chord* chord = Pool_alloc(pChordPool);
     chord->currentNotes = notes;
     chord->numNotes = numNotes;
+    chord->isNotePlayed = false;
 
     return chord;
 }
 
 // parse each txt file by new line 
 // gets all the notes that need to be played in one line (chord or individual)
-StringArray Parser_parseFileByLineBreak(char *filePath){
+StringArray Parser_parseFileByLineBreak(const char *filePath, arena_t *pArena){
     // initialize variables
     FILE *file;
     char line[MAX_LINE_LENGTH];
     int index = 0;
-    
-    // open the file for reading
-    file = fopen(filePath, "r");
-    if (file == NULL) {
-        fprintf(stderr, "Error opening file.\n");
-    }
 
     // init StringArray to store each line
     StringArray lines;
-    lines.size = MAX_LINES;
-    lines.lines = (char**)malloc((lines.size + 1) * sizeof(char*));
+    lines.size = 0;
+    lines.lines = Arena_alloc(pArena, (MAX_LINES + 1) * sizeof(char*));
    
    // initialize default value for each element of the lines array
     for (int i = 0; i < MAX_LINES + 1; i++) {
         lines.lines[i] = "";
     }
+
+    // open the file for reading
+    file = fopen(filePath, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Error opening file %s.\n", filePath);
+        return lines;
+    }
  
-    // Read and parse lines until end of file
-    while(fgets(line, sizeof(line), file)) {
-        lines.lines[index] = malloc(strlen(line) + 1); // +1 for null terminator
-    
+    // Read and parse lines until end of file, or the array is full
+    while(index < MAX_LINES && fgets(line, sizeof(line), file)) {
         // get rid of space or line break characters(if any)
         trimWhitespace(line);
-        strcpy(lines.lines[index], line);
+        lines.lines[index] = Arena_strdup(pArena, line);
         index++;
         lines.size = index;
     }
@@ -125,62 +120,58 @@ StringArray Parser_parseFileByLineBreak(char *filePath){
 }
 
 // take in an array of strings and map each string to its enum value
-enum note* Parse_parseStringArrayForNotes(StringArray stringArray){
+enum note* Parse_parseStringArrayForNotes(StringArray stringArray, arena_t *pArena){
     // set up notes array to keep the notes
-    enum note* notesArray = (enum note*)malloc((stringArray.size + 1) * sizeof(enum note));
+    enum note* notesArray = Arena_alloc(pArena, (stringArray.size + 1) * sizeof(enum note));
     // printf("During init, the string array size is: %d\n", stringArray.size);
 
     // go through each element of the string array and convert raw string data to appropriate enum value
     for (int i = 0; i < stringArray.size; i++){
         notesArray[i] = stringToNote(stringArray.lines[i]);
     }
+    // nothing to play past the end
+    notesArray[stringArray.size] = NUM_OF_NOTES;
     // printf("After init notesArray, size: %d\n", notesArray.size);
     return notesArray;
 }
 
 // take in array of string, parse each element of the array by comma to seperate string 
 // create a cord from each line of the text file
-struct chord** Parser_parseStringArrayForChords(StringArray stringArray) {
-    // Allocate memory for the array of chord pointers (Remember to clean up array of chord pointers when exit)
-    struct chord** chords = (struct chord**)malloc((stringArray.size + 1) * sizeof(struct chord*));
-    if (chords == NULL) {
-        fprintf(stderr, "Memory allocation failed for chords array.\n");
-        return NULL;
-    }
+struct chord** Parser_parseStringArrayForChords(StringArray stringArray, arena_t *pArena, pool_t *pChordPool) {
+    struct chord** chords = Arena_alloc(pArena, (stringArray.size + 1) * sizeof(struct chord*));
 
-    // free chords if notes array allocation fail
     for (int i = 0; i < stringArray.size; i++) {
+        // collect the line's notes, then keep only as many as it has
+        enum note lineNotes[MAX_NOTES];
         int numNotes = 0;
-        // clean up when program is finished
-        enum note* notesArray = (enum note*)malloc((stringArray.size + 1) * sizeof(enum note));
-        if (notesArray == NULL) {
-            fprintf(stderr, "Memory allocation failed.\n");
-            // free previously allocated memory
-            for (int j = 0; j < i; j++) {
-                free(chords[j]);
-            }
-            free(chords);
-            return NULL;
-        }
 
         // parse a string by comma
         char *token = strtok(stringArray.lines[i], ","); 
-        while(token != NULL) {
+        while(token != NULL && numNotes < MAX_NOTES) {
             // get rid of line break character (if any)
             trimWhitespace(token);  
             // convert string to enum
             enum note currentNote = stringToNote(token); 
             // only push if it is a valid note
             if (currentNote != NUM_OF_NOTES) {  
-                notesArray[numNotes++] = currentNote; 
+                lineNotes[numNotes++] = currentNote; 
             }
             token = strtok(NULL, ",");
         }
 
+        enum note* notesArray = Arena_alloc(pArena, numNotes * sizeof(enum note));
+        memcpy(notesArray, lineNotes, numNotes * sizeof(enum note));
+
         // create new chords out of notes in the same line
-        struct chord* currentChord = createChord(notesArray, numNotes);
-        chords[i] = currentChord; 
+        chords[i] = createChord(notesArray, numNotes, pChordPool);
     }
+    chords[stringArray.size] = NULL;
 
     return chords;
-}
\ No newline at end of file
+}
+
+void Parser_releaseChords(struct chord **chords, int numChords, pool_t *pChordPool) {
+    for (int i = 0; i < numChords; i++) {
+        Pool_release(pChordPool, chords[i]);
+    }
+}
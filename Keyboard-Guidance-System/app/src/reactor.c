@@ -0,0 +1,265 @@
+// Module to run all non-audio work on one thread, from one epoll set
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include "reactor.h"
+#include "shutdown.h"
+#include "timeDelay.h"
+#include "hal/trace.h"
+#include "hal/statsPage.h"
+
+#define MAX_HANDLERS 32
+// Ready fds taken per epoll_wait
+#define MAX_EVENTS 16
+#define NS_PER_SECOND 1000000000LL
+
+struct reactorTimer {
+    reactorTimerCallback_t callback;
+    void *pContext;
+    uint64_t expirations;
+};
+
+struct Handler {
+    bool isActive;
+    const char *name;
+    int fd;
+    reactorFdCallback_t callback;
+    void *pContext;
+    // Set for timers: fd is then its timerfd
+    struct reactorTimer *pTimer;
+    // Time spent in the callback, to find anything holding up the loop
+    uint16_t traceNameId;
+    long long calls;
+    long long totalNs;
+    long long maxNs;
+};
+
+static int epollFd = -1;
+static struct Handler handlers[MAX_HANDLERS];
+static struct reactorTimer timers[MAX_HANDLERS];
+// Handlers are added from module init on other threads
+static pthread_mutex_t handlersMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static long long wakeups;
+static long long runStartNs;
+static long long runNs;
+
+// A timer callback makes it a timer, run through runTimer()
+static void runTimer(int fd, uint32_t events, void *pContext);
+
+static struct Handler *addHandler(const char *name, int fd, uint32_t events,
+    reactorFdCallback_t callback, reactorTimerCallback_t timerCallback, void *pContext)
+{
+    pthread_mutex_lock(&handlersMutex);
+    struct Handler *pHandler = NULL;
+    for (int i = 0; i < MAX_HANDLERS; i++) {
+        if (!handlers[i].isActive) {
+            pHandler = &handlers[i];
+            break;
+        }
+    }
+    if (pHandler == NULL) {
+        printf("ERROR: Reactor is out of handlers adding %s\n", name);
+        exit(EXIT_FAILURE);
+    }
+    *pHandler = (struct Handler) {
+        .isActive = true,
+        .name = name,
+        .fd = fd,
+        .callback = callback,
+        .pContext = pContext,
+        .traceNameId = Trace_registerName(name),
+    };
+    // Set up before epoll can report it: the reactor may already be running
+    if (timerCallback != NULL) {
+        // Timers share the handler's slot number
+        struct reactorTimer *pTimer = &timers[pHandler - handlers];
+        *pTimer = (struct reactorTimer) {.callback = timerCallback, .pContext = pContext};
+        pHandler->callback = runTimer;
+        pHandler->pContext = pTimer;
+        pHandler->pTimer = pTimer;
+    }
+    pthread_mutex_unlock(&handlersMutex);
+
+    struct epoll_event event = {.events = events, .data.ptr = pHandler};
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        perror("ERROR: Reactor unable to watch fd");
+        exit(EXIT_FAILURE);
+    }
+    return pHandler;
+}
+
+static struct Handler *findHandler(int fd)
+{
+    for (int i = 0; i < MAX_HANDLERS; i++) {
+        if (handlers[i].isActive && handlers[i].fd == fd) {
+            return &handlers[i];
+        }
+    }
+    return NULL;
+}
+
+void Reactor_addFd(const char *name, int fd, uint32_t events,
+    reactorFdCallback_t callback, void *pContext)
+{
+    addHandler(name, fd, events, callback, NULL, pContext);
+}
+
+void Reactor_removeFd(int fd)
+{
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, NULL);
+    pthread_mutex_lock(&handlersMutex);
+    struct Handler *pHandler = findHandler(fd);
+    if (pHandler != NULL) {
+        pHandler->isActive = false;
+    }
+    pthread_mutex_unlock(&handlersMutex);
+}
+
+static void runTimer(int fd, uint32_t events, void *pContext)
+{
+    (void) events;
+    struct reactorTimer *pTimer = pContext;
+    uint64_t expirations;
+    // Nothing to read if it was re-armed since it became ready
+    if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+        return;
+    }
+    pTimer->expirations = expirations;
+    pTimer->callback(pTimer->pContext);
+}
+
+reactorTimer_t *Reactor_addTimer(const char *name, reactorTimerCallback_t callback, void *pContext)
+{
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0) {
+        perror("ERROR: Reactor unable to create timer");
+        exit(EXIT_FAILURE);
+    }
+    return addHandler(name, fd, EPOLLIN, NULL, callback, pContext)->pTimer;
+}
+
+static int getTimerFd(const reactorTimer_t *pTimer)
+{
+    return handlers[pTimer - timers].fd;
+}
+
+void Reactor_armTimer(reactorTimer_t *pTimer, long long deadlineNs, long long intervalNs)
+{
+    // A zero it_value would disarm it, so an overdue deadline becomes "now"
+    if (deadlineNs <= 0) {
+        deadlineNs = 1;
+    }
+    struct itimerspec spec = {
+        .it_value = {.tv_sec = deadlineNs / NS_PER_SECOND, .tv_nsec = deadlineNs % NS_PER_SECOND},
+        .it_interval = {.tv_sec = intervalNs / NS_PER_SECOND, .tv_nsec = intervalNs % NS_PER_SECOND},
+    };
+    if (timerfd_settime(getTimerFd(pTimer), TFD_TIMER_ABSTIME, &spec, NULL) < 0) {
+        perror("ERROR: Reactor unable to arm timer");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void Reactor_disarmTimer(reactorTimer_t *pTimer)
+{
+    struct itimerspec spec = {0};
+    timerfd_settime(getTimerFd(pTimer), 0, &spec, NULL);
+}
+
+uint64_t Reactor_getTimerExpirations(const reactorTimer_t *pTimer)
+{
+    return pTimer->expirations;
+}
+
+void Reactor_removeTimer(reactorTimer_t *pTimer)
+{
+    int fd = getTimerFd(pTimer);
+    Reactor_removeFd(fd);
+    close(fd);
+}
+
+static void dispatch(struct Handler *pHandler, uint32_t events)
+{
+    long long startNs = getMonotonicTimeInNs();
+    TRACE_EVENT_ID(pHandler->traceNameId, TRACE_PHASE_BEGIN, 0);
+    pHandler->callback(pHandler->fd, events, pHandler->pContext);
+    TRACE_EVENT_ID(pHandler->traceNameId, TRACE_PHASE_END, 0);
+    long long elapsedNs = getMonotonicTimeInNs() - startNs;
+
+    pHandler->calls++;
+    pHandler->totalNs += elapsedNs;
+    if (elapsedNs > pHandler->maxNs) {
+        pHandler->maxNs = elapsedNs;
+    }
+}
+
+void Reactor_run(void)
+{
+    int shutdownFd = Shutdown_getEventFd();
+    struct epoll_event shutdownEvent = {.events = EPOLLIN, .data.ptr = NULL};
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, shutdownFd, &shutdownEvent);
+
+    runStartNs = getMonotonicTimeInNs();
+    while (!Shutdown_isShutdown()) {
+        struct epoll_event ready[MAX_EVENTS];
+        int numReady = epoll_wait(epollFd, ready, MAX_EVENTS, -1);
+        if (numReady < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("ERROR: Reactor epoll_wait failed");
+            exit(EXIT_FAILURE);
+        }
+        wakeups++;
+        STATS_ADD("reactor.wakeups", 1);
+        for (int i = 0; i < numReady; i++) {
+            struct Handler *pHandler = ready[i].data.ptr;
+            // An earlier callback in this batch may have removed it
+            if (pHandler != NULL && pHandler->isActive) {
+                dispatch(pHandler, ready[i].events);
+            }
+        }
+    }
+    runNs = getMonotonicTimeInNs() - runStartNs;
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, shutdownFd, NULL);
+}
+
+// init and cleanup functions
+void Reactor_init(void)
+{
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd < 0) {
+        perror("ERROR: Unable to create reactor epoll");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void Reactor_cleanup(void)
+{
+    long long runMs = runNs / 1000000;
+    if (runMs > 0) {
+        printf("Reactor: %lld wakeups in %lld ms (%lld/s)\n", wakeups, runMs, wakeups * 1000 / runMs);
+    }
+    for (int i = 0; i < MAX_HANDLERS; i++) {
+        struct Handler *pHandler = &handlers[i];
+        if (pHandler->calls > 0) {
+            printf("Reactor: %-20s %8lld calls, mean %lld us, max %lld us\n",
+                pHandler->name, pHandler->calls,
+                pHandler->totalNs / pHandler->calls / 1000, pHandler->maxNs / 1000);
+        }
+        if (pHandler->isActive && pHandler->pTimer != NULL) {
+            close(pHandler->fd);
+        }
+        pHandler->isActive = false;
+    }
+    close(epollFd);
+    epollFd = -1;
+}
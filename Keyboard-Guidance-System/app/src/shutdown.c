@@ -6,10 +6,30 @@
 #include <unistd.h>
 #include <string.h>
 #include <stdbool.h>
+#include <sys/eventfd.h>
 
 _Atomic bool stop = false;
 static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 
+// Created on first use, as modules may ask for it before Shutdown_init()
+static int shutdownFd = -1;
+static pthread_once_t shutdownFdOnce = PTHREAD_ONCE_INIT;
+
+static void createShutdownFd(void)
+{
+    shutdownFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (shutdownFd == -1) {
+        perror("ERROR: Unable to create shutdown eventfd");
+        exit(EXIT_FAILURE);
+    }
+}
+
+int Shutdown_getEventFd(void)
+{
+    pthread_once(&shutdownFdOnce, createShutdownFd);
+    return shutdownFd;
+}
+
 // Initialize/cleanup shutdown module
 void Shutdown_init(void){
     pthread_mutex_lock(&mutex);
@@ -20,6 +40,7 @@ void Shutdown_cleanup(void){
 // Signals shutdown
 void Shutdown_triggerShutdown(void){
     stop = true;
+    eventfd_write(Shutdown_getEventFd(), 1);
     pthread_mutex_unlock(&mutex);
 }
 
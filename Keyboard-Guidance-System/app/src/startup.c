@@ -0,0 +1,232 @@
+// Module to start the other modules in dependency order, on worker threads
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "startup.h"
+#include "timeDelay.h"
+#include "hal/trace.h"
+
+// Most stages wait on a file, a child process or the kernel, not the CPU
+#define NUM_WORKERS 4
+
+struct StageState {
+    bool isStarted;
+    // When its dependencies were done, and when it ran, from startNs
+    long long readyNs;
+    long long beginNs;
+    long long endNs;
+    int worker;
+    uint16_t traceNameId;
+};
+
+static const startupStage_t *pStages;
+static int numStages;
+static struct StageState states[STARTUP_MAX_STAGES];
+static uint32_t doneStages;
+static uint32_t readyStages;
+static long long startNs;
+static long long readyNs = -1;
+
+// Guards everything above once the workers are running
+static pthread_mutex_t stagesMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stageDone = PTHREAD_COND_INITIALIZER;
+static pthread_t workers[NUM_WORKERS];
+
+static uint32_t allStages(void)
+{
+    return numStages == STARTUP_MAX_STAGES ? UINT32_MAX : ((uint32_t) 1 << numStages) - 1;
+}
+
+// Every stage has to be reachable: no dependency on itself, on a later
+// stage that loops back, or on one that does not exist
+static void checkStages(void)
+{
+    uint32_t reachable = 0;
+    bool isProgress = true;
+    while (isProgress) {
+        isProgress = false;
+        for (int i = 0; i < numStages; i++) {
+            uint32_t bit = STARTUP_AFTER(i);
+            if (!(reachable & bit) && (pStages[i].after & ~reachable) == 0) {
+                reachable |= bit;
+                isProgress = true;
+            }
+        }
+    }
+    for (int i = 0; i < numStages; i++) {
+        if (!(reachable & STARTUP_AFTER(i))) {
+            printf("ERROR: Startup stage %s can never run, check what it comes after\n",
+                pStages[i].name);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+// Tell systemd, if it started us as a Type=notify service
+static void notifySystemd(void)
+{
+    const char *socketPath = getenv("NOTIFY_SOCKET");
+    if (socketPath == NULL) {
+        return;
+    }
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    size_t length = strlen(socketPath);
+    if (length == 0 || length >= sizeof(addr.sun_path)) {
+        return;
+    }
+    memcpy(addr.sun_path, socketPath, length);
+    // '@' stands for an abstract socket
+    if (addr.sun_path[0] == '@') {
+        addr.sun_path[0] = '\0';
+    }
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("Startup: unable to create notify socket");
+        return;
+    }
+    const char message[] = "READY=1";
+    if (sendto(fd, message, sizeof(message) - 1, 0, (struct sockaddr *) &addr,
+            offsetof(struct sockaddr_un, sun_path) + length) < 0) {
+        perror("Startup: unable to notify systemd");
+    }
+    close(fd);
+}
+
+// Called with stagesMutex held, by whichever worker finished the last
+// stage needed
+static void signalReady(long long nowNs)
+{
+    readyNs = nowNs - startNs;
+    TRACE_INSTANT("startup ready", (uint32_t) (readyNs / 1000));
+    printf("Startup: ready to play %lld us after the stages started\n", readyNs / 1000);
+    notifySystemd();
+}
+
+static void printReport(void)
+{
+    long long serialNs = 0;
+    for (int i = 0; i < numStages; i++) {
+        const struct StageState *pState = &states[i];
+        long long runNs = pState->endNs - pState->beginNs;
+        serialNs += runNs;
+        printf("Startup: %-20s %7lld us, from %7lld us, waited %6lld us for a worker (init %d)\n",
+            pStages[i].name, runNs / 1000, pState->beginNs / 1000,
+            (pState->beginNs - pState->readyNs) / 1000, pState->worker);
+    }
+    long long totalNs = getMonotonicTimeInNs() - startNs;
+    printf("Startup: %-20s %7lld us, %lld us one after the other\n", "all stages",
+        totalNs / 1000, serialNs / 1000);
+}
+
+// Stage whose dependencies are all done, or -1
+static int findRunnableStage(void)
+{
+    for (int i = 0; i < numStages; i++) {
+        if (!states[i].isStarted && (pStages[i].after & ~doneStages) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void *workerThread(void *pArg)
+{
+    int worker = (int) (intptr_t) pArg;
+    char threadName[16];
+    snprintf(threadName, sizeof(threadName), "init %d", worker);
+    pthread_setname_np(pthread_self(), threadName);
+
+    pthread_mutex_lock(&stagesMutex);
+    while (doneStages != allStages()) {
+        int stage = findRunnableStage();
+        if (stage < 0) {
+            // Everything left is running, or waiting on something running
+            pthread_cond_wait(&stageDone, &stagesMutex);
+            continue;
+        }
+        struct StageState *pState = &states[stage];
+        pState->isStarted = true;
+        pState->worker = worker;
+        pState->beginNs = getMonotonicTimeInNs() - startNs;
+        pthread_mutex_unlock(&stagesMutex);
+
+        TRACE_EVENT_ID(pState->traceNameId, TRACE_PHASE_BEGIN, 0);
+        pStages[stage].init();
+        TRACE_EVENT_ID(pState->traceNameId, TRACE_PHASE_END, 0);
+
+        pthread_mutex_lock(&stagesMutex);
+        long long nowNs = getMonotonicTimeInNs();
+        pState->endNs = nowNs - startNs;
+        doneStages |= STARTUP_AFTER(stage);
+        // Whatever this stage was holding up can go now
+        for (int i = 0; i < numStages; i++) {
+            if (!states[i].isStarted && (pStages[i].after & ~doneStages) == 0
+                    && states[i].readyNs == 0) {
+                states[i].readyNs = pState->endNs;
+            }
+        }
+        if (readyNs < 0 && (readyStages & ~doneStages) == 0) {
+            signalReady(nowNs);
+        }
+        if (doneStages == allStages()) {
+            printReport();
+        }
+        pthread_cond_broadcast(&stageDone);
+    }
+    pthread_mutex_unlock(&stagesMutex);
+    return NULL;
+}
+
+void Startup_start(const startupStage_t *pStagesToRun, int numStagesToRun)
+{
+    if (numStagesToRun < 1 || numStagesToRun > STARTUP_MAX_STAGES) {
+        printf("ERROR: Startup needs 1 to %d stages, not %d\n", STARTUP_MAX_STAGES, numStagesToRun);
+        exit(EXIT_FAILURE);
+    }
+    pStages = pStagesToRun;
+    numStages = numStagesToRun;
+    checkStages();
+
+    doneStages = 0;
+    readyStages = 0;
+    readyNs = -1;
+    memset(states, 0, sizeof(states));
+    for (int i = 0; i < numStages; i++) {
+        states[i].traceNameId = Trace_registerName(pStages[i].name);
+        if (pStages[i].isNeededForReady) {
+            readyStages |= STARTUP_AFTER(i);
+        }
+    }
+
+    startNs = getMonotonicTimeInNs();
+    for (int i = 0; i < NUM_WORKERS; i++) {
+        if (pthread_create(&workers[i], NULL, workerThread, (void *) (intptr_t) i) != 0) {
+            printf("ERROR: Unable to start startup worker %d\n", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+void Startup_wait(void)
+{
+    for (int i = 0; i < NUM_WORKERS; i++) {
+        pthread_join(workers[i], NULL);
+    }
+}
+
+long long Startup_getReadyUs(void)
+{
+    pthread_mutex_lock(&stagesMutex);
+    long long readyUs = readyNs < 0 ? -1 : readyNs / 1000;
+    pthread_mutex_unlock(&stagesMutex);
+    return readyUs;
+}
@@ -32,4 +32,11 @@ long long getTimeInMs(void){
     long long nanoSeconds = spec.tv_nsec;
     long long milliSeconds = seconds * 1000 + nanoSeconds / 1000000;
     return milliSeconds;
-}
\ No newline at end of file
+}
+
+// Get monotonic time; unaffected by changes to the wall clock
+long long getMonotonicTimeInNs(void){
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return (long long) spec.tv_sec * 1000000000LL + spec.tv_nsec;
+}
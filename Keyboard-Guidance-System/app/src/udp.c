@@ -1,29 +1,51 @@
+#define _GNU_SOURCE
 #include <sys/socket.h>
-#include <stdio.h> 
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include <unistd.h> 
+#include <unistd.h>
+#include <errno.h>
 #include <netinet/in.h>
 #include <pthread.h>
 #include <stdbool.h>
-#include <malloc.h>
 #include "udp.h"
+#include "udp_internal.h"
 #include "shutdown.h"
 #include "midiController.h"
+#include "timeDelay.h"
+#include "reactor.h"
+#include "netMidi.h"
+#include "arena.h"
+#include "startup.h"
+#include "worker.h"
+#include "hal/audioGenerator.h"
+#include "hal/trace.h"
+#include "hal/statsPage.h"
 
 // References: Slide deck 06 LinuxProgramming from Dr.Brian
 // https://www.cs.princeton.edu/courses/archive/spring14/cos461/docs/rec01-sockets.pdf
 // https://vinodthebest.wordpress.com/category/c-programming/c-network-programming/
 
-#define PORT 12345 
+#define PORT 12345
 #define MAX_LEN 4096
-#define PACKET_SIZE 1500 // bytes
-#define NUM_COMMAND_SUPPORT 8 // update while implementing
 #define TEMP_PREV_COMMAND "temp prev command\n"
 
-struct ReponseMessage {
-    int numPackets;
-    char* packetContent[PACKET_SIZE];
-};
+// Datagrams taken or sent per recvmmsg/sendmmsg call
+#define BATCH_SIZE 16
+// Reply datagrams one batch can produce
+#define MAX_REPLIES (BATCH_SIZE * 2)
+
+// Status stream: clients that sent "subscribe" get a UDP_STATUS_FRAME_LEN
+// frame whenever the status changes, at most once per their interval.
+#define MAX_SUBSCRIBERS 32
+#define STATUS_TICK_MS 20
+#define DEFAULT_STATUS_INTERVAL_MS 100
+#define MAX_STATUS_INTERVAL_MS 10000
+// Sent even when nothing changed, so clients can tell the server is alive
+#define STATUS_HEARTBEAT_MS 1000
+// Subscriptions lapse unless renewed by subscribing again
+#define SUBSCRIPTION_LEASE_MS 60000
+#define NS_PER_MS 1000000LL
 
 typedef struct ReponseMessage (*CommandFunction)();
 
@@ -33,210 +55,405 @@ struct CommandToFunction {
     enum Command command_enum;
 };
 
-pthread_t udp_id;
+static struct ReponseMessage commandStop(void);
+static struct ReponseMessage commandSubscribe(void);
+static struct ReponseMessage commandUnsubscribe(void);
+static struct ReponseMessage commandStats(void);
+static struct ReponseMessage commandTrace(void);
+
+// Perfect hash of the command words: every command lands in its own slot,
+// so a lookup is one hash and one strcmp. Slots were found by trying
+// multipliers offline; UDP_init() checks them, so a new command that
+// collides is caught at startup. Change COMMAND_HASH_* if it does.
+#define COMMAND_TABLE_SIZE 32
+#define COMMAND_HASH_LAST_MULTIPLIER 3
+
+static unsigned int commandHash(const char *command, size_t length)
+{
+    unsigned char first = command[0];
+    unsigned char last = command[length - 1];
+    return (length + first + last * COMMAND_HASH_LAST_MULTIPLIER) % COMMAND_TABLE_SIZE;
+}
+
+static const struct CommandToFunction commandTable[COMMAND_TABLE_SIZE] = {
+    [28] = {"help",  UDP_commandHelp,       HELP},
+    [29] = {"?",     UDP_commandHelp,       HELP},
+    [10] = {"twinkle", UDP_commandTwinkle, UDP_TWINKLE},
+    [30] = {"bach", UDP_commandBach, UDP_BACH},
+    [2]  = {"zelda", UDP_commandZelda, UDP_ZELDA},
+    [1]  = {"pokemon", UDP_commandPokemon, UDP_POKEMON},
+    [21] = {"birthday", UDP_commandBirthday, UDP_BIRTHDAY},
+    [12] = {"popsong", UDP_commandPopSong, UDP_POPSONG},
+    [7]  = {"stop", commandStop, STOP},
+    [11] = {"subscribe", commandSubscribe, SUBSCRIBE},
+    [15] = {"unsubscribe", commandUnsubscribe, UNSUBSCRIBE},
+    [17] = {"stats", commandStats, STATS},
+    [8]  = {"trace", commandTrace, TRACE},
+};
+
+// What <enter> repeats, by enum Command
+static const CommandFunction commandByEnum[MAX_NUMBER_OF_COMMANDS] = {
+    [HELP] = UDP_commandHelp,
+    [UDP_TWINKLE] = UDP_commandTwinkle,
+    [UDP_BACH] = UDP_commandBach,
+    [UDP_ZELDA] = UDP_commandZelda,
+    [UDP_POKEMON] = UDP_commandPokemon,
+    [UDP_BIRTHDAY] = UDP_commandBirthday,
+    [UDP_POPSONG] = UDP_commandPopSong,
+};
+
+static int socket_fd = -1;
 pthread_mutex_t udp_mutex;
-static enum Command prevCommand; 
+static enum Command prevCommand;
 static bool isValidCommand;
 static bool shutDown;
 
-// Thread function
-void *udpServer () {
-
-    int socket_fd;
-    struct sockaddr_in servaddr, client; 
+// Replies with text built at runtime go here instead of a fresh malloc each
+// time; the server copies a reply out before handling the next command.
+static char commandReply[MAX_LEN];
+
+// Receive and reply buffers, allocated once for the whole batch
+static char receiveBuffers[BATCH_SIZE][MAX_LEN];
+static struct sockaddr_in receiveAddrs[BATCH_SIZE];
+static struct iovec receiveIovecs[BATCH_SIZE];
+static struct mmsghdr receiveMsgs[BATCH_SIZE];
+static char replyBuffers[MAX_REPLIES][PACKET_SIZE];
+static struct iovec replyIovecs[MAX_REPLIES];
+static struct mmsghdr replyMsgs[MAX_REPLIES];
+
+// Sender of the command being handled, and the text after its first word
+static struct sockaddr_in *pCommandClient;
+static const char *pCommandArgs;
+
+struct Subscriber {
+    struct sockaddr_in addr;
+    long long intervalNs;
+    long long lastSentNs;
+    long long expiryNs;
+    uint32_t lastChangeCount;
+    bool needsFrame;
+};
 
+// Only touched by the server thread
+static struct Subscriber subscribers[MAX_SUBSCRIBERS];
+static int numSubscribers;
+static reactorTimer_t *pStatusTimer;
+static uint16_t statusFrameSeq;
+static unsigned char statusFrame[UDP_STATUS_FRAME_LEN];
+static struct iovec statusIovec = {.iov_base = statusFrame, .iov_len = UDP_STATUS_FRAME_LEN};
+static struct mmsghdr statusMsgs[MAX_SUBSCRIBERS];
+
+// Traffic counters, reported at cleanup
+static long long commandsHandled;
+static long long datagramsSent;
+static long long receiveBatches;
+static long long serverStartMs;
+static long long statusFramesSent;
+static long long statusTicks;
+
+static int createSocket(void)
+{
+    struct sockaddr_in servaddr;
     memset(&servaddr, 0, sizeof(servaddr));
     servaddr.sin_family = AF_INET;
     servaddr.sin_addr.s_addr = htonl(INADDR_ANY);
-    servaddr.sin_port = htons(PORT); 
+    servaddr.sin_port = htons(PORT);
 
     // Create and bind to socket
-    socket_fd = socket(PF_INET, SOCK_DGRAM, 0); 
+    int socket_fd = socket(PF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (socket_fd < 0) {
         printf("Socket Error.\n");
     }
     if (bind(socket_fd, (struct sockaddr*) &servaddr, sizeof(servaddr)) < 0){
         printf("Error on binding.\n");
     }
+    return socket_fd;
+}
 
-    // keep the server running after processing one client request
-    while (shutDown == false) {
-        unsigned int sin_len = sizeof(client);
-        char messageRx[MAX_LEN];
-
-        int bytesRx = recvfrom(socket_fd, messageRx, MAX_LEN-1, 0, (struct sockaddr *)&client, &sin_len);
-        // Uncomment to test client address info
-        // if (inet_ntop(AF_INET, &(client.sin_addr), clientAddress, INET_ADDRSTRLEN) != NULL) {
-            // printf("Client info %s, %d\n", clientAddress, ntohs(client.sin_port));
-        // }        
-        if (bytesRx < 0) {
-            printf("Receive error.\n");
-        } 
-        messageRx[bytesRx] = 0; // Null terminated string
-        // printf("Message received (%d) bytes: %s\n", bytesRx, messageRx);
-
-        // Create the reply message and send
-        char messageTx[MAX_LEN];
-        struct ReponseMessage responseMsg = UDP_processClientCommand(messageRx);
-        for (int i = 0; i < responseMsg.numPackets; i++) {
-            // printf("Curr packet content is %s\n", (responseMsg.packetContent)[i]); // testing curr packet content 
-            snprintf(messageTx, MAX_LEN, "%s\n", (responseMsg.packetContent)[i]);
-            sendto(socket_fd, messageTx, strlen(messageTx), 0, (struct sockaddr *)&client, sin_len);
-            messageTx[0] = '\0';
+// Queue every packet of a response back to the client it came from.
+// Returns the new number of queued replies.
+static int queueReplies(struct ReponseMessage *pResponse, struct sockaddr_in *pClient, int numReplies)
+{
+    for (int i = 0; i < pResponse->numPackets && numReplies < MAX_REPLIES; i++) {
+        int length = snprintf(replyBuffers[numReplies], PACKET_SIZE, "%s\n", pResponse->packetContent[i]);
+        if (length >= PACKET_SIZE) {
+            length = PACKET_SIZE - 1;
         }
+        replyIovecs[numReplies].iov_base = replyBuffers[numReplies];
+        replyIovecs[numReplies].iov_len = length;
+        memset(&replyMsgs[numReplies].msg_hdr, 0, sizeof(struct msghdr));
+        replyMsgs[numReplies].msg_hdr.msg_name = pClient;
+        replyMsgs[numReplies].msg_hdr.msg_namelen = sizeof(*pClient);
+        replyMsgs[numReplies].msg_hdr.msg_iov = &replyIovecs[numReplies];
+        replyMsgs[numReplies].msg_hdr.msg_iovlen = 1;
+        numReplies++;
     }
-    close(socket_fd);
-    return NULL;
+    return numReplies;
 }
 
-struct ReponseMessage UDP_processClientCommand(char* messageRx) {
+static int sendBatch(int socket_fd, struct mmsghdr *pMsgs, int numMsgs)
+{
+    int sent = 0;
+    while (sent < numMsgs) {
+        int result = sendmmsg(socket_fd, &pMsgs[sent], numMsgs - sent, 0);
+        if (result < 0) {
+            // Replies are best effort, as with any UDP; don't stall the server
+            if (errno != EINTR) {
+                printf("Send error.\n");
+                break;
+            }
+            continue;
+        }
+        sent += result;
+    }
+    datagramsSent += sent;
+    return sent;
+}
 
-    // Create the command to function map
-    struct CommandToFunction map[] = {
-        {"help",  UDP_commandHelp,       HELP},
-        {"?",     UDP_commandHelp,       HELP},
-        {"twinkle", UDP_commandTwinkle, UDP_TWINKLE},
-        {"bach", UDP_commandBach, UDP_BACH},
-        {"zelda", UDP_commandZelda, UDP_ZELDA},
-        {"pokemon", UDP_commandPokemon, UDP_POKEMON},
-        {"birthday", UDP_commandBirthday, UDP_BIRTHDAY},
-        {"popsong", UDP_commandPopSong, UDP_POPSONG},
-    };
-
-    char clientCommand[MAX_LEN];
-    char* token;
-    CommandFunction targetFunction = NULL;
-    struct ReponseMessage responseMessage;
-    isValidCommand = false;
+static void sendReplies(int socket_fd, int numReplies)
+{
+    sendBatch(socket_fd, replyMsgs, numReplies);
+}
 
-    if (strncmp(messageRx, "stop", 4) == 0) {
-        // printf("Command is stop.\n");
-        UDP_commandStop();
-        return responseMessage;
-    } 
+static bool isSameClient(const struct sockaddr_in *pFirst, const struct sockaddr_in *pSecond)
+{
+    return pFirst->sin_addr.s_addr == pSecond->sin_addr.s_addr
+        && pFirst->sin_port == pSecond->sin_port;
+}
 
-    clientCommand[strcspn(clientCommand, "\n")] = 0; // remove the line feed
+static int findSubscriber(const struct sockaddr_in *pClient)
+{
+    for (int i = 0; i < numSubscribers; i++) {
+        if (isSameClient(&subscribers[i].addr, pClient)) {
+            return i;
+        }
+    }
+    return -1;
+}
 
-    if (((strlen(messageRx) == 1) && (messageRx[0] == '\n'))) {
-        // printf("Current command is <enter>\n");
-        responseMessage = UDP_commandBlank();
+// The tick only runs while someone is listening
+static void armStatusTimer(bool isArmed)
+{
+    if (isArmed) {
+        long long tickNs = STATUS_TICK_MS * NS_PER_MS;
+        Reactor_armTimer(pStatusTimer, getMonotonicTimeInNs() + tickNs, tickNs);
     } else {
-        token = strtok(messageRx, " \n\0"); // Tokenize by either space or \n
-        if (token != NULL) {
-            snprintf(clientCommand, MAX_LEN - 1, "%s\n", token);
-        } else {
-            printf("Tokenize error.\n");
-        }
+        Reactor_disarmTimer(pStatusTimer);
+    }
+}
 
-        for (int i = 0; i < NUM_COMMAND_SUPPORT; i++) {
-            clientCommand[strcspn(clientCommand, "\n")] = 0; // remove the line feed
+static void removeSubscriber(int index)
+{
+    subscribers[index] = subscribers[--numSubscribers];
+    STATS_SET("udp.subscribers", numSubscribers);
+    if (numSubscribers == 0) {
+        armStatusTimer(false);
+    }
+}
 
-            if (strcmp(clientCommand, map[i].command) == 0) {
-                isValidCommand = true;
+static void putLe16(unsigned char *pBuffer, uint16_t value)
+{
+    pBuffer[0] = value & 0xFF;
+    pBuffer[1] = value >> 8;
+}
 
-                pthread_mutex_lock(&udp_mutex);
-                targetFunction = map[i].function;
-                responseMessage = targetFunction();
-                pthread_mutex_unlock(&udp_mutex);
+static void putLe32(unsigned char *pBuffer, uint32_t value)
+{
+    putLe16(pBuffer, value & 0xFFFF);
+    putLe16(pBuffer + 2, value >> 16);
+}
 
-                prevCommand = map[i].command_enum;
-                // printf("----------\n");
-                break;
+// Layout is documented with UDP_STATUS_FRAME_LEN in udp.h
+static void encodeStatusFrame(const midiControllerStatus_t *pStatus)
+{
+    statusFrame[0] = UDP_STATUS_MAGIC;
+    statusFrame[1] = UDP_STATUS_VERSION;
+    putLe16(&statusFrame[2], statusFrameSeq++);
+    statusFrame[4] = pStatus->song;
+    statusFrame[5] = pStatus->lastNote < 0 ? UDP_STATUS_NO_NOTE : pStatus->lastNote;
+    statusFrame[6] = pStatus->wasLastNoteCorrect ? UDP_STATUS_FLAG_CORRECT : 0;
+    statusFrame[7] = 0;
+    putLe16(&statusFrame[8], pStatus->stepIndex);
+    putLe16(&statusFrame[10], pStatus->stepCount);
+    putLe32(&statusFrame[12], pStatus->lastNoteLatencyUs);
+    putLe32(&statusFrame[16], pStatus->changeCount);
+}
+
+// One status snapshot per tick, encoded once and sent to every subscriber
+// that is due in a single sendmmsg. Changes between two sends to a client
+// are coalesced: it only ever gets the latest status.
+static void sendStatusFrames(void *pContext)
+{
+    (void) pContext;
+    statusTicks++;
+
+    long long nowNs = getMonotonicTimeInNs();
+    for (int i = numSubscribers - 1; i >= 0; i--) {
+        if (nowNs >= subscribers[i].expiryNs) {
+            removeSubscriber(i);
+        }
+    }
+
+    midiControllerStatus_t status;
+    MidiController_getStatus(&status);
+
+    int numDue = 0;
+    for (int i = 0; i < numSubscribers; i++) {
+        struct Subscriber *pSubscriber = &subscribers[i];
+        long long sinceSentNs = nowNs - pSubscriber->lastSentNs;
+        bool hasChanged = pSubscriber->needsFrame || status.changeCount != pSubscriber->lastChangeCount;
+        bool isDue = hasChanged ? sinceSentNs >= pSubscriber->intervalNs
+            : sinceSentNs >= STATUS_HEARTBEAT_MS * NS_PER_MS;
+        if (!isDue) {
+            continue;
+        }
+        pSubscriber->lastSentNs = nowNs;
+        pSubscriber->lastChangeCount = status.changeCount;
+        pSubscriber->needsFrame = false;
+
+        memset(&statusMsgs[numDue].msg_hdr, 0, sizeof(struct msghdr));
+        statusMsgs[numDue].msg_hdr.msg_name = &pSubscriber->addr;
+        statusMsgs[numDue].msg_hdr.msg_namelen = sizeof(pSubscriber->addr);
+        statusMsgs[numDue].msg_hdr.msg_iov = &statusIovec;
+        statusMsgs[numDue].msg_hdr.msg_iovlen = 1;
+        numDue++;
+    }
+    if (numDue > 0) {
+        encodeStatusFrame(&status);
+        statusFramesSent += sendBatch(socket_fd, statusMsgs, numDue);
+    }
+}
+
+// Drain the socket a batch at a time, replying to each batch with one call
+static void handleDatagrams(int fd, uint32_t events, void *pContext)
+{
+    (void) fd;
+    (void) events;
+    (void) pContext;
+    while (true) {
+        for (int i = 0; i < BATCH_SIZE; i++) {
+            receiveIovecs[i].iov_base = receiveBuffers[i];
+            receiveIovecs[i].iov_len = MAX_LEN - 1;
+            memset(&receiveMsgs[i].msg_hdr, 0, sizeof(struct msghdr));
+            receiveMsgs[i].msg_hdr.msg_name = &receiveAddrs[i];
+            receiveMsgs[i].msg_hdr.msg_namelen = sizeof(receiveAddrs[i]);
+            receiveMsgs[i].msg_hdr.msg_iov = &receiveIovecs[i];
+            receiveMsgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        int received = recvmmsg(socket_fd, receiveMsgs, BATCH_SIZE, MSG_DONTWAIT, NULL);
+        if (received < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                printf("Receive error.\n");
             }
+            return;
         }
-        if (!isValidCommand) {
-            printf("oops bad command\n");
-            return responseMessage;
+        receiveBatches++;
+        STATS_ADD("udp.batches", 1);
+
+        int numReplies = 0;
+        for (int i = 0; i < received; i++) {
+            char *messageRx = receiveBuffers[i];
+            messageRx[receiveMsgs[i].msg_len] = 0; // Null terminated string
+            struct ReponseMessage responseMsg = UDP_processClientCommandFrom(&receiveAddrs[i], messageRx);
+            commandsHandled++;
+            STATS_ADD("udp.requests", 1);
+            numReplies = queueReplies(&responseMsg, &receiveAddrs[i], numReplies);
+        }
+        sendReplies(socket_fd, numReplies);
+
+        if (received < BATCH_SIZE || shutDown) {
+            return;
         }
     }
+}
+
+struct ReponseMessage UDP_processClientCommandFrom(struct sockaddr_in *pClient, char *messageRx) {
+    pCommandClient = pClient;
+    return UDP_processClientCommand(messageRx);
+}
+
+struct ReponseMessage UDP_processClientCommand(char* messageRx) {
+
+    struct ReponseMessage responseMessage;
+    responseMessage.numPackets = 0;
+    isValidCommand = false;
+
+    if (((strlen(messageRx) == 1) && (messageRx[0] == '\n'))) {
+        // printf("Current command is <enter>\n");
+        return UDP_commandBlank();
+    }
+
+    // First word only, tokenize by either space or \n
+    size_t length = strcspn(messageRx, " \n");
+    if (length == 0) {
+        printf("Tokenize error.\n");
+        return responseMessage;
+    }
+
+    const struct CommandToFunction *pEntry = &commandTable[commandHash(messageRx, length)];
+    if (pEntry->command == NULL
+            || strlen(pEntry->command) != length
+            || strncmp(messageRx, pEntry->command, length) != 0) {
+        printf("oops bad command\n");
+        return responseMessage;
+    }
+    isValidCommand = true;
+    pCommandArgs = messageRx + length;
+
+    pthread_mutex_lock(&udp_mutex);
+    responseMessage = pEntry->function();
+    pthread_mutex_unlock(&udp_mutex);
+
+    if (pEntry->command_enum < MAX_NUMBER_OF_COMMANDS) {
+        prevCommand = pEntry->command_enum;
+    }
     return responseMessage;
 }
 
 struct ReponseMessage UDP_commandHelp(void) {
-    char *helpReply = "Accepted command examples:\ntwinkle          -- plays Twinkle, Twinkle\nbach             -- plays Bach Minuet in G\nzelda            -- plays Zelda's theme song\npokemon          -- plays Pokemon's theme song\nbirthday         -- plays Happy Birthday\npopsong          -- plays a special pop song\nstop             -- cause the server program to end.\n";
+    char *helpReply = "Accepted command examples:\ntwinkle          -- plays Twinkle, Twinkle\nbach             -- plays Bach Minuet in G\nzelda            -- plays Zelda's theme song\npokemon          -- plays Pokemon's theme song\nbirthday         -- plays Happy Birthday\npopsong          -- plays a special pop song\nsubscribe [ms]   -- stream binary status frames, at most one per ms (default 100)\nunsubscribe      -- stop the status stream\nstats            -- server, audio, network MIDI and memory counters\ntrace [file]     -- dump the trace buffers (default " TRACE_DEFAULT_PATH ")\nstop             -- cause the server program to end.\n";
     struct ReponseMessage responseMessage;
     responseMessage.numPackets = 1;
     (responseMessage.packetContent)[0] = helpReply;
     return responseMessage;
 }
 
-struct ReponseMessage UDP_commandTwinkle(void) {
-    char* countReply = malloc(MAX_LEN);
-    MidiController_setSong(TWINKLE);
-    int song = MidiController_getCurrentSong();
-    snprintf(countReply, MAX_LEN, "%d", song);
+// Switch song and reply with the new song number
+static struct ReponseMessage replyWithSong(enum songs song) {
+    MidiController_setSong(song);
+    snprintf(commandReply, MAX_LEN, "%d", MidiController_getCurrentSong());
     struct ReponseMessage responseMessage;
     responseMessage.numPackets = 1;
-    (responseMessage.packetContent)[0] = countReply;
+    (responseMessage.packetContent)[0] = commandReply;
     return responseMessage;
 }
 
+struct ReponseMessage UDP_commandTwinkle(void) {
+    return replyWithSong(TWINKLE);
+}
+
 struct ReponseMessage UDP_commandBach(void) {
-    char* countReply = malloc(MAX_LEN);
-    MidiController_setSong(BACH);
-    int song = MidiController_getCurrentSong();
-    snprintf(countReply, MAX_LEN, "%d", song);
-    struct ReponseMessage responseMessage;
-    responseMessage.numPackets = 1;
-    (responseMessage.packetContent)[0] = countReply;
-    return responseMessage;
+    return replyWithSong(BACH);
 }
 
 struct ReponseMessage UDP_commandZelda(void) {
-    char* countReply = malloc(MAX_LEN);
-    MidiController_setSong(ZELDA);
-    int song = MidiController_getCurrentSong();
-    snprintf(countReply, MAX_LEN, "%d", song);
-    struct ReponseMessage responseMessage;
-    responseMessage.numPackets = 1;
-    (responseMessage.packetContent)[0] = countReply;
-    return responseMessage;
+    return replyWithSong(ZELDA);
 }
 struct ReponseMessage UDP_commandPokemon(void) {
-    char* countReply = malloc(MAX_LEN);
-    MidiController_setSong(POKEMON);
-    int song = MidiController_getCurrentSong();
-    snprintf(countReply, MAX_LEN, "%d", song);
-    struct ReponseMessage responseMessage;
-    responseMessage.numPackets = 1;
-    (responseMessage.packetContent)[0] = countReply;
-    return responseMessage;
+    return replyWithSong(POKEMON);
 }
 struct ReponseMessage UDP_commandBirthday(void) {
-    char* countReply = malloc(MAX_LEN);
-    MidiController_setSong(BIRTHDAY);
-    int song = MidiController_getCurrentSong();
-    snprintf(countReply, MAX_LEN, "%d", song);
-    struct ReponseMessage responseMessage;
-    responseMessage.numPackets = 1;
-    (responseMessage.packetContent)[0] = countReply;
-    return responseMessage;
+    return replyWithSong(BIRTHDAY);
 }
 struct ReponseMessage UDP_commandPopSong(void) {
-    char* countReply = malloc(MAX_LEN);
-    MidiController_setSong(POPSONG);
-    int song = MidiController_getCurrentSong();
-    snprintf(countReply, MAX_LEN, "%d", song);
-    struct ReponseMessage responseMessage;
-    responseMessage.numPackets = 1;
-    (responseMessage.packetContent)[0] = countReply;
-    return responseMessage;
+    return replyWithSong(POPSONG);
 }
 
 
 struct ReponseMessage UDP_commandBlank(void) {
-    struct CommandToFunction map[] = {
-        {"help",  UDP_commandHelp,       HELP},
-        {"?",     UDP_commandHelp,       HELP},
-        {"twinkle", UDP_commandTwinkle, UDP_TWINKLE},
-        {"bach", UDP_commandBach, UDP_BACH},
-        {"zelda", UDP_commandZelda, UDP_ZELDA},
-        {"pokemon", UDP_commandPokemon, UDP_POKEMON},
-        {"birthday", UDP_commandBirthday, UDP_BIRTHDAY},
-        {"popsong", UDP_commandPopSong, UDP_POPSONG},
-    };
     CommandFunction targetFunction = NULL;
-    targetFunction = map[prevCommand].function;
+    targetFunction = commandByEnum[prevCommand];
     struct ReponseMessage responseMessage = targetFunction();
 
     return responseMessage;
@@ -249,14 +466,223 @@ void UDP_commandStop(void){
     printf("Program terminating.\n");
 }
 
+static struct ReponseMessage commandStop(void) {
+    UDP_commandStop();
+    struct ReponseMessage responseMessage;
+    responseMessage.numPackets = 0;
+    return responseMessage;
+}
+
+// Called on the server thread, from handleDatagrams()
+static struct ReponseMessage commandSubscribe(void) {
+    struct ReponseMessage responseMessage;
+    responseMessage.numPackets = 1;
+
+    int intervalMs = DEFAULT_STATUS_INTERVAL_MS;
+    sscanf(pCommandArgs, "%d", &intervalMs);
+    if (intervalMs < STATUS_TICK_MS) {
+        intervalMs = STATUS_TICK_MS;
+    } else if (intervalMs > MAX_STATUS_INTERVAL_MS) {
+        intervalMs = MAX_STATUS_INTERVAL_MS;
+    }
+
+    int index = findSubscriber(pCommandClient);
+    if (index < 0) {
+        if (numSubscribers == MAX_SUBSCRIBERS) {
+            (responseMessage.packetContent)[0] = "subscribe failed: too many subscribers";
+            return responseMessage;
+        }
+        index = numSubscribers++;
+        STATS_SET("udp.subscribers", numSubscribers);
+        subscribers[index].addr = *pCommandClient;
+        subscribers[index].lastSentNs = 0;
+        if (numSubscribers == 1) {
+            armStatusTimer(true);
+        }
+    }
+    long long nowNs = getMonotonicTimeInNs();
+    subscribers[index].intervalNs = intervalMs * NS_PER_MS;
+    subscribers[index].expiryNs = nowNs + SUBSCRIPTION_LEASE_MS * NS_PER_MS;
+    // (Re)subscribing always gets a frame on the next tick
+    subscribers[index].needsFrame = true;
+
+    snprintf(commandReply, MAX_LEN, "subscribed %d", intervalMs);
+    (responseMessage.packetContent)[0] = commandReply;
+    return responseMessage;
+}
+
+static struct ReponseMessage commandUnsubscribe(void) {
+    int index = findSubscriber(pCommandClient);
+    if (index >= 0) {
+        removeSubscriber(index);
+    }
+    struct ReponseMessage responseMessage;
+    responseMessage.numPackets = 1;
+    (responseMessage.packetContent)[0] = "unsubscribed";
+    return responseMessage;
+}
+
+// Resident set size from /proc, or -1 if it cannot be read
+static long readRssKb(void) {
+    long pages = -1;
+    FILE *pFile = fopen("/proc/self/statm", "r");
+    if (pFile == NULL) {
+        return -1;
+    }
+    if (fscanf(pFile, "%*s %ld", &pages) != 1) {
+        pages = -1;
+    }
+    fclose(pFile);
+    return pages < 0 ? -1 : pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// Runs on the worker: replies go out from there once the slow part is done
+static void sendWorkerReply(const struct sockaddr_in *pClient, const char *reply, int length) {
+    // Best effort, as with every reply
+    if (sendto(socket_fd, reply, length, 0, (const struct sockaddr *) pClient, sizeof(*pClient)) < 0) {
+        printf("Send error.\n");
+    }
+}
+
+// A stats reply waiting on the worker for the figures that need file I/O
+typedef struct {
+    struct sockaddr_in client;
+    char text[WORKER_MAX_CONTEXT - sizeof(struct sockaddr_in)];
+} statsReply_t;
+
+// Runs on the worker: add the resident set size and send the reply
+static void finishStatsReply(void *pContext) {
+    statsReply_t *pReply = pContext;
+    char reply[PACKET_SIZE];
+    int length = snprintf(reply, sizeof(reply), "%s\nrssKb %ld\n", pReply->text, readRssKb());
+    if (length >= (int) sizeof(reply)) {
+        length = sizeof(reply) - 1;
+    }
+    sendWorkerReply(&pReply->client, reply, length);
+}
+
+// One "name value" pair per line, so tools can pick out what they need.
+// Counters are read here, on the reactor; the reply is sent by the worker.
+static struct ReponseMessage commandStats(void) {
+    audioGeneratorStats_t audioStats;
+    audioGenerator_getStats(&audioStats);
+    netMidiStats_t netMidiStats;
+    NetMidi_getStats(&netMidiStats);
+    arenaStats_t arenaStats;
+    Arena_getStats(&arenaStats);
+
+    statsReply_t statsReply;
+    statsReply.client = *pCommandClient;
+    snprintf(statsReply.text, sizeof(statsReply.text),
+        "commands %lld\n"
+        "batches %lld\n"
+        "replies %lld\n"
+        "subscribers %d\n"
+        "statusFrames %lld\n"
+        "audioPeriods %lu\n"
+        "audioXruns %lu\n"
+        "audioShortWrites %lu\n"
+        "netMidiReceived %llu\n"
+        "netMidiLost %llu\n"
+        "netMidiLate %llu\n"
+        "netMidiJitterUs %d\n"
+        "memReservedBytes %lu\n"
+        "memPeakUsedBytes %lu\n"
+        "memBlocks %lu\n"
+        "memResets %lu\n"
+        "startupReadyUs %lld",
+        commandsHandled, receiveBatches, datagramsSent, numSubscribers, statusFramesSent,
+        audioStats.periodsWritten, audioStats.xruns, audioStats.shortWrites,
+        (unsigned long long) netMidiStats.packetsReceived,
+        (unsigned long long) netMidiStats.packetsLost,
+        (unsigned long long) netMidiStats.packetsLate,
+        netMidiStats.jitterUs,
+        arenaStats.reservedBytes, arenaStats.peakUsedBytes,
+        arenaStats.blocks, arenaStats.resets, Startup_getReadyUs());
+
+    struct ReponseMessage responseMessage;
+    responseMessage.numPackets = 0;
+    if (!Worker_post(finishStatsReply, &statsReply, sizeof(statsReply))) {
+        responseMessage.numPackets = 1;
+        (responseMessage.packetContent)[0] = "stats failed: busy";
+    }
+    return responseMessage;
+}
+
+// A trace dump waiting on the worker, and who asked for it
+typedef struct {
+    struct sockaddr_in client;
+    char path[256];
+} traceReply_t;
+
+// Runs on the worker: write the dump and say how it went
+static void finishTraceReply(void *pContext) {
+    traceReply_t *pReply = pContext;
+    char reply[PACKET_SIZE];
+    int numEvents = Trace_dump(pReply->path);
+    int length;
+    if (numEvents < 0) {
+        length = snprintf(reply, sizeof(reply), "trace failed");
+    } else {
+        length = snprintf(reply, sizeof(reply), "trace %d events to %s", numEvents, pReply->path);
+    }
+    if (length >= (int) sizeof(reply)) {
+        length = sizeof(reply) - 1;
+    }
+    sendWorkerReply(&pReply->client, reply, length);
+}
+
+// Called on the server thread, from handleDatagrams(). The dump is written
+// and the reply sent by the worker.
+static struct ReponseMessage commandTrace(void) {
+    traceReply_t traceReply;
+    traceReply.client = *pCommandClient;
+    if (sscanf(pCommandArgs, "%255s", traceReply.path) != 1) {
+        snprintf(traceReply.path, sizeof(traceReply.path), "%s", TRACE_DEFAULT_PATH);
+    }
+
+    struct ReponseMessage responseMessage;
+    responseMessage.numPackets = 0;
+    if (!Worker_post(finishTraceReply, &traceReply, sizeof(traceReply))) {
+        responseMessage.numPackets = 1;
+        (responseMessage.packetContent)[0] = "trace failed: busy";
+    }
+    return responseMessage;
+}
+
 void UDP_init(void) {
     printf("UDP_init...\n");
+    // Catch a command added to the table at a slot it does not hash to
+    for (int i = 0; i < COMMAND_TABLE_SIZE; i++) {
+        const char *command = commandTable[i].command;
+        if (command != NULL && commandHash(command, strlen(command)) != (unsigned int) i) {
+            printf("ERROR: UDP command '%s' is in slot %d, hashes to %u\n",
+                command, i, commandHash(command, strlen(command)));
+            exit(EXIT_FAILURE);
+        }
+    }
     shutDown = false;
-    pthread_create(&udp_id, NULL, udpServer, NULL); 
+
+    // Commands are taken as soon as the socket is added, so it goes last
+    socket_fd = createSocket();
+    pStatusTimer = Reactor_addTimer("udp status", sendStatusFrames, NULL);
+    serverStartMs = getTimeInMs();
+    Reactor_addFd("udp commands", socket_fd, EPOLLIN, handleDatagrams, NULL);
 }
 
 void UDP_cleanup(void) {
     printf("UDP_cleanup...\n");
-    pthread_join(udp_id, NULL);
+    Reactor_removeTimer(pStatusTimer);
+    Reactor_removeFd(socket_fd);
+    close(socket_fd);
+    long long elapsedMs = getTimeInMs() - serverStartMs;
+    if (receiveBatches > 0 && elapsedMs > 0) {
+        printf("UDP: %lld commands in %lld batches (%.1f per batch), %lld replies, %lld commands/s\n",
+            commandsHandled, receiveBatches, (double) commandsHandled / receiveBatches,
+            datagramsSent, commandsHandled * 1000 / elapsedMs);
+    }
+    if (statusTicks > 0) {
+        printf("UDP: %lld status frames over %lld ticks, %d subscribers at exit\n",
+            statusFramesSent, statusTicks, numSubscribers);
+    }
 }
-
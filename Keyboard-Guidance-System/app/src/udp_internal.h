@@ -0,0 +1,21 @@
+// Internals of udp.c that the benchmarks drive directly.
+// Not part of the module's interface: only udp.c and benchmarks/ include
+// this.
+
+#ifndef _UDP_INTERNAL_H_
+#define _UDP_INTERNAL_H_
+
+#include <netinet/in.h>
+
+#define PACKET_SIZE 1500 // bytes
+
+struct ReponseMessage {
+    int numPackets;
+    char* packetContent[PACKET_SIZE];
+};
+
+// Run one command from pClient, as handleDatagrams() does for each
+// datagram. Replies sent later by the worker go to pClient.
+struct ReponseMessage UDP_processClientCommandFrom(struct sockaddr_in *pClient, char *messageRx);
+
+#endif
@@ -0,0 +1,102 @@
+// Module for blocking work the reactor must not wait on
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "worker.h"
+#include "hal/statsPage.h"
+
+typedef struct {
+    workerJob_t job;
+    _Alignas(max_align_t) unsigned char context[WORKER_MAX_CONTEXT];
+} workerJobSlot_t;
+
+// Jobs waiting to run, oldest at firstJob
+static workerJobSlot_t jobs[WORKER_MAX_JOBS];
+static int firstJob;
+static int numJobs;
+static bool isRunning;
+static bool isStopping;
+static pthread_mutex_t jobsMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jobPosted = PTHREAD_COND_INITIALIZER;
+static pthread_t thread;
+
+static void *workerThread(void *pArg)
+{
+    (void) pArg;
+    pthread_setname_np(pthread_self(), "worker");
+    // Runs out of the queue slot's copy, so the slot is copied out first
+    static workerJobSlot_t current;
+
+    pthread_mutex_lock(&jobsMutex);
+    while (true) {
+        while (numJobs == 0 && !isStopping) {
+            pthread_cond_wait(&jobPosted, &jobsMutex);
+        }
+        if (numJobs == 0) {
+            break;
+        }
+        current = jobs[firstJob];
+        firstJob = (firstJob + 1) % WORKER_MAX_JOBS;
+        numJobs--;
+        pthread_mutex_unlock(&jobsMutex);
+
+        current.job(current.context);
+        STATS_ADD("worker.jobs", 1);
+
+        pthread_mutex_lock(&jobsMutex);
+    }
+    pthread_mutex_unlock(&jobsMutex);
+    return NULL;
+}
+
+void Worker_init(void)
+{
+    firstJob = 0;
+    numJobs = 0;
+    isStopping = false;
+    if (pthread_create(&thread, NULL, workerThread, NULL) != 0) {
+        printf("ERROR: Unable to start worker thread\n");
+        exit(EXIT_FAILURE);
+    }
+    pthread_mutex_lock(&jobsMutex);
+    isRunning = true;
+    pthread_mutex_unlock(&jobsMutex);
+}
+
+void Worker_cleanup(void)
+{
+    pthread_mutex_lock(&jobsMutex);
+    isRunning = false;
+    isStopping = true;
+    pthread_cond_signal(&jobPosted);
+    pthread_mutex_unlock(&jobsMutex);
+    pthread_join(thread, NULL);
+}
+
+bool Worker_post(workerJob_t job, const void *pContext, size_t size)
+{
+    if (size > WORKER_MAX_CONTEXT) {
+        printf("ERROR: Worker job context of %zu bytes, over %d\n", size, WORKER_MAX_CONTEXT);
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_mutex_lock(&jobsMutex);
+    if (!isRunning || numJobs == WORKER_MAX_JOBS) {
+        pthread_mutex_unlock(&jobsMutex);
+        STATS_ADD("worker.rejected", 1);
+        return false;
+    }
+    workerJobSlot_t *pSlot = &jobs[(firstJob + numJobs) % WORKER_MAX_JOBS];
+    pSlot->job = job;
+    if (size > 0) {
+        memcpy(pSlot->context, pContext, size);
+    }
+    numJobs++;
+    pthread_cond_signal(&jobPosted);
+    pthread_mutex_unlock(&jobsMutex);
+    return true;
+}
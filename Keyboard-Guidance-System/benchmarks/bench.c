@@ -0,0 +1,152 @@
+// Minimal microbenchmark harness for the hot paths
+// Usage: benchmarks [--filter text] [--repetitions n] [--min-time-ms ms]
+//                   [--cpu n] [--data-dir dir] > results.json
+// The report goes to stdout; anything the modules print goes to stderr.
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/utsname.h>
+
+#include "bench.h"
+#include "timeDelay.h"
+
+#ifndef KGS_BENCH_DATA_DIR
+#define KGS_BENCH_DATA_DIR "."
+#endif
+
+#define MAX_REPETITIONS 50
+
+static const char *filter = "";
+static int repetitions = 5;
+static long long minTimeNs = 100 * 1000000LL;
+static const char *dataDir = KGS_BENCH_DATA_DIR;
+
+static FILE *pReport;
+static int numReported;
+
+const char *Bench_getDataDir(void)
+{
+    return dataDir;
+}
+
+static long long timeIterations(benchFunction_t function, void *pContext, long long iterations)
+{
+    long long startNs = getMonotonicTimeInNs();
+    function(pContext, iterations);
+    return getMonotonicTimeInNs() - startNs;
+}
+
+static int compareDoubles(const void *pFirst, const void *pSecond)
+{
+    double first = *(const double *) pFirst;
+    double second = *(const double *) pSecond;
+    return (first > second) - (first < second);
+}
+
+void Bench_run(const char *name, benchFunction_t function, void *pContext)
+{
+    if (strstr(name, filter) == NULL) {
+        return;
+    }
+
+    // Grow the count until a run is long enough to time, which also warms
+    // the caches, then size it to minTimeNs
+    long long iterations = 1;
+    long long elapsedNs;
+    while ((elapsedNs = timeIterations(function, pContext, iterations)) < minTimeNs / 10) {
+        iterations *= 2;
+    }
+    iterations = iterations * minTimeNs / (elapsedNs > 0 ? elapsedNs : 1);
+    if (iterations < 1) {
+        iterations = 1;
+    }
+
+    double nsPerOp[MAX_REPETITIONS];
+    for (int i = 0; i < repetitions; i++) {
+        nsPerOp[i] = (double) timeIterations(function, pContext, iterations) / iterations;
+    }
+    qsort(nsPerOp, repetitions, sizeof(nsPerOp[0]), compareDoubles);
+    double median = nsPerOp[repetitions / 2];
+
+    fprintf(stderr, "%-36s %12.1f ns/op  (min %.1f, max %.1f, %lld iterations)\n",
+        name, median, nsPerOp[0], nsPerOp[repetitions - 1], iterations);
+    fprintf(pReport, "%s\n    {\"name\": \"%s\", \"iterations\": %lld, \"repetitions\": %d, "
+        "\"ns_per_op\": %.3f, \"ns_per_op_min\": %.3f, \"ns_per_op_max\": %.3f}",
+        numReported == 0 ? "" : ",", name, iterations, repetitions,
+        median, nsPerOp[0], nsPerOp[repetitions - 1]);
+    numReported++;
+}
+
+static void printUsage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [--filter text] [--repetitions n] [--min-time-ms ms] "
+        "[--cpu n] [--data-dir dir]\n", program);
+    exit(EXIT_FAILURE);
+}
+
+static void pinToCpu(int cpu)
+{
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+        perror("ERROR: Unable to pin to CPU");
+        exit(EXIT_FAILURE);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int cpu = -1;
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 == argc) {
+            printUsage(argv[0]);
+        }
+        if (strcmp(argv[i], "--filter") == 0) {
+            filter = argv[++i];
+        } else if (strcmp(argv[i], "--repetitions") == 0) {
+            repetitions = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--min-time-ms") == 0) {
+            minTimeNs = atoll(argv[++i]) * 1000000LL;
+        } else if (strcmp(argv[i], "--cpu") == 0) {
+            cpu = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--data-dir") == 0) {
+            dataDir = argv[++i];
+        } else {
+            printUsage(argv[0]);
+        }
+    }
+    if (repetitions < 1 || repetitions > MAX_REPETITIONS || minTimeNs <= 0) {
+        printUsage(argv[0]);
+    }
+    if (cpu >= 0) {
+        pinToCpu(cpu);
+    }
+
+    // Keep stdout for the report and send module printfs to stderr
+    pReport = fdopen(dup(STDOUT_FILENO), "w");
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+
+    struct utsname host;
+    uname(&host);
+    fprintf(pReport, "{\n  \"context\": {\"host\": \"%s\", \"machine\": \"%s\", "
+        "\"date\": %lld, \"repetitions\": %d, \"min_time_ms\": %lld},\n  \"benchmarks\": [",
+        host.nodename, host.machine, (long long) time(NULL), repetitions, minTimeNs / 1000000);
+
+    BenchAudio_run();
+    BenchMidi_run();
+    BenchParser_run();
+    BenchLed_run();
+    BenchUdp_run();
+
+    fprintf(pReport, "\n  ]\n}\n");
+    fclose(pReport);
+    return 0;
+}
@@ -0,0 +1,32 @@
+// Minimal microbenchmark harness for the hot paths.
+// Each benchmark is calibrated to run for about minTimeMs, then timed over
+// several repetitions; the median, min and max time per operation go to
+// the JSON report, which benchmarks/compare.py checks against a baseline.
+
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+// Runs the operation being measured `iterations` times
+typedef void (*benchFunction_t)(void *pContext, long long iterations);
+
+// Time one benchmark and add it to the report. Skipped unless its name
+// contains the --filter text.
+void Bench_run(const char *name, benchFunction_t function, void *pContext);
+
+// Keeps the compiler from optimising away a result nothing reads
+static inline void Bench_keep(const void *pValue)
+{
+    __asm__ volatile("" : : "g"(pValue) : "memory");
+}
+
+// Where the song files are (--data-dir)
+const char *Bench_getDataDir(void);
+
+// Each group of benchmarks, run in this order by main()
+void BenchAudio_run(void);
+void BenchMidi_run(void);
+void BenchParser_run(void);
+void BenchLed_run(void);
+void BenchUdp_run(void);
+
+#endif
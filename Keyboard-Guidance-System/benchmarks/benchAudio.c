@@ -0,0 +1,51 @@
+// Benchmarks of audio mixing: one ALSA period at N voices
+
+#include <stdlib.h>
+
+#include "bench.h"
+#include "hal/audioGenerator.h"
+#include "audioGenerator_internal.h"
+
+// One period, as ALSA gives us on the board
+#define BENCH_PERIOD_FRAMES 735
+// A second of sound at 44.1 kHz
+#define BENCH_SOUND_SAMPLES 44100
+
+static wavedata_t benchSound;
+static short playbackBuffer[BENCH_PERIOD_FRAMES];
+
+// Each voice plays from a different place, and they all move on each
+// period, so the mixer reads fresh samples as it would while playing
+static void mixVoices(void *pContext, long long iterations)
+{
+    int voices = (int) (long) pContext;
+    int lastStart = benchSound.numSamples - BENCH_PERIOD_FRAMES;
+    for (long long i = 0; i < iterations; i++) {
+        for (int v = 0; v < voices; v++) {
+            audioGenerator_setVoice(v, &benchSound, (i * BENCH_PERIOD_FRAMES + v * 997) % lastStart);
+        }
+        audioGenerator_fillPlaybackBuffer(playbackBuffer, BENCH_PERIOD_FRAMES);
+        Bench_keep(playbackBuffer);
+    }
+    for (int v = 0; v < voices; v++) {
+        audioGenerator_setVoice(v, NULL, 0);
+    }
+}
+
+void BenchAudio_run(void)
+{
+    benchSound.numSamples = BENCH_SOUND_SAMPLES;
+    benchSound.pData = malloc(BENCH_SOUND_SAMPLES * sizeof(*benchSound.pData));
+    // Loud enough that mixing many voices clips
+    unsigned int seed = 1;
+    for (int i = 0; i < BENCH_SOUND_SAMPLES; i++) {
+        benchSound.pData[i] = (short) (rand_r(&seed) % 20000 - 10000);
+    }
+
+    Bench_run("mix/voices:0", mixVoices, (void *) 0L);
+    Bench_run("mix/voices:1", mixVoices, (void *) 1L);
+    Bench_run("mix/voices:4", mixVoices, (void *) 4L);
+    Bench_run("mix/voices:16", mixVoices, (void *) 16L);
+
+    audioGenerator_freeWaveFileData(&benchSound);
+}
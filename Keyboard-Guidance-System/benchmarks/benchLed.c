@@ -0,0 +1,46 @@
+// Benchmarks of LED frame commits, against simulated PRU memory
+
+#include <stdio.h>
+
+#include "bench.h"
+#include "reactor.h"
+#include "hal/pruMem.h"
+#include "hal/ledDriver.h"
+#include "hal/colours.h"
+
+// One LED per key, as main() sets up
+#define BENCH_STRIP_LENGTH 14
+
+// One LED changes: the whole frame is corrected and written again
+static void commitOneLed(void *pContext, long long iterations)
+{
+    (void) pContext;
+    for (long long i = 0; i < iterations; i++) {
+        changeColourLED(i & 1 ? BRIGHT_RED : BRIGHT_BLUE, 0);
+    }
+}
+
+static void commitAllLeds(void *pContext, long long iterations)
+{
+    (void) pContext;
+    for (long long i = 0; i < iterations; i++) {
+        turnOnAllLEDs(i & 1 ? BRIGHT_RED : BRIGHT_BLUE);
+    }
+}
+
+void BenchLed_run(void)
+{
+    // The LED scheduler registers with the reactor; nothing runs it here
+    Reactor_init();
+    PruMem_useFileBackend(NULL);
+    LED_init(BENCH_STRIP_LENGTH);
+
+    Bench_run("led/commitOneLed", commitOneLed, NULL);
+    Bench_run("led/commitAllLeds", commitAllLeds, NULL);
+    LED_setBrightness(50);
+    LED_setGamma(2.2);
+    Bench_run("led/commitOneLed/gamma", commitOneLed, NULL);
+
+    LED_cleanup();
+    Reactor_cleanup();
+}
@@ -0,0 +1,48 @@
+// Benchmarks of MIDI input: decoding amidi lines, and note lookups
+
+#include <string.h>
+
+#include "bench.h"
+#include "hal/midiReader.h"
+#include "midiReader_internal.h"
+
+// A press and release, as amidi prints them
+static const char *amidiLines[] = {"90 3C 40", "80 3C 00"};
+
+static void decodeLines(void *pContext, long long iterations)
+{
+    (void) pContext;
+    char line[16];
+    for (long long i = 0; i < iterations; i++) {
+        // Decoding tokenises the line in place
+        strcpy(line, amidiLines[i & 1]);
+        int note = MidiReader_parseLine(line);
+        Bench_keep(&note);
+    }
+}
+
+// Every MIDI note number, most of them outside the keyboard's range
+static void lookUpNotes(void *pContext, long long iterations)
+{
+    (void) pContext;
+    for (long long i = 0; i < iterations; i++) {
+        enum note note = MidiReader_intToNote(i & 0x7F);
+        Bench_keep(&note);
+    }
+}
+
+static void lookUpNoteNames(void *pContext, long long iterations)
+{
+    (void) pContext;
+    for (long long i = 0; i < iterations; i++) {
+        const char *pName = MidiReader_noteToString(60 + i % (NUM_OF_NOTES + 1));
+        Bench_keep(pName);
+    }
+}
+
+void BenchMidi_run(void)
+{
+    Bench_run("midi/decode", decodeLines, NULL);
+    Bench_run("midi/intToNote", lookUpNotes, NULL);
+    Bench_run("midi/noteToString", lookUpNoteNames, NULL);
+}
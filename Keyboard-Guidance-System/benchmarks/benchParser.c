@@ -0,0 +1,74 @@
+// Benchmarks of song parsing, as done on every song change
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "parser.h"
+#include "hal/midiReader.h"
+
+#define MAX_PATH_LEN 256
+
+static void parseLines(void *pContext, long long iterations)
+{
+    arena_t arena;
+    Arena_init(&arena, ARENA_DEFAULT_BLOCK_SIZE);
+    for (long long i = 0; i < iterations; i++) {
+        Arena_reset(&arena);
+        StringArray lines = Parser_parseFileByLineBreak(pContext, &arena);
+        Bench_keep(lines.lines);
+    }
+    Arena_cleanup(&arena);
+}
+
+static void parseNotes(void *pContext, long long iterations)
+{
+    arena_t linesArena;
+    arena_t notesArena;
+    Arena_init(&linesArena, ARENA_DEFAULT_BLOCK_SIZE);
+    Arena_init(&notesArena, ARENA_DEFAULT_BLOCK_SIZE);
+    StringArray lines = Parser_parseFileByLineBreak(pContext, &linesArena);
+    for (long long i = 0; i < iterations; i++) {
+        Arena_reset(&notesArena);
+        enum note *pNotes = Parse_parseStringArrayForNotes(lines, &notesArena);
+        Bench_keep(pNotes);
+    }
+    Arena_cleanup(&notesArena);
+    Arena_cleanup(&linesArena);
+}
+
+// Chord parsing changes the lines, so each iteration reads the file again
+static void parseChords(void *pContext, long long iterations)
+{
+    arena_t arena;
+    pool_t chordPool;
+    Arena_init(&arena, ARENA_DEFAULT_BLOCK_SIZE);
+    Pool_init(&chordPool, sizeof(struct chord), 64);
+    for (long long i = 0; i < iterations; i++) {
+        Arena_reset(&arena);
+        StringArray lines = Parser_parseFileByLineBreak(pContext, &arena);
+        struct chord **chords = Parser_parseStringArrayForChords(lines, &arena, &chordPool);
+        Bench_keep(chords);
+        Parser_releaseChords(chords, lines.size, &chordPool);
+    }
+    Pool_cleanup(&chordPool);
+    Arena_cleanup(&arena);
+}
+
+void BenchParser_run(void)
+{
+    // The longest song
+    static char path[MAX_PATH_LEN];
+    snprintf(path, sizeof(path), "%s/txt_files/bach.txt", Bench_getDataDir());
+    FILE *pFile = fopen(path, "r");
+    if (pFile == NULL) {
+        fprintf(stderr, "ERROR: Unable to open %s, see --data-dir\n", path);
+        exit(EXIT_FAILURE);
+    }
+    fclose(pFile);
+
+    Bench_run("parser/fileByLineBreak", parseLines, path);
+    Bench_run("parser/stringArrayForNotes", parseNotes, path);
+    Bench_run("parser/fileAndChords", parseChords, path);
+}
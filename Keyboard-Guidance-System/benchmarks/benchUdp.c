@@ -0,0 +1,30 @@
+// Benchmarks of UDP command dispatch, from the datagram text to the reply
+// The worker is not running here, so "stats" times the part on the
+// reactor and replies busy instead of posting the rest.
+
+#include <stdio.h>
+#include <netinet/in.h>
+
+#include "bench.h"
+#include "udp.h"
+#include "udp_internal.h"
+
+#define BENCH_COMMAND_LEN 64
+
+static void dispatchCommand(void *pContext, long long iterations)
+{
+    char command[BENCH_COMMAND_LEN];
+    snprintf(command, sizeof(command), "%s", (const char *) pContext);
+    struct sockaddr_in client = {.sin_family = AF_INET};
+    for (long long i = 0; i < iterations; i++) {
+        struct ReponseMessage reply = UDP_processClientCommandFrom(&client, command);
+        Bench_keep(&reply);
+    }
+}
+
+void BenchUdp_run(void)
+{
+    Bench_run("udp/dispatch/help", dispatchCommand, "help\n");
+    Bench_run("udp/dispatch/stats", dispatchCommand, "stats\n");
+    Bench_run("udp/dispatch/unsubscribe", dispatchCommand, "unsubscribe\n");
+}
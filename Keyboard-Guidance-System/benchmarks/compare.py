@@ -0,0 +1,55 @@
+#!/usr/bin/env python3
+"""Compare a benchmark report against a stored baseline.
+
+    benchmarks/compare.py baseline.json results.json [--threshold 0.10]
+
+Both files come from the benchmarks program. A benchmark regresses when
+its median time per op grows by more than the threshold and its fastest
+repetition is also slower than the baseline's slowest, so run-to-run
+noise is not flagged. Exits 1 if anything regressed.
+"""
+
+import argparse
+import json
+import sys
+
+
+def load(path):
+    with open(path) as report:
+        return {bench["name"]: bench for bench in json.load(report)["benchmarks"]}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("baseline")
+    parser.add_argument("results")
+    parser.add_argument("--threshold", type=float, default=0.10,
+                        help="allowed slowdown of the median, as a fraction (default 0.10)")
+    args = parser.parse_args()
+
+    baseline = load(args.baseline)
+    results = load(args.results)
+
+    regressions = 0
+    print(f"{'benchmark':36} {'baseline':>12} {'now':>12} {'change':>8}")
+    for name, now in results.items():
+        before = baseline.get(name)
+        if before is None:
+            print(f"{name:36} {'-':>12} {now['ns_per_op']:12.1f}      new")
+            continue
+        change = now["ns_per_op"] / before["ns_per_op"] - 1
+        regressed = change > args.threshold and now["ns_per_op_min"] > before["ns_per_op_max"]
+        regressions += regressed
+        print(f"{name:36} {before['ns_per_op']:12.1f} {now['ns_per_op']:12.1f} {change:+8.1%}"
+              + ("  REGRESSION" if regressed else ""))
+    for name in baseline.keys() - results.keys():
+        print(f"{name:36} {baseline[name]['ns_per_op']:12.1f} {'-':>12}  missing")
+
+    if regressions:
+        print(f"{regressions} benchmark(s) regressed by more than {args.threshold:.0%}")
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,275 @@
+// Host-side check of the joystick on the reactor
+// Runs the joystick with fake GPIO pipes for the sysfs directions and
+// simulated PRU memory for the ones the PRU samples, and checks that:
+// - a press reaches the song controls within a fixed latency of the edge:
+//   the gesture debounce for GPIO directions, next to nothing for PRU ones,
+//   which wake the reactor through the PRU event
+// - a PRU press and release published before ARM reads them still counts
+// - with the joystick idle, the reactor is not woken at all
+// Song controls are stubbed out here to time when presses land.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/resource.h>
+
+#include "reactor.h"
+#include "shutdown.h"
+#include "timeDelay.h"
+#include "midiController.h"
+#include "hal/pruMem.h"
+#include "hal/sharedDataStruct.h"
+#include "hal/joystick.h"
+#include "hal/joystickGesture.h"
+
+#define NS_PER_MS 1000000LL
+#define NS_PER_US 1000LL
+
+// Reactor thread CPU allowed over the idle window, and wakeups on top of
+// the ones taking the samples
+#define IDLE_WINDOW_MS 2000
+#define IDLE_MAX_CPU_US 2000
+#define IDLE_MAX_WAKEUPS 0
+
+// How late a press may land after it is due. Covers the host scheduling
+// the reactor thread.
+#define LATENCY_TOLERANCE_MS 5
+// Longest to wait for a press to land at all
+#define PRESS_TIMEOUT_MS 1000
+// Time after a release for its debounce to finish
+#define SETTLE_MS 100
+
+static int failures = 0;
+
+#define CHECK(condition, ...) \
+    do { \
+        if (!(condition)) { \
+            printf("FAIL: " __VA_ARGS__); \
+            printf("\n"); \
+            failures++; \
+        } \
+    } while (0)
+
+enum songControl {
+    SONG_RESTART,
+    SONG_LEFT,
+    SONG_RIGHT,
+    NUM_SONG_CONTROLS
+};
+
+static pthread_t reactorThread;
+static reactorTimer_t *pSampleTimer;
+static sem_t sampleDone;
+static long long reactorCpuUs;
+static long long reactorSleeps;
+
+static volatile sharedMemStruct_t *pSharedPru;
+static uint32_t pruEdges;
+
+// Set by the song control stubs on the reactor thread
+static sem_t songControlDone;
+static long long songControlNs[NUM_SONG_CONTROLS];
+static int songControlCount[NUM_SONG_CONTROLS];
+
+// Stand-ins for the song controls the joystick drives
+static void recordSongControl(enum songControl control)
+{
+    songControlNs[control] = getMonotonicTimeInNs();
+    songControlCount[control]++;
+    sem_post(&songControlDone);
+}
+
+void MidiController_setSong(int newSong)
+{
+    (void) newSong;
+    recordSongControl(SONG_RESTART);
+}
+
+int MidiController_getCurrentSong()
+{
+    return TWINKLE;
+}
+
+void MidiController_cycleSongLeft()
+{
+    recordSongControl(SONG_LEFT);
+}
+
+void MidiController_cycleSongRight()
+{
+    recordSongControl(SONG_RIGHT);
+}
+
+static void *reactorThreadFunction(void *pArg)
+{
+    (void) pArg;
+    pthread_setname_np(pthread_self(), "reactor");
+    Reactor_run();
+    return NULL;
+}
+
+// Runs on the reactor thread, see ledSchedulerCheck.c
+static void sampleReactor(void *pContext)
+{
+    (void) pContext;
+    struct rusage usage;
+    getrusage(RUSAGE_THREAD, &usage);
+    reactorCpuUs = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000LL
+        + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+    reactorSleeps = usage.ru_nvcsw;
+    sem_post(&sampleDone);
+}
+
+static void sampleReactorNow(void)
+{
+    Reactor_armTimer(pSampleTimer, getMonotonicTimeInNs(), 0);
+    sem_wait(&sampleDone);
+}
+
+static void checkIdle(const char *when)
+{
+    sampleReactorNow();
+    long long startCpuUs = reactorCpuUs;
+    long long startSleeps = reactorSleeps;
+    sleepForMs(IDLE_WINDOW_MS);
+    sampleReactorNow();
+    long long cpuUs = reactorCpuUs - startCpuUs;
+    // Less the sleep after the first sample
+    long long wakeups = reactorSleeps - startSleeps - 1;
+
+    printf("Idle %s: %lld us of reactor CPU and %lld wakeups in %d ms\n",
+        when, cpuUs, wakeups, IDLE_WINDOW_MS);
+    CHECK(cpuUs <= IDLE_MAX_CPU_US, "idle %s used %lld us of CPU, over %d us",
+        when, cpuUs, IDLE_MAX_CPU_US);
+    CHECK(wakeups <= IDLE_MAX_WAKEUPS, "idle %s woke the reactor %lld times, over %d",
+        when, wakeups, IDLE_MAX_WAKEUPS);
+}
+
+// Wait for a song control to be used. Returns false if it never was.
+static bool waitForSongControl(void)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += PRESS_TIMEOUT_MS / 1000;
+    while (sem_timedwait(&songControlDone, &deadline) == -1) {
+        if (errno != EINTR) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Publish the PRU's joystick state the way the firmware does, and raise
+// its event unless the caller wants to batch several edges
+static void publishPru(uint32_t pressed, uint32_t changed, bool isSignalled)
+{
+    pruEdges++;
+    pSharedPru->joystickState = (pruEdges << 16) | (changed << 8) | pressed;
+    if (isSignalled) {
+        PruMem_raiseEvent();
+    }
+}
+
+static void checkLatency(const char *name, enum songControl control,
+    long long pressNs, long long dueMs)
+{
+    if (!waitForSongControl()) {
+        CHECK(false, "%s press never landed", name);
+        return;
+    }
+    long long latencyUs = (songControlNs[control] - pressNs) / NS_PER_US;
+    printf("%s press landed after %lld us (due after %lld ms)\n", name, latencyUs, dueMs);
+    CHECK(latencyUs >= dueMs * 1000 && latencyUs <= (dueMs + LATENCY_TOLERANCE_MS) * 1000,
+        "%s press landed after %lld us, due after %lld ms", name, latencyUs, dueMs);
+}
+
+// A sysfs direction: edges wake the reactor, then it waits out the debounce
+static void checkGpioPress(void)
+{
+    int countBefore = songControlCount[SONG_LEFT];
+    long long pressNs = getMonotonicTimeInNs();
+    Joystick_setFakePressed(JOYSTICK_LEFT, true);
+    checkLatency("GPIO left", SONG_LEFT, pressNs, GESTURE_DEBOUNCE_MS);
+    // Let go well before it would repeat
+    Joystick_setFakePressed(JOYSTICK_LEFT, false);
+    sleepForMs(SETTLE_MS);
+    CHECK(songControlCount[SONG_LEFT] == countBefore + 1, "GPIO left pressed %d times, not once",
+        songControlCount[SONG_LEFT] - countBefore);
+}
+
+// A PRU direction: already debounced, so it lands as soon as the event does
+static void checkPruPress(void)
+{
+    int countBefore = songControlCount[SONG_RIGHT];
+    long long pressNs = getMonotonicTimeInNs();
+    publishPru(PRU_JOYSTICK_RIGHT, PRU_JOYSTICK_RIGHT, true);
+    checkLatency("PRU right", SONG_RIGHT, pressNs, 0);
+    publishPru(0, PRU_JOYSTICK_RIGHT, true);
+    sleepForMs(SETTLE_MS);
+    CHECK(songControlCount[SONG_RIGHT] == countBefore + 1, "PRU right pressed %d times, not once",
+        songControlCount[SONG_RIGHT] - countBefore);
+}
+
+// Press and release both published before ARM gets to look. The tap reads
+// as held until the next look at the joystick, at the repeat deadline.
+static void checkPruTap(void)
+{
+    int countBefore = songControlCount[SONG_RIGHT];
+    publishPru(PRU_JOYSTICK_RIGHT, PRU_JOYSTICK_RIGHT, false);
+    publishPru(0, PRU_JOYSTICK_RIGHT, true);
+    CHECK(waitForSongControl(), "PRU right tap never landed");
+    sleepForMs(GESTURE_REPEAT_DELAY_MS + SETTLE_MS);
+    CHECK(songControlCount[SONG_RIGHT] == countBefore + 1, "PRU right tap pressed %d times, not once",
+        songControlCount[SONG_RIGHT] - countBefore);
+}
+
+int main(void)
+{
+    Shutdown_init();
+    Reactor_init();
+    PruMem_useFileBackend(NULL);
+    // Firmware that samples right and down and signals its edges
+    volatile void *pPruBase = getPruMmapAddr();
+    pSharedPru = PRUSHARED_MEM_FROM_BASE(pPruBase);
+    pSharedPru->pruCaps = PRU_CAP_JOYSTICK | PRU_CAP_JOYSTICK_EVENT;
+    pSharedPru->joystickState = 0;
+    pruEdges = 0;
+
+    sem_init(&sampleDone, 0, 0);
+    sem_init(&songControlDone, 0, 0);
+    Joystick_useFakeGpio();
+    Joystick_init();
+    pSampleTimer = Reactor_addTimer("reactor sample", sampleReactor, NULL);
+    if (pthread_create(&reactorThread, NULL, reactorThreadFunction, NULL) != 0) {
+        printf("ERROR: Unable to start reactor thread\n");
+        exit(EXIT_FAILURE);
+    }
+
+    checkIdle("before presses");
+    checkGpioPress();
+    checkPruPress();
+    checkPruTap();
+    checkIdle("after presses");
+
+    Shutdown_triggerShutdown();
+    pthread_join(reactorThread, NULL);
+    Reactor_removeTimer(pSampleTimer);
+    Joystick_cleanup();
+    sem_destroy(&songControlDone);
+    sem_destroy(&sampleDone);
+    freePruMmapAddr(pPruBase);
+    Reactor_cleanup();
+
+    if (failures > 0) {
+        printf("%d checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("All joystick checks passed\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,310 @@
+// Host-side check of the ARM LED effect scheduler
+// Runs LedScheduler on the reactor against simulated PRU memory, with the
+// fake PRU latching frames, and checks that:
+// - with no effects running, the reactor thread uses next to no CPU and
+//   is not woken
+// - with several effects running at once on different LEDs, every LED
+//   change is latched within a fixed tolerance of when it was due
+// Exits non-zero if anything is off, so it can gate scheduler changes.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/resource.h>
+
+#include "reactor.h"
+#include "shutdown.h"
+#include "timeDelay.h"
+#include "hal/pruMem.h"
+#include "hal/fakePru.h"
+#include "hal/ledDriver.h"
+#include "hal/ledScheduler.h"
+#include "hal/colours.h"
+
+#define NS_PER_MS 1000000LL
+#define NS_PER_US 1000LL
+
+// One LED per key, as main() sets up
+#define STRIP_LENGTH 14
+
+// Reactor thread CPU allowed over the idle window, and wakeups on top of
+// the ones taking the samples
+#define IDLE_WINDOW_MS 2000
+#define IDLE_MAX_CPU_US 2000
+#define IDLE_MAX_WAKEUPS 0
+
+// How far a latched LED change may be from its deadline. Covers the fake
+// PRU polling every 100 us and the host scheduling the reactor thread.
+#define TIMING_TOLERANCE_US 3000
+// Time after the last effect ends for its final frame to be latched
+#define SETTLE_MS 100
+
+// Expected LED changes, from the effect descriptions in sharedDataStruct.h
+#define MAX_EXPECTED_CHANGES 512
+
+static int failures = 0;
+
+#define CHECK(condition, ...) \
+    do { \
+        if (!(condition)) { \
+            printf("FAIL: " __VA_ARGS__); \
+            printf("\n"); \
+            failures++; \
+        } \
+    } while (0)
+
+typedef struct {
+    long long dueMs;
+    int led;
+    uint32_t colour;
+} expectedChange_t;
+
+static pthread_t reactorThread;
+static reactorTimer_t *pSampleTimer;
+static sem_t sampleDone;
+static long long reactorCpuUs;
+static long long reactorSleeps;
+
+// Several effects at once, on LEDs that do not overlap
+static const ledAnimation_t effects[] = {
+    {.type = LED_ANIM_BLINK, .repeat = 3, .firstLed = 0, .lastLed = 0,
+        .onMs = 100, .offMs = 50, .colour = BRIGHT_RED},
+    {.type = LED_ANIM_BLINK, .repeat = 4, .firstLed = 1, .lastLed = 2,
+        .onMs = 70, .offMs = 30, .colour = BRIGHT_BLUE},
+    {.type = LED_ANIM_SWEEP, .repeat = 2, .firstLed = 4, .lastLed = 9,
+        .onMs = 40, .colour = WHITE},
+    {.type = LED_ANIM_CHASE, .repeat = 3, .firstLed = 10, .lastLed = 13,
+        .onMs = 30, .colour = BRIGHT_GREEN},
+};
+#define NUM_EFFECTS ((int) (sizeof(effects) / sizeof(effects[0])))
+
+static void *reactorThreadFunction(void *pArg)
+{
+    (void) pArg;
+    pthread_setname_np(pthread_self(), "reactor");
+    Reactor_run();
+    return NULL;
+}
+
+// Runs on the reactor thread: RUSAGE_THREAD then covers only the reactor
+// and the callbacks it runs, not the fake PRU polling next to it. Each
+// time the reactor goes back to sleep in epoll_wait() is one voluntary
+// context switch.
+static void sampleReactor(void *pContext)
+{
+    (void) pContext;
+    struct rusage usage;
+    getrusage(RUSAGE_THREAD, &usage);
+    reactorCpuUs = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000LL
+        + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+    reactorSleeps = usage.ru_nvcsw;
+    sem_post(&sampleDone);
+}
+
+static void sampleReactorNow(void)
+{
+    Reactor_armTimer(pSampleTimer, getMonotonicTimeInNs(), 0);
+    sem_wait(&sampleDone);
+}
+
+static void checkIdle(const char *when)
+{
+    sampleReactorNow();
+    long long startCpuUs = reactorCpuUs;
+    long long startSleeps = reactorSleeps;
+    sleepForMs(IDLE_WINDOW_MS);
+    sampleReactorNow();
+    long long cpuUs = reactorCpuUs - startCpuUs;
+    // Less the sleep after the first sample
+    long long wakeups = reactorSleeps - startSleeps - 1;
+
+    printf("Idle %s: %lld us of reactor CPU and %lld wakeups in %d ms\n",
+        when, cpuUs, wakeups, IDLE_WINDOW_MS);
+    CHECK(cpuUs <= IDLE_MAX_CPU_US, "idle %s used %lld us of CPU, over %d us",
+        when, cpuUs, IDLE_MAX_CPU_US);
+    CHECK(wakeups <= IDLE_MAX_WAKEUPS, "idle %s woke the reactor %lld times, over %d",
+        when, wakeups, IDLE_MAX_WAKEUPS);
+}
+
+// Colour of one LED msIntoEffect after it started, or 0 once it has finished
+static uint32_t getExpectedColour(const ledAnimation_t *pAnim, int led, long long msIntoEffect)
+{
+    long long span = pAnim->lastLed - pAnim->firstLed + 1;
+    switch (pAnim->type) {
+        case LED_ANIM_BLINK: {
+            long long period = pAnim->onMs + pAnim->offMs;
+            if (msIntoEffect >= period * pAnim->repeat) {
+                return 0;
+            }
+            return msIntoEffect % period < pAnim->onMs ? pAnim->colour : 0;
+        }
+        case LED_ANIM_SWEEP:
+        case LED_ANIM_CHASE: {
+            long long step = msIntoEffect / pAnim->onMs;
+            if (step >= span * pAnim->repeat) {
+                return 0;
+            }
+            int pos = step % span;
+            bool isLit = led == pAnim->firstLed + pos
+                || (pAnim->type == LED_ANIM_SWEEP && led == pAnim->lastLed - pos);
+            return isLit ? pAnim->colour : 0;
+        }
+        default:
+            return 0;
+    }
+}
+
+static long long getEffectLengthMs(const ledAnimation_t *pAnim)
+{
+    if (pAnim->type == LED_ANIM_BLINK) {
+        return (pAnim->onMs + pAnim->offMs) * pAnim->repeat;
+    }
+    return (pAnim->lastLed - pAnim->firstLed + 1) * pAnim->onMs * pAnim->repeat;
+}
+
+// Every change to every LED, in the order each LED sees them
+static int buildExpectedChanges(expectedChange_t *pChanges, long long *pLastMs)
+{
+    int numChanges = 0;
+    *pLastMs = 0;
+    for (int i = 0; i < NUM_EFFECTS; i++) {
+        const ledAnimation_t *pAnim = &effects[i];
+        long long lengthMs = getEffectLengthMs(pAnim);
+        if (lengthMs > *pLastMs) {
+            *pLastMs = lengthMs;
+        }
+        for (int led = pAnim->firstLed; led <= pAnim->lastLed; led++) {
+            // Starts from the blank strip LED_init() commits
+            uint32_t colour = 0;
+            for (long long ms = 0; ms <= lengthMs; ms++) {
+                uint32_t newColour = getExpectedColour(pAnim, led, ms);
+                if (newColour != colour) {
+                    if (numChanges == MAX_EXPECTED_CHANGES) {
+                        printf("ERROR: More than %d expected LED changes\n", MAX_EXPECTED_CHANGES);
+                        exit(EXIT_FAILURE);
+                    }
+                    pChanges[numChanges++] = (expectedChange_t) {ms, led, newColour};
+                    colour = newColour;
+                }
+            }
+        }
+    }
+    return numChanges;
+}
+
+static void checkEffectTiming(void)
+{
+    static expectedChange_t changes[MAX_EXPECTED_CHANGES];
+    long long lastMs;
+    int numChanges = buildExpectedChanges(changes, &lastMs);
+
+    int firstFrame = FakePru_getFrameCount();
+    long long startNs = getMonotonicTimeInNs();
+    for (int i = 0; i < NUM_EFFECTS; i++) {
+        LED_playAnimation(&effects[i]);
+    }
+    sleepForMs(lastMs + SETTLE_MS);
+    CHECK(LedScheduler_getActiveCount() == 0, "%d effects still running after %lld ms",
+        LedScheduler_getActiveCount(), lastMs + SETTLE_MS);
+
+    int numFrames = FakePru_getFrameCount() - firstFrame;
+    fakePruFrame_t *pFrames = malloc(numFrames * sizeof(fakePruFrame_t));
+    if (pFrames == NULL) {
+        printf("ERROR: Unable to allocate %d frames\n", numFrames);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < numFrames; i++) {
+        if (!FakePru_getFrame(firstFrame + i, &pFrames[i])) {
+            printf("ERROR: Fake PRU no longer holds frame %d\n", firstFrame + i);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Each change is latched in the first frame after the one before it on
+    // that LED where the LED shows its new colour
+    int nextFrame[STRIP_LENGTH] = {0};
+    long long totalLatenessNs = 0;
+    long long maxLatenessNs = 0;
+    int numMatched = 0;
+    for (int i = 0; i < numChanges; i++) {
+        const expectedChange_t *pChange = &changes[i];
+        int frame = nextFrame[pChange->led];
+        while (frame < numFrames && pFrames[frame].colour[pChange->led] != pChange->colour) {
+            frame++;
+        }
+        if (frame == numFrames) {
+            CHECK(false, "LED %d never changed to %06x, due at %lld ms",
+                pChange->led, pChange->colour, pChange->dueMs);
+            nextFrame[pChange->led] = numFrames;
+            continue;
+        }
+        nextFrame[pChange->led] = frame;
+
+        long long latenessNs = pFrames[frame].timestampNs - (startNs + pChange->dueMs * NS_PER_MS);
+        CHECK(latenessNs >= -TIMING_TOLERANCE_US * NS_PER_US
+                && latenessNs <= TIMING_TOLERANCE_US * NS_PER_US,
+            "LED %d changed to %06x %lld us from its deadline at %lld ms",
+            pChange->led, pChange->colour, latenessNs / NS_PER_US, pChange->dueMs);
+        long long absLatenessNs = latenessNs < 0 ? -latenessNs : latenessNs;
+        totalLatenessNs += absLatenessNs;
+        if (absLatenessNs > maxLatenessNs) {
+            maxLatenessNs = absLatenessNs;
+        }
+        numMatched++;
+    }
+
+    // Every effect hands its LEDs back to the blank frame
+    if (numFrames > 0) {
+        for (int led = 0; led < STRIP_LENGTH; led++) {
+            CHECK(pFrames[numFrames - 1].colour[led] == 0, "LED %d left at %06x",
+                led, pFrames[numFrames - 1].colour[led]);
+        }
+    }
+
+    if (numMatched > 0) {
+        printf("%d effects: %d LED changes in %d frames, mean %lld us, max %lld us from deadline\n",
+            NUM_EFFECTS, numMatched, numFrames,
+            totalLatenessNs / numMatched / NS_PER_US, maxLatenessNs / NS_PER_US);
+    }
+    free(pFrames);
+}
+
+int main(void)
+{
+    Shutdown_init();
+    Reactor_init();
+    PruMem_useFileBackend(NULL);
+    // The fake PRU has no animation support, so LED_init() starts the scheduler
+    FakePru_init(NULL);
+    LED_init(STRIP_LENGTH);
+
+    sem_init(&sampleDone, 0, 0);
+    pSampleTimer = Reactor_addTimer("reactor sample", sampleReactor, NULL);
+    if (pthread_create(&reactorThread, NULL, reactorThreadFunction, NULL) != 0) {
+        printf("ERROR: Unable to start reactor thread\n");
+        exit(EXIT_FAILURE);
+    }
+
+    checkIdle("before effects");
+    checkEffectTiming();
+    checkIdle("after effects");
+
+    Shutdown_triggerShutdown();
+    pthread_join(reactorThread, NULL);
+    Reactor_removeTimer(pSampleTimer);
+    sem_destroy(&sampleDone);
+    LED_cleanup();
+    FakePru_cleanup();
+    Reactor_cleanup();
+
+    if (failures > 0) {
+        printf("%d checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("All LED scheduler checks passed\n");
+    return EXIT_SUCCESS;
+}
@@ -14,9 +14,15 @@ void audioGenerator_playMusic();
 
 // init() must be called before any other functions,
 // cleanup() must be called last to stop playback threads and free memory.
+// Playback stops after a second with nothing to play, and starts again
+// with the next queued sound.
 void audioGenerator_init(void);
 void audioGenerator_cleanup(void);
 
+// Mix into a null sink instead of the ALSA default device, for running
+// without a sound card. Must be called before audioGenerator_init().
+void audioGenerator_useNullSink(void);
+
 // Read the contents of a wave file into the pSound structure. Note that
 // the pData pointer in this structure will be dynamically allocated in
 // readWaveFileIntoMemory(), and is freed by calling freeWaveFileData().
@@ -33,6 +39,16 @@ void audioGenerator_clearSound(void);
 int  audioGenerator_getVolume(void);
 void audioGenerator_setVolume(int newVolume);
 
+// Playback health since init: an xrun is an underrun, where the mixer did
+// not refill the buffer before the hardware ran out of audio.
+typedef struct {
+	unsigned long periodsWritten;
+	unsigned long xruns;
+	unsigned long shortWrites;
+} audioGeneratorStats_t;
+
+void audioGenerator_getStats(audioGeneratorStats_t *pStats);
+
 // Increase/ decrease volume by five if possible
 void audioGenerator_increaseVolumeFive();
 void audioGenerator_decreaseVolumeFive();
@@ -2,6 +2,8 @@
 #define COLOURS_H
 
 // Ordering is GRB, not RGB
+// These are the colours as requested; the LED driver maps every channel
+// through its gamma and brightness table when a frame is committed.
 #define BRIGHT_RED  0x00F000
 #define BRIGHT_GREEN  0xF00000
 #define BRIGHT_BLUE  0x0000F0
@@ -0,0 +1,33 @@
+// Host-side stand-in for the PRU LED firmware
+// Runs against simulated PRU memory (see PruMem_useFileBackend()).
+// Latches committed frames the same way the firmware does, and records
+// every latched frame with a timestamp so LED output can be checked or
+// benchmarked without a BeagleBone.
+
+#ifndef _FAKEPRU_H_
+#define _FAKEPRU_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "hal/sharedDataStruct.h"
+
+typedef struct {
+    // Monotonic time the frame was latched
+    long long timestampNs;
+    uint32_t seq;
+    uint32_t numLeds;
+    uint32_t colour[MAX_STR_LEN];
+} fakePruFrame_t;
+
+// Starts the fake PRU thread. If capturePath is not NULL, every latched
+// frame is also appended to that file as one line of text.
+void FakePru_init(const char *capturePath);
+void FakePru_cleanup(void);
+
+// Number of frames latched since init
+int FakePru_getFrameCount(void);
+// Copies a captured frame, 0 being the oldest still held in memory.
+// Returns false if index is out of range.
+bool FakePru_getFrame(int index, fakePruFrame_t *pFrame);
+
+#endif
@@ -0,0 +1,29 @@
+// Module to pick what the HAL runs on: the BeagleBone hardware, or a
+// simulation so the whole app can run headless on a plain Linux PC.
+// The simulated backend swaps in:
+//   PRU memory     memfd (or KGS_SIM_PRU_MEM file), served by the fake PRU;
+//                  latched LED frames go to KGS_SIM_LED_CAPTURE if set
+//   joystick       pipes, driven by Joystick_setFakePressed()
+//   14-seg display no I2C or GPIO, writes are only counted
+//   MIDI keyboard  recording replayed from KGS_SIM_MIDI if set, else none
+//   audio          null sink paced by the clock
+// Selected by the KGS_HAL_BACKEND environment variable ("hw" or "sim"),
+// defaulting to the backend the HAL was built with.
+
+#ifndef _HAL_BACKEND_H_
+#define _HAL_BACKEND_H_
+
+enum halBackend {
+    HAL_BACKEND_HW = 0,
+    HAL_BACKEND_SIM,
+};
+
+// Must be called before any other HAL init, and cleaned up after all the
+// other HAL modules.
+void HalBackend_init(void);
+void HalBackend_cleanup(void);
+
+enum halBackend HalBackend_get(void);
+const char *HalBackend_getName(void);
+
+#endif
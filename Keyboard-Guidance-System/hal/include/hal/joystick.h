@@ -21,6 +21,14 @@ enum joystickDirections
 void Joystick_init(void);
 void Joystick_cleanup(void);
 
+// Use pipes in place of the sysfs GPIO files (and skip the real PRU), so
+// the joystick can be driven on a PC. With simulated PRU memory, directions
+// the PRU samples are still read from it. Must be called before
+// Joystick_init().
+void Joystick_useFakeGpio(void);
+// Fake GPIO only: press or release a direction the PRU does not sample
+void Joystick_setFakePressed(enum joystickDirections direction, bool isPressed);
+
 // Checks if a joystick direction is pressed
 bool Joystick_isDirectionPressed(enum joystickDirections direction);
 // Checks if any joystick directions are pressed
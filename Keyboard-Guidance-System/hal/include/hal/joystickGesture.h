@@ -0,0 +1,50 @@
+// Module to turn raw joystick levels into gestures
+// Each direction has its own debounce and state machine, driven only by
+// the monotonic timestamps it is fed, so nothing here ever sleeps.
+// Not thread safe: feed and drain it from the joystick thread.
+
+#ifndef _JOYSTICKGESTURE_H_
+#define _JOYSTICKGESTURE_H_
+
+#include <stdbool.h>
+#include "hal/joystick.h"
+
+// Defaults, in ms
+#define GESTURE_DEBOUNCE_MS         20
+#define GESTURE_LONG_PRESS_MS       1000
+#define GESTURE_REPEAT_DELAY_MS     500     // Held this long before repeating
+#define GESTURE_REPEAT_INTERVAL_MS  200
+
+enum joystickGestureType {
+    GESTURE_PRESS,
+    GESTURE_RELEASE,
+    // Sent once when a press has been held for GESTURE_LONG_PRESS_MS
+    GESTURE_LONG_PRESS,
+    // Sent every GESTURE_REPEAT_INTERVAL_MS while held, after the repeat delay
+    GESTURE_REPEAT
+};
+
+typedef struct {
+    enum joystickDirections direction;
+    enum joystickGestureType type;
+    long long timestampNs;
+} joystickGesture_t;
+
+// Resets every direction to released
+void JoystickGesture_init(long long nowNs);
+
+// Debounce for one direction; 0 if its source already debounces
+void JoystickGesture_setDebounceMs(enum joystickDirections direction, int debounceMs);
+
+// Feed the current level of a direction. Call it for every direction each
+// time input is read, and at least by the time from getNextDeadlineNs().
+void JoystickGesture_update(enum joystickDirections direction, bool isPressed, long long nowNs);
+
+// Takes the oldest pending gesture. Returns false if there are none.
+bool JoystickGesture_nextEvent(joystickGesture_t *pGesture);
+
+// Time of the next debounce, long-press or repeat deadline, or -1 if
+// nothing will happen until a level changes
+long long JoystickGesture_getNextDeadlineNs(void);
+
+#endif
@@ -3,6 +3,9 @@
 #ifndef _LEDDRIVER_H_
 #define _LEDDRIVER_H_
 
+#include <stdbool.h>
+#include "hal/sharedDataStruct.h"
+
 // Changes colours of LEDs
 void changeColourLED(unsigned int colour, int LEDNum);
 void turnOnAllLEDs(unsigned int colour);
@@ -11,8 +14,31 @@ void turnOffAllLEDs(void);
 void LED_finishAnimation(void);
 void LED_triggerBlink(unsigned int colour, int LEDNum);
 
+// Plays an animation: rendered by the PRU when its firmware supports it,
+// otherwise by the ARM-side LED scheduler. Returns immediately.
+void LED_playAnimation(const ledAnimation_t *pAnimation);
+
+// Overlay used by the ARM-side LED scheduler. While an LED has an overlay it
+// shows the overlay colour instead of the one set by changeColourLED().
+// Overlay changes are committed together by LED_applyOverlay().
+void LED_setOverlay(int LEDNum, unsigned int colour);
+void LED_clearOverlay(int LEDNum);
+void LED_applyOverlay(void);
+
+// Global brightness (0-100) and gamma curve applied to every colour when a
+// frame is committed. Defaults are 100% and 1.0, i.e. colours unchanged.
+void LED_setBrightness(int percent);
+void LED_setGamma(double gamma);
+
+// Number of LEDs on the strip
+int LED_getStripLength(void);
+// Time the PRU took to stream the last frame, or 0 if not yet known.
+// The strip's maximum refresh rate is 1000000 / this.
+int LED_getFrameTransmitUs(void);
+
 // Cleanup and init functions for LEDs
-void LED_init(void);
+// stripLength is the number of LEDs on the strip, up to MAX_STR_LEN
+void LED_init(int stripLength);
 void LED_cleanup(void);
 
 #endif
\ No newline at end of file
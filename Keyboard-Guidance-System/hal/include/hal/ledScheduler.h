@@ -0,0 +1,24 @@
+// Module to run timed LED effects on ARM
+// Used when the PRU firmware cannot render animations itself.
+// Many effects can run at once on different LEDs; the scheduler runs on the
+// reactor only when the next effect step is due.
+
+#ifndef _LEDSCHEDULER_H_
+#define _LEDSCHEDULER_H_
+
+#include <stdbool.h>
+#include "hal/sharedDataStruct.h"
+
+// init and cleanup functions
+void LedScheduler_init(void);
+void LedScheduler_cleanup(void);
+
+// Queues an effect to start now. Never blocks or takes a lock, so it is safe
+// to call from any thread. An effect on exactly the same LEDs is restarted.
+// Returns false if the request queue is full.
+bool LedScheduler_submit(const ledAnimation_t *pAnimation);
+
+// Number of effects currently running
+int LedScheduler_getActiveCount(void);
+
+#endif
@@ -1,4 +1,4 @@
-// Module to continuously read output from MIDI keyboard
+// Module to read output from MIDI keyboard as it arrives, on the reactor
 // COnverts MIDI output into enum notes
 
 #ifndef _MIDI_READER_H
@@ -36,6 +36,12 @@ struct chord {
 void MidiReader_init(void);
 void MidiReader_cleanup(void);
 
+// Replay a recording instead of reading the keyboard through amidi, for a
+// PC. Each line is "<ms since init> <amidi line>", e.g. "500 90 3C 33";
+// lines starting with # are skipped. A NULL path means no local keyboard
+// at all (network MIDI still works). Must be called before MidiReader_init().
+void MidiReader_useRecording(const char *path);
+
 //converts int value to enum
 enum note MidiReader_intToNote(int note);
 // converts the enum note to string
@@ -50,5 +56,16 @@ void MidiReader_setNoteToPlay(enum note note);
 // to be called in src files
 bool MidiReader_getNeedToPlayNote();
 void MidiReader_setNeedToPlayNote(bool flag);
+// Hand a note-on (MIDI note number) to the controller, as if played on the
+// local keyboard. Returns false if it is out of range, or if the previous
+// note has not been played yet and this one was dropped.
+bool MidiReader_submitNote(int midiNote);
+
+// eventfd that becomes readable when a note is submitted, for the
+// controller to wait on. Read it to clear it.
+int MidiReader_getNoteEventFd(void);
+
+// monotonic time the current note to play was read from the controller
+long long MidiReader_getNoteTimeNs(void);
 
 #endif
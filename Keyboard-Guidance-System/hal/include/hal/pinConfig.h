@@ -0,0 +1,23 @@
+// Module to set pin modes and GPIO settings without a shell
+// Writes the pinmux and GPIO sysfs files directly, and skips any write
+// that would not change anything, so applying a config twice is cheap.
+// Falls back to config-pin (run in parallel) if a pinmux file is missing.
+
+#ifndef _PINCONFIG_H_
+#define _PINCONFIG_H_
+
+typedef struct {
+    // Header pin as config-pin names it, e.g. "P8_15"
+    const char *pin;
+    // Pinmux state, e.g. "gpio", "pruin", "pruout", "i2c"
+    const char *mode;
+} pinConfig_t;
+
+// Set the mode of each pin
+void PinConfig_apply(const pinConfig_t *pPins, int count);
+
+// GPIO direction ("in" or "out") and edge ("none", "rising", "falling", "both")
+void PinConfig_setGpioDirection(int gpio, const char *direction);
+void PinConfig_setGpioEdge(int gpio, const char *edge);
+
+#endif
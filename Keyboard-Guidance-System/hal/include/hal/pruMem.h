@@ -3,8 +3,40 @@
 #ifndef _PRUMEM_H_
 #define _PRUMEM_H_
 
+#include <stdbool.h>
+
+#define PRU0_DRAM     0x00000      // Offset to DRAM
+#define PRU1_DRAM     0x02000
+#define PRU_SHAREDMEM 0x10000      // Offset to shared memory
+#define PRU_MEM_RESERVED 0x200     // Amount used by stack and heap
+
+// Convert base address to each memory section
+#define PRU0_MEM_FROM_BASE(base) ( (base) + PRU0_DRAM + PRU_MEM_RESERVED)
+#define PRU1_MEM_FROM_BASE(base) ( (base) + PRU1_DRAM + PRU_MEM_RESERVED)
+#define PRUSHARED_MEM_FROM_BASE(base) ( (base) + PRU_SHAREDMEM)
+
 volatile void* getPruMmapAddr(void);
 void freePruMmapAddr(volatile void* pPruBase);
 
+// Map PRU memory from a plain file instead of /dev/mem, so the LED driver
+// can run on a machine without a PRU. A NULL path uses an anonymous memfd.
+// Must be called before the first getPruMmapAddr(); every later mapping
+// then shares the same memory.
+void PruMem_useFileBackend(const char *path);
+bool PruMem_isSimulated(void);
+
+// Event the PRU raises towards ARM (PRU_ARM_SYSEVT). Returns an fd that
+// becomes readable when it is raised, for the reactor to wait on, or -1 if
+// it cannot be received. On the board this is the uio device for the PRU's
+// host interrupt (KGS_PRU_EVENT_DEV, default /dev/uio0), and the PRU's
+// interrupt controller is set up to route the event there. With simulated
+// PRU memory it is an eventfd that PruMem_raiseEvent() writes to.
+int PruMem_openEvent(volatile void *pPruBase);
+// Call once woken, before reading what the PRU published: clears the
+// event, so the next one wakes the fd again
+void PruMem_ackEvent(int fd, volatile void *pPruBase);
+void PruMem_closeEvent(int fd);
+// Simulated PRU memory only: raise the event, as the firmware does
+void PruMem_raiseEvent(void);
 
-#endif
\ No newline at end of file
+#endif
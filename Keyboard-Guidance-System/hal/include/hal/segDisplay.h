@@ -5,5 +5,15 @@
 void SegmentDisplay_init(void);
 void SegmentDisplay_cleanup(void);
 
+// Run without the I2C display or its GPIOs, for a PC.
+// Must be called before SegmentDisplay_init().
+void SegmentDisplay_useSimulated(void);
+
+// Something happened that the display should show or stay lit for: a song
+// change or a note. The display only refreshes while its text moves or
+// its digits differ, and blanks after a minute with no wake. Cheap, and
+// safe from any thread.
+void SegmentDisplay_wake(void);
+
 
 #endif
\ No newline at end of file
@@ -0,0 +1,45 @@
+// Module with the 14-segment character set and scrolling text
+// A glyph is the pair of expander output registers that draw one character.
+// Text is turned into frames ahead of time, so the refresh loop only
+// indexes an array.
+
+#ifndef _SEGGLYPHS_H_
+#define _SEGGLYPHS_H_
+
+#include <stdbool.h>
+
+// Longest text a scroll can hold; longer text is cut short
+#define SEG_SCROLL_MAX_LEN 62
+// Blanks between the end of the text and the frame it comes to rest on
+#define SEG_SCROLL_GAP 2
+
+typedef struct {
+    unsigned char regA;
+    unsigned char regB;
+} segGlyph_t;
+
+// What the two digits show at one step of a scroll
+typedef struct {
+    segGlyph_t left;
+    segGlyph_t right;
+} segFrame_t;
+
+typedef struct {
+    segFrame_t frames[SEG_SCROLL_MAX_LEN + SEG_SCROLL_GAP];
+    int count;
+} segScroll_t;
+
+// Whether a character can be drawn; only glyphs whose segments have been
+// checked on the cape are included
+bool SegGlyphs_hasGlyph(char c);
+
+// Glyph for a character; lower case is drawn as upper case, and anything
+// without a glyph is blank
+segGlyph_t SegGlyphs_forChar(char c);
+
+// Build the frames for text. Two characters or fewer give one still
+// frame. Longer text scrolls left one character per frame, once, and the
+// last frame holds holdText (two characters or fewer) still.
+void SegGlyphs_buildScroll(const char *text, const char *holdText, segScroll_t *pScroll);
+
+#endif
@@ -1,11 +1,75 @@
 #ifndef _SHARED_DATA_STRUCT_H_
 #define _SHARED_DATA_STRUCT_H_
 
-#define STR_LEN 14
+// Most LEDs a strip can have; the length in use is set by ARM at startup
+#define MAX_STR_LEN 512
+
+// Frames are double buffered: ARM fills the buffer the PRU is not reading,
+// then publishes it by bumping frameSeq with a single store.
+// The buffer holding frame number `seq` is frame[FRAME_BUFFER_FOR_SEQ(seq)].
+#define NUM_FRAME_BUFFERS 2
+#define FRAME_BUFFER_FOR_SEQ(seq) ((seq) & (NUM_FRAME_BUFFERS - 1))
+
+// Animations the PRU can render on its own clock, independent of ARM
+#define NUM_ANIMATION_SLOTS 4
+
+// Feature bits the PRU firmware advertises in pruCaps at boot
+#define PRU_CAP_ANIMATION (1 << 0)
+#define PRU_CAP_JOYSTICK  (1 << 1)
+// Raises PRU_ARM_SYSEVT on every debounced joystick edge, so ARM can wait
+// for edges instead of re-reading joystickState
+#define PRU_CAP_JOYSTICK_EVENT (1 << 2)
+
+// PRU-ICSS system event the firmware raises towards ARM (PRU0_ARM_INTERRUPT)
+#define PRU_ARM_SYSEVT 19
+
+// Joystick directions wired to PRU0 inputs, as bits of the pressed bitmap
+#define PRU_JOYSTICK_RIGHT (1 << 0)     // P8.15, pru0_pru_r31_15
+#define PRU_JOYSTICK_DOWN  (1 << 1)     // P8.16, pru0_pru_r31_14
+
+// joystickState packs everything into one word so ARM reads it with a single
+// load: bits 0-7 debounced pressed bitmap, bits 8-15 the bits that changed
+// on the latest edge, bits 16-31 a count of debounced edges.
+#define PRU_JOYSTICK_PRESSED(state)     ((state) & 0xFF)
+#define PRU_JOYSTICK_LAST_CHANGE(state) (((state) >> 8) & 0xFF)
+#define PRU_JOYSTICK_EDGES(state)       ((state) >> 16)
 
 #include <stdbool.h>
 #include <stdint.h>
 
+enum ledAnimationType {
+    LED_ANIM_NONE = 0,
+    // All LEDs in range flash `repeat` times, onMs lit then offMs dark
+    LED_ANIM_BLINK,
+    // Two dots start at either end of the range and cross, onMs per step
+    LED_ANIM_SWEEP,
+    // All LEDs in range ramp up and back down, onMs per fade cycle
+    LED_ANIM_FADE,
+    // One dot runs from firstLed to lastLed, onMs per step
+    LED_ANIM_CHASE
+};
+
+// Describes one animation. While it runs it owns LEDs firstLed..lastLed;
+// when it finishes those LEDs go back to the committed frame.
+typedef struct {
+    uint8_t type;           // enum ledAnimationType
+    uint8_t repeat;         // blinks, passes or fade cycles
+    uint16_t firstLed;
+    uint16_t lastLed;
+    uint16_t onMs;
+    uint16_t offMs;
+    uint16_t _p1;
+    uint32_t colour;        // GRB
+} ledAnimation_t;
+
+typedef struct {
+    // Written by ARM; startSeq is bumped last to (re)start the animation
+    ledAnimation_t animation;
+    uint32_t startSeq;
+    // Written by PRU; set to startSeq once the animation has finished
+    uint32_t doneSeq;
+} ledAnimationSlot_t;
+
 
 // WARNING:
 // Fields in the struct must be aligned to match ARM's alignment
@@ -19,10 +83,28 @@
 typedef struct {
     // 1 byte
     bool isLedOn;
-        
-    _Alignas(32) uint32_t colour[STR_LEN];
 
-    
+    // Written by ARM only
+    _Alignas(32) uint32_t frame[NUM_FRAME_BUFFERS][MAX_STR_LEN];
+    // Number of the newest complete frame, written last on each commit
+    uint32_t frameSeq;
+    // LEDs on the strip, at most MAX_STR_LEN
+    uint32_t numLeds;
+
+    // Written by PRU only
+    // Frames streamed out to the LEDs
+    uint32_t framesSent;
+    // Frames that were replaced by a newer commit before the PRU latched them
+    uint32_t framesDropped;
+    // PRU_CAP_* bits supported by the running firmware
+    uint32_t pruCaps;
+    // PRU cycles (5ns each) taken to stream the last frame, reset included
+    uint32_t frameTxCycles;
+    // Debounced joystick inputs, see PRU_JOYSTICK_*
+    uint32_t joystickState;
+
+    ledAnimationSlot_t animations[NUM_ANIMATION_SLOTS];
+
 } sharedMemStruct_t;
 
 #endif
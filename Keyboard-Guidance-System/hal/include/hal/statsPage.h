@@ -0,0 +1,91 @@
+// Module to publish live counters and gauges in a shared memory page, so
+// tools/kgsStats.c can watch them from another process without asking the
+// app for anything. Updating one is a relaxed load and store to memory the
+// reader only ever reads: no locks, no syscalls, nothing for the reader to
+// hold up. Each entry has a cache line to itself, so threads updating
+// different entries do not slow each other down.
+// Each entry must only be updated by one thread at a time.
+
+#ifndef _STATS_PAGE_H_
+#define _STATS_PAGE_H_
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+// Under /dev/shm
+#define STATS_PAGE_NAME "/kgs-stats"
+#define STATS_PAGE_MAGIC "KGSSTATS"
+#define STATS_PAGE_VERSION 1
+#define STATS_MAX_ENTRIES 64
+#define STATS_NAME_LEN 48
+
+enum statsKind {
+    // Only goes up: the reader shows its rate
+    STATS_KIND_COUNTER = 1,
+    // A level, shown as is
+    STATS_KIND_GAUGE = 2,
+};
+
+typedef struct {
+    _Alignas(64) _Atomic uint64_t value;
+    uint8_t kind;
+    char name[STATS_NAME_LEN];
+} statsEntry_t;
+
+// The shared page. Entries [0, numEntries) are filled in; new ones are
+// only added, so the reader picks them up as numEntries grows.
+typedef struct {
+    char magic[sizeof(STATS_PAGE_MAGIC) - 1];
+    uint32_t version;
+    uint32_t pid;
+    _Atomic uint32_t numEntries;
+    // Cleared when the app exits
+    _Atomic uint32_t isRunning;
+    statsEntry_t entries[STATS_MAX_ENTRIES];
+} statsPage_t;
+
+// Each update site looks its entry up once, then only writes
+#define STATS_UPDATE(name, kind, update, amount) \
+    do { \
+        static _Atomic(statsEntry_t *) pStatsEntry; \
+        statsEntry_t *pEntry = atomic_load_explicit(&pStatsEntry, memory_order_relaxed); \
+        if (pEntry == NULL) { \
+            pEntry = StatsPage_register(name, kind); \
+            atomic_store_explicit(&pStatsEntry, pEntry, memory_order_relaxed); \
+        } \
+        update(pEntry, (amount)); \
+    } while (0)
+
+#define STATS_ADD(name, amount) STATS_UPDATE(name, STATS_KIND_COUNTER, StatsPage_add, amount)
+#define STATS_SET(name, value) STATS_UPDATE(name, STATS_KIND_GAUGE, StatsPage_set, value)
+// Gauge holding the largest value seen
+#define STATS_MAX(name, value) STATS_UPDATE(name, STATS_KIND_GAUGE, StatsPage_max, value)
+
+// Creates the shared page; call before anything is updated. Without it,
+// entries go to a page private to the process.
+void StatsPage_init(void);
+void StatsPage_cleanup(void);
+
+// Returns the entry for name, the same one each time. Exits if the page
+// is full or name already has another kind.
+statsEntry_t *StatsPage_register(const char *name, enum statsKind kind);
+
+static inline void StatsPage_add(statsEntry_t *pEntry, uint64_t amount)
+{
+    uint64_t value = atomic_load_explicit(&pEntry->value, memory_order_relaxed);
+    atomic_store_explicit(&pEntry->value, value + amount, memory_order_relaxed);
+}
+
+static inline void StatsPage_set(statsEntry_t *pEntry, uint64_t value)
+{
+    atomic_store_explicit(&pEntry->value, value, memory_order_relaxed);
+}
+
+static inline void StatsPage_max(statsEntry_t *pEntry, uint64_t value)
+{
+    if (value > atomic_load_explicit(&pEntry->value, memory_order_relaxed)) {
+        atomic_store_explicit(&pEntry->value, value, memory_order_relaxed);
+    }
+}
+
+#endif
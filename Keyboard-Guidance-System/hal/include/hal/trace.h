@@ -0,0 +1,90 @@
+// Module to trace where time goes between a key press and the sound.
+// Trace points write fixed-size events into a ring buffer owned by the
+// calling thread: no locks, no syscalls beyond reading the clock. Each
+// thread keeps its last TRACE_BUFFER_EVENTS events.
+// Dump them with the UDP "trace" command or SIGUSR1, and turn the dump into
+// Chrome/Perfetto trace JSON with tools/traceToChrome.c.
+// Trace points compile to nothing unless KGS_TRACE is defined (CMake
+// option KGS_TRACE).
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define TRACE_BUFFER_EVENTS 4096
+#define TRACE_MAX_THREADS 16
+#define TRACE_MAX_NAMES 256
+#define TRACE_THREAD_NAME_LEN 16
+// Where SIGUSR1 and "trace" with no path dump to
+#define TRACE_DEFAULT_PATH "/tmp/kgs-trace.bin"
+
+// Same meaning as the Chrome trace "ph" field
+enum tracePhase {
+    TRACE_PHASE_BEGIN = 'B',
+    TRACE_PHASE_END = 'E',
+    TRACE_PHASE_INSTANT = 'i',
+    TRACE_PHASE_COUNTER = 'C',
+};
+
+typedef struct {
+    // Monotonic clock
+    uint64_t timestampNs;
+    // From Trace_registerName(), starting at 1
+    uint16_t nameId;
+    uint8_t phase;
+    uint8_t reserved;
+    // Instant: any detail (note, slot...); counter: its value
+    uint32_t arg;
+} traceEvent_t;
+
+// Dump file, in the byte order of the machine that wrote it:
+//   "KGSTRACE", uint32 version TRACE_FILE_VERSION, uint32 numNames, uint32 numThreads
+//   numNames times: uint16 length, then the name (no terminator); ids count from 1
+//   numThreads times: int32 tid, char name[TRACE_THREAD_NAME_LEN], uint32 numEvents,
+//                     then numEvents traceEvent_t, oldest first
+#define TRACE_FILE_MAGIC "KGSTRACE"
+#define TRACE_FILE_VERSION 1
+
+#ifdef KGS_TRACE
+// Each trace point looks its name up once, then only records
+#define TRACE_EVENT(name, phase, arg) \
+    do { \
+        static _Atomic uint16_t traceNameId; \
+        uint16_t id = atomic_load_explicit(&traceNameId, memory_order_relaxed); \
+        if (id == 0) { \
+            id = Trace_registerName(name); \
+            atomic_store_explicit(&traceNameId, id, memory_order_relaxed); \
+        } \
+        Trace_record(id, (phase), (arg)); \
+    } while (0)
+// For names only known at run time: register once, keep the id
+#define TRACE_EVENT_ID(id, phase, arg) Trace_record((id), (phase), (arg))
+#else
+#define TRACE_EVENT(name, phase, arg) do { } while (0)
+#define TRACE_EVENT_ID(id, phase, arg) do { } while (0)
+#endif
+
+// Begin/end must pair up on the same thread
+#define TRACE_BEGIN(name) TRACE_EVENT(name, TRACE_PHASE_BEGIN, 0)
+#define TRACE_END(name) TRACE_EVENT(name, TRACE_PHASE_END, 0)
+#define TRACE_INSTANT(name, arg) TRACE_EVENT(name, TRACE_PHASE_INSTANT, arg)
+#define TRACE_COUNTER(name, value) TRACE_EVENT(name, TRACE_PHASE_COUNTER, value)
+
+// Blocks SIGUSR1 for the threads started after it, and dumps to
+// TRACE_DEFAULT_PATH whenever the reactor sees one. Call before starting
+// any thread, once the reactor is up.
+void Trace_init(void);
+void Trace_cleanup(void);
+
+// Returns the id for name, the same one each time. name must stay valid.
+uint16_t Trace_registerName(const char *name);
+void Trace_record(uint16_t nameId, uint8_t phase, uint32_t arg);
+
+// Write every thread's buffer to path (TRACE_DEFAULT_PATH if NULL).
+// Safe while tracing goes on. Returns the number of events, or -1.
+// Blocks on file I/O, so only the worker calls it (see worker.h).
+int Trace_dump(const char *path);
+
+#endif
@@ -1,11 +1,18 @@
 // Note: Generates low latency audio on BeagleBone Black; higher latency found on host.
 
+#define _GNU_SOURCE
 #include "shutdown.h"
+#include "timeDelay.h"
 #include "hal/audioGenerator.h"
+#include "audioGenerator_internal.h"
+#include "hal/trace.h"
+#include "hal/statsPage.h"
 #include <alsa/asoundlib.h>
 #include <stdbool.h>
 #include <pthread.h>
 #include <limits.h>
+#include <stdatomic.h>
+#include <errno.h>
 #include <alloca.h> // needed for mixer
 
 static snd_pcm_t *handle;
@@ -22,7 +29,7 @@ static unsigned long playbackBufferSize = 0;
 static short *playbackBuffer = NULL;
 
 // Currently active (waiting to be played) sound bites
-#define MAX_SOUND_BITES 100
+#define MAX_SOUND_BITES AUDIO_MAX_VOICES
 typedef struct {
 	// A pointer to a previously allocated sound bite (wavedata_t struct).
 	// Note that many different sound-bite slots could share the same pointer
@@ -42,9 +49,28 @@ void* playbackThread(void * arg);
 static bool stopping = false;
 static pthread_t playbackThreadId;
 static pthread_mutex_t audioMutex = PTHREAD_MUTEX_INITIALIZER;
+// Signalled when a sound is queued, for a playback thread waiting idle
+static pthread_cond_t soundQueued = PTHREAD_COND_INITIALIZER;
+
+// After this long with nothing to play the stream is stopped until the
+// next sound, so a quiet keyboard does not wake the playback thread every
+// period. Much longer than the ALSA buffer, so every sound has played out,
+// and than a pause between notes, which keeps the stream running.
+#define IDLE_AFTER_SILENT_MS 1000
 
 static int volume = 0;
 
+// Null sink: mix as usual but throw the audio away, paced by the clock
+// instead of the sound card. Same period ALSA picks for our 50 ms buffer.
+#define NULL_SINK_PERIOD_FRAMES 735
+#define NS_PER_SECOND 1000000000LL
+static bool isNullSink = false;
+
+// Playback health, read from other threads by audioGenerator_getStats()
+static _Atomic unsigned long periodsWritten;
+static _Atomic unsigned long xruns;
+static _Atomic unsigned long shortWrites;
+
 void audioGenerator_init(void)
 {
 	// audioGenerator_setVolume(DEFAULT_VOLUME);
@@ -55,6 +81,18 @@ void audioGenerator_init(void)
         soundBites[i].location = 0;
     }
 
+	// So the stats page shows them at 0 rather than not at all
+	STATS_ADD("audio.xruns", 0);
+	STATS_ADD("audio.shortWrites", 0);
+	STATS_ADD("audio.voicesDropped", 0);
+
+	if (isNullSink) {
+		playbackBufferSize = NULL_SINK_PERIOD_FRAMES;
+		playbackBuffer = malloc(playbackBufferSize * sizeof(*playbackBuffer));
+		pthread_create(&playbackThreadId, NULL, &playbackThread, NULL);
+		return;
+	}
+
 	// Open the PCM output
 	int err = snd_pcm_open(&handle, "default", SND_PCM_STREAM_PLAYBACK, 0);
 	if (err < 0) {
@@ -139,7 +177,10 @@ void audioGenerator_queueSound(wavedata_t *pSound)
 	assert(pSound->numSamples > 0);
 	assert(pSound->pData);
 
+	// Shows how long the mixer holds us up
+	TRACE_BEGIN("audio lock");
 	pthread_mutex_lock(&audioMutex);
+	TRACE_END("audio lock");
 
 	bool freeSlots = false;
 
@@ -149,6 +190,8 @@ void audioGenerator_queueSound(wavedata_t *pSound)
 		if (soundBites[i].pSound == NULL){
 			soundBites[i].pSound = pSound;
 			soundBites[i].location = 0;
+			TRACE_INSTANT("voice start", i);
+			pthread_cond_signal(&soundQueued);
 			// Indicate that we found a free spot
 			freeSlots = true;
 			break;
@@ -157,21 +200,27 @@ void audioGenerator_queueSound(wavedata_t *pSound)
 
 	pthread_mutex_unlock(&audioMutex);
 
+	// Counted rather than printed: it happens in bursts
 	if (freeSlots == false){
-		printf("No free slots in soundBites, could not queue sound. \n");
+		STATS_ADD("audio.voicesDropped", 1);
 		return;
 	}
 }
 
 void audioGenerator_cleanup(void)
 {
-	// Stop the PCM generation thread
+	// Stop the PCM generation thread, which may be waiting for a sound
+	pthread_mutex_lock(&audioMutex);
 	stopping = true;
+	pthread_cond_signal(&soundQueued);
+	pthread_mutex_unlock(&audioMutex);
 	pthread_join(playbackThreadId, NULL);
 
 	// Shutdown the PCM output, allowing any pending sound to play out (drain)
-	snd_pcm_drain(handle);
-	snd_pcm_close(handle);
+	if (!isNullSink) {
+		snd_pcm_drain(handle);
+		snd_pcm_close(handle);
+	}
 
 	// Free playback buffer
 	// (note that any wave files read into wavedata_t records must be freed
@@ -187,11 +236,20 @@ void audioGenerator_cleanup(void)
 	playbackBuffer = NULL;
 
 	fflush(stdout);
+	printf("Audio: %lu periods written, %lu underruns, %lu short writes\n",
+			(unsigned long) periodsWritten, (unsigned long) xruns, (unsigned long) shortWrites);
 	printf("Audio Mixer cleanup done!\n");
 	
 }
 
 
+void audioGenerator_getStats(audioGeneratorStats_t *pStats)
+{
+	pStats->periodsWritten = periodsWritten;
+	pStats->xruns = xruns;
+	pStats->shortWrites = shortWrites;
+}
+
 int audioGenerator_getVolume()
 {
 	// Return the cached volume; good enough unless someone is changing
@@ -230,6 +288,9 @@ void audioGenerator_setVolume(int newVolume)
 		return;
 	}
 	volume = newVolume;
+	if (isNullSink) {
+		return;
+	}
  
     long min, max;
     snd_mixer_t *volHandle;
@@ -257,8 +318,10 @@ void audioGenerator_setVolume(int newVolume)
 // Fill the `buff` array with new PCM values to output.
 //    `buff`: buffer to fill with new PCM data from sound bites.
 //    `size`: the number of values to store into playbackBuffer
-static void fillPlaybackBuffer(short *buff, int size)
+// Returns how many sounds were mixed in
+int audioGenerator_fillPlaybackBuffer(short *buff, int size)
 {
+	int numVoices = 0;
 	// wipe playback buffer
 	memset(buff, 0, size * sizeof((short)*buff));
 	// make sure soundBites array is threadsafe
@@ -274,25 +337,21 @@ static void fillPlaybackBuffer(short *buff, int size)
 		// otherwise add sound bite's data to buffer if there is a sound in the soundBites slot
 		// load current sound bite into local variable
 		wavedata_t *currSoundBite = soundBites[i].pSound;
+		numVoices++;
 		// get the current position of offset, where to start playing next
 		int offset = soundBites[i].location;
 
-		// loop thru the current sound bite
-		// size is the number of values to store in the current buffer
-		for(int j = 0; j < size; j++){
-			// make sure to not overflow playbackBuffer
-
-			// offset is supposed to be the current location of the sound on the soundBite
-			// goal is to use offset location to look at where to place the next 'bite'
-			// size is the size of the buffer to be filled in, always seems to be 735 bites
-			// so if we do comparison if (offset >= size), it will be true very early, since offset seems to be multiplse of 735
-			if (offset >= currSoundBite->numSamples){
-				break;
-			}
-
-			// get the current value of the soundBite at offset location and check to see if we can add it to buffer
-			// using pData[offset] since offset shows location of soundbite 
-			int tempValue = ((int)buff[j] + currSoundBite->pData[offset]);
+		// offset is the current location of the sound on the soundBite, so
+		// mix whichever is shorter: the rest of the buffer or of the sound.
+		// Working the count out first keeps the loop free of early exits,
+		// so the compiler can vectorise it (NEON on the board).
+		int count = currSoundBite->numSamples - offset;
+		if (count > size) {
+			count = size;
+		}
+		const short *pSource = &currSoundBite->pData[offset];
+		for(int j = 0; j < count; j++){
+			int tempValue = ((int)buff[j] + pSource[j]);
 
 			// check for overflow
 			if (tempValue > SHRT_MAX){
@@ -302,10 +361,10 @@ static void fillPlaybackBuffer(short *buff, int size)
 				tempValue = SHRT_MIN;
 			}
 
-			// add new soundbite to playbackBuffer and increment offset
+			// add new soundbite to playbackBuffer
 			buff[j] = tempValue;
-			offset++;
 		}
+		offset += count;
 		// update new location to show this portion of the sound bite has been played back 
 		soundBites[i].location = offset;
 
@@ -317,6 +376,16 @@ static void fillPlaybackBuffer(short *buff, int size)
 	}
 
 	pthread_mutex_unlock(&audioMutex);
+	return numVoices;
+}
+
+void audioGenerator_setVoice(int voice, wavedata_t *pSound, int location)
+{
+	assert(voice >= 0 && voice < MAX_SOUND_BITES);
+	pthread_mutex_lock(&audioMutex);
+	soundBites[voice].pSound = pSound;
+	soundBites[voice].location = location;
+	pthread_mutex_unlock(&audioMutex);
 }
 
 void audioGenerator_clearSound(void) {
@@ -332,18 +401,104 @@ void audioGenerator_clearSound(void) {
 }
 
 
+void audioGenerator_useNullSink(void)
+{
+	isNullSink = true;
+}
+
+// Stands in for snd_pcm_writei(): waits until the sink would have played
+// out the previous period, on absolute deadlines so the rate does not drift
+static void writeNullSink(long long *pNextPeriodNs)
+{
+	if (*pNextPeriodNs == 0) {
+		*pNextPeriodNs = getMonotonicTimeInNs();
+	}
+	*pNextPeriodNs += playbackBufferSize * NS_PER_SECOND / SAMPLE_RATE;
+	struct timespec deadline = {
+		.tv_sec = *pNextPeriodNs / NS_PER_SECOND,
+		.tv_nsec = *pNextPeriodNs % NS_PER_SECOND,
+	};
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {
+	}
+	periodsWritten++;
+	STATS_ADD("audio.periods", 1);
+}
+
+static bool hasSounds(void)
+{
+	for (int i = 0; i < MAX_SOUND_BITES; i++) {
+		if (soundBites[i].pSound != NULL) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Stop the stream and sleep until a sound is queued or we are stopping.
+// Only silence is in the ALSA buffer by now, so dropping it loses nothing.
+static void waitForSound(long long *pNextPeriodNs)
+{
+	TRACE_INSTANT("audio idle", periodsWritten);
+	STATS_ADD("audio.idles", 1);
+	if (!isNullSink) {
+		snd_pcm_drop(handle);
+	}
+
+	pthread_mutex_lock(&audioMutex);
+	while (!hasSounds() && !stopping && !Shutdown_isShutdown()) {
+		pthread_cond_wait(&soundQueued, &audioMutex);
+	}
+	pthread_mutex_unlock(&audioMutex);
+
+	// Starts again once the first periods fill the buffer
+	if (!isNullSink) {
+		snd_pcm_prepare(handle);
+	}
+	*pNextPeriodNs = 0;
+}
+
 void* playbackThread(void * arg)
 {
+	long long nextPeriodNs = 0;
+	pthread_setname_np(pthread_self(), "audio");
+	long long idlePeriods = (long long) IDLE_AFTER_SILENT_MS * SAMPLE_RATE / 1000 / playbackBufferSize;
+	long long silentPeriods = 0;
 
 	while(!Shutdown_isShutdown()) {
 		// Generate next block of audio
-		fillPlaybackBuffer(playbackBuffer, playbackBufferSize);
+		TRACE_BEGIN("mix");
+		long long mixStartNs = getMonotonicTimeInNs();
+		int numVoices = audioGenerator_fillPlaybackBuffer(playbackBuffer, playbackBufferSize);
+		long long mixNs = getMonotonicTimeInNs() - mixStartNs;
+		TRACE_END("mix");
+		STATS_SET("audio.voices", numVoices);
+		STATS_SET("audio.mixNs", mixNs);
+		STATS_MAX("audio.mixMaxNs", mixNs);
+
+		silentPeriods = numVoices > 0 ? 0 : silentPeriods + 1;
+		if (silentPeriods > idlePeriods) {
+			waitForSound(&nextPeriodNs);
+			silentPeriods = 0;
+			continue;
+		}
+
+		if (isNullSink) {
+			writeNullSink(&nextPeriodNs);
+			continue;
+		}
 
-		// Output the audio
+		// Output the audio; blocks while the ALSA buffer is full
+		TRACE_BEGIN("alsa write");
 		snd_pcm_sframes_t frames = snd_pcm_writei(handle,
 				playbackBuffer, playbackBufferSize);
+		TRACE_END("alsa write");
 
 		// Check for (and handle) possible error conditions on output
+		if (frames == -EPIPE) {
+			TRACE_INSTANT("xrun", periodsWritten);
+			xruns++;
+			STATS_ADD("audio.xruns", 1);
+		}
 		if (frames < 0) {
 			fprintf(stderr, "audioGenerator: writei() returned %li\n", frames);
 			frames = snd_pcm_recover(handle, frames, 1);
@@ -354,9 +509,11 @@ void* playbackThread(void * arg)
 			exit(EXIT_FAILURE);
 		}
 		if (frames > 0 && frames < (long int) playbackBufferSize) {
-			printf("Short write (expected %li, wrote %li)\n",
-					playbackBufferSize, frames);
+			shortWrites++;
+			STATS_ADD("audio.shortWrites", 1);
 		}
+		periodsWritten++;
+		STATS_ADD("audio.periods", 1);
 
 	}
 
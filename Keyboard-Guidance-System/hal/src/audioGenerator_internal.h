@@ -0,0 +1,21 @@
+// Internals of audioGenerator.c that the benchmarks drive directly.
+// Not part of the module's interface: only audioGenerator.c and
+// benchmarks/ include this.
+
+#ifndef _AUDIO_GENERATOR_INTERNAL_H_
+#define _AUDIO_GENERATOR_INTERNAL_H_
+
+#include "hal/audioGenerator.h"
+
+// Voice slots the mixer has
+#define AUDIO_MAX_VOICES 100
+
+// Mix size samples of every voice into buff, moving each voice on, as the
+// playback thread does for one period. Returns how many voices were mixed.
+int audioGenerator_fillPlaybackBuffer(short *buff, int size);
+
+// Play pSound in a voice slot from sample location, or free the slot if
+// pSound is NULL
+void audioGenerator_setVoice(int voice, wavedata_t *pSound, int location);
+
+#endif
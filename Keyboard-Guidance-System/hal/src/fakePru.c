@@ -0,0 +1,160 @@
+// Host-side stand-in for the PRU LED firmware
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "hal/fakePru.h"
+#include "hal/pruMem.h"
+#include "timeDelay.h"
+
+// How often to check for a new frame; the real PRU spins continuously
+#define POLL_INTERVAL_NS 100000
+// Frames held in memory; older ones are only in the capture file
+#define MAX_CAPTURED_FRAMES 1024
+
+static volatile void *pPruBase;
+static volatile sharedMemStruct_t *pShared;
+
+static pthread_t fakePruThread;
+static _Atomic bool stopping = false;
+static FILE *captureFile = NULL;
+
+static fakePruFrame_t capturedFrames[MAX_CAPTURED_FRAMES];
+static int frameCount;
+static pthread_mutex_t captureMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t latchedSeq;
+
+// Same latch as the firmware: copy the newest frame, and retry if ARM
+// committed again while we were copying.
+static bool latchFrame(fakePruFrame_t *pFrame)
+{
+    uint32_t seq = pShared->frameSeq;
+    if (seq == latchedSeq) {
+        return false;
+    }
+
+    while (true) {
+        atomic_thread_fence(memory_order_acquire);
+        volatile uint32_t *pSource = pShared->frame[FRAME_BUFFER_FOR_SEQ(seq)];
+        pFrame->numLeds = pShared->numLeds <= MAX_STR_LEN ? pShared->numLeds : MAX_STR_LEN;
+        for (uint32_t i = 0; i < pFrame->numLeds; i++) {
+            pFrame->colour[i] = pSource[i];
+        }
+        uint32_t newSeq = pShared->frameSeq;
+        if (newSeq == seq) {
+            break;
+        }
+        seq = newSeq;
+    }
+
+    pShared->framesDropped += seq - latchedSeq - 1;
+    latchedSeq = seq;
+    pFrame->seq = seq;
+    pFrame->timestampNs = getMonotonicTimeInNs();
+    return true;
+}
+
+static void captureFrame(const fakePruFrame_t *pFrame)
+{
+    pthread_mutex_lock(&captureMutex);
+    capturedFrames[frameCount % MAX_CAPTURED_FRAMES] = *pFrame;
+    frameCount++;
+    pthread_mutex_unlock(&captureMutex);
+
+    if (captureFile != NULL) {
+        fprintf(captureFile, "%lld %u", pFrame->timestampNs, pFrame->seq);
+        for (uint32_t i = 0; i < pFrame->numLeds; i++) {
+            fprintf(captureFile, " %06x", pFrame->colour[i]);
+        }
+        fprintf(captureFile, "\n");
+    }
+}
+
+static void* fakePruThreadFunction()
+{
+    fakePruFrame_t frame;
+    pthread_setname_np(pthread_self(), "fake pru");
+    while (!stopping) {
+        if (latchFrame(&frame)) {
+            captureFrame(&frame);
+            pShared->framesSent++;
+        }
+        customSleep(0, POLL_INTERVAL_NS);
+    }
+    return NULL;
+}
+
+// init and cleanup functions
+void FakePru_init(const char *capturePath)
+{
+    if (!PruMem_isSimulated()) {
+        fprintf(stderr, "ERROR: fake PRU needs simulated PRU memory\n");
+        exit(EXIT_FAILURE);
+    }
+    pPruBase = getPruMmapAddr();
+    pShared = PRUSHARED_MEM_FROM_BASE(pPruBase);
+
+    if (capturePath != NULL) {
+        captureFile = fopen(capturePath, "w");
+        if (captureFile == NULL) {
+            fprintf(stderr, "ERROR: Unable to open capture file %s.\n", capturePath);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Boot like the firmware, minus animation support: ARM then falls back
+    // to its own LED scheduler.
+    pShared->isLedOn = true;
+    pShared->framesSent = 0;
+    pShared->framesDropped = 0;
+    pShared->pruCaps = 0;
+    latchedSeq = pShared->frameSeq;
+    frameCount = 0;
+
+    stopping = false;
+    int retStatus = pthread_create(&fakePruThread, NULL, &fakePruThreadFunction, NULL);
+    if (retStatus != 0){
+        fprintf(stderr, "Error in fake PRU thread\n");
+    }
+}
+
+void FakePru_cleanup(void)
+{
+    stopping = true;
+    int retStatus = pthread_join(fakePruThread, NULL);
+    if (retStatus != 0){
+        fprintf(stderr, "Error in joining thread\n");
+    }
+    if (captureFile != NULL) {
+        fclose(captureFile);
+        captureFile = NULL;
+    }
+    freePruMmapAddr(pPruBase);
+    printf("Fake PRU latched %d frames\n", frameCount);
+}
+
+int FakePru_getFrameCount(void)
+{
+    pthread_mutex_lock(&captureMutex);
+    int count = frameCount;
+    pthread_mutex_unlock(&captureMutex);
+    return count;
+}
+
+bool FakePru_getFrame(int index, fakePruFrame_t *pFrame)
+{
+    pthread_mutex_lock(&captureMutex);
+    int oldest = frameCount > MAX_CAPTURED_FRAMES ? frameCount - MAX_CAPTURED_FRAMES : 0;
+    bool isHeld = index >= 0 && oldest + index < frameCount;
+    if (isHeld) {
+        *pFrame = capturedFrames[(oldest + index) % MAX_CAPTURED_FRAMES];
+    }
+    pthread_mutex_unlock(&captureMutex);
+    return isHeld;
+}
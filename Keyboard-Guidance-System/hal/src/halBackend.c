@@ -0,0 +1,70 @@
+// Module to pick what the HAL runs on
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hal/halBackend.h"
+#include "hal/pruMem.h"
+#include "hal/fakePru.h"
+#include "hal/joystick.h"
+#include "hal/segDisplay.h"
+#include "hal/midiReader.h"
+#include "hal/audioGenerator.h"
+
+// Set by the build (KGS_HAL_BACKEND in CMake)
+#ifndef KGS_DEFAULT_HAL_BACKEND
+#define KGS_DEFAULT_HAL_BACKEND "hw"
+#endif
+
+static const char *backendNames[] = {
+    [HAL_BACKEND_HW] = "hw",
+    [HAL_BACKEND_SIM] = "sim",
+};
+
+static enum halBackend backend = HAL_BACKEND_HW;
+
+static enum halBackend parseBackend(const char *name)
+{
+    for (int i = 0; i < (int) (sizeof(backendNames) / sizeof(backendNames[0])); i++) {
+        if (strcmp(name, backendNames[i]) == 0) {
+            return i;
+        }
+    }
+    printf("ERROR: Unknown HAL backend '%s' (expected hw or sim)\n", name);
+    exit(EXIT_FAILURE);
+}
+
+void HalBackend_init(void)
+{
+    const char *name = getenv("KGS_HAL_BACKEND");
+    backend = parseBackend(name != NULL ? name : KGS_DEFAULT_HAL_BACKEND);
+    printf("HAL backend: %s\n", backendNames[backend]);
+    if (backend != HAL_BACKEND_SIM) {
+        return;
+    }
+
+    PruMem_useFileBackend(getenv("KGS_SIM_PRU_MEM"));
+    FakePru_init(getenv("KGS_SIM_LED_CAPTURE"));
+    Joystick_useFakeGpio();
+    SegmentDisplay_useSimulated();
+    MidiReader_useRecording(getenv("KGS_SIM_MIDI"));
+    audioGenerator_useNullSink();
+}
+
+void HalBackend_cleanup(void)
+{
+    if (backend == HAL_BACKEND_SIM) {
+        FakePru_cleanup();
+    }
+}
+
+enum halBackend HalBackend_get(void)
+{
+    return backend;
+}
+
+const char *HalBackend_getName(void)
+{
+    return backendNames[backend];
+}
@@ -1,159 +1,365 @@
 // Joystick Functions
 
+#define _GNU_SOURCE
+
 #include "hal/joystick.h"
-#include "hal/runCommand.h"
+#include "hal/pinConfig.h"
+#include "hal/pruMem.h"
+#include "hal/sharedDataStruct.h"
+#include "hal/joystickGesture.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <assert.h>
 #include <string.h>
-#include <pthread.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
 
 #include "timeDelay.h"
 #include "midiController.h"
 #include "shutdown.h"
+#include "reactor.h"
+
+// Firmware without PRU_CAP_JOYSTICK_EVENT, or no way to receive the event:
+// PRU directions are re-read this often on top of waiting for sysfs edges
+#define PRU_POLL_MS 10
+#define NS_PER_MS 1000000LL
 
-static pthread_t joystickThread;
+static reactorTimer_t *pJoystickTimer;
 static int currentMode = 1;
 
 // Source: Dr Brian Fraser
 struct DirectionInfo {
     const char * name;
     const int pinNumber;
-    const char * pathToDirection;
-    const char * gpioCommand;
+    const char * headerPin;
     const char * pathToReadValue;
+    // Set for pins the PRU firmware can sample instead (0 if it cannot)
+    const uint32_t pruBit;
 };
 
 // paths for all GPIO pins
 #define BASEPATH "/sys/class/gpio/"
 const struct DirectionInfo directions[] = {
-    {"Up", 26, BASEPATH "gpio26/direction", "config-pin p8.14 gpio", BASEPATH "gpio26/value"},
-    {"Right", 47, BASEPATH "gpio47/direction", "config-pin p8.15 gpio", BASEPATH "gpio47/value"},
-    {"Down", 46, BASEPATH "gpio46/direction", "config-pin p8.16 gpio", BASEPATH "gpio46/value"},
-    {"Left", 65, BASEPATH "gpio65/direction", "config-pin p8.18 gpio", BASEPATH "gpio65/value"},
-    {"Center", 27, BASEPATH "gpio27/direction", "config-pin p8.17 gpio", BASEPATH "gpio27/value"}
+    {"Up", 26, "P8_14", BASEPATH "gpio26/value", 0},
+    {"Right", 47, "P8_15", BASEPATH "gpio47/value", PRU_JOYSTICK_RIGHT},
+    {"Down", 46, "P8_16", BASEPATH "gpio46/value", PRU_JOYSTICK_DOWN},
+    {"Left", 65, "P8_18", BASEPATH "gpio65/value", 0},
+    {"Center", 27, "P8_17", BASEPATH "gpio27/value", 0}
 };
 
-static enum joystickDirections Joystick_directionPressed();
+// When the PRU firmware samples joystick pins, those directions are read
+// from shared memory with one load instead of a sysfs read each.
+static volatile void *pPruBase;
+static volatile sharedMemStruct_t *pSharedPru;
+static bool hasPruJoystick;
+// Readable when the PRU has published an edge; -1 if they must be polled
+static int pruEventFd = -1;
+// Edge count at the last read, and presses that came and went between reads
+static uint32_t lastPruEdges;
+static _Atomic uint32_t pruTapped;
 
-static void debounceSleepTime(int prevCommand, int currCommand);
+// Open value file of each sysfs direction (-1 for PRU directions), and the
+// level last read from it. The reactor watches these for edges, so nothing
+// is read while the joystick is idle.
+static int valueFds[JOYSTICK_MAX_NUMBER_DIRECTIONS];
+static _Atomic bool isPressed[JOYSTICK_MAX_NUMBER_DIRECTIONS];
 
-static void * joystickThreadFunction()
-{   
-    int currentJoystickPress;
-
-    while(!Shutdown_isShutdown()) {
-        // Functions called in this loop should only be low level functions, this is mostly for testing purposes
-        // There is Joystick_isDirectionPressed() and Joystick_isAnyPressed() for higher level module function calls to the joystick
-        currentJoystickPress = Joystick_directionPressed();
-        switch (currentJoystickPress) {
-            case JOYSTICK_CENTER:
+// Fake GPIO: each direction is a pipe instead of a sysfs file, and a level
+// is one '0' (pressed) or '1' byte written to it
+static bool isFakeGpio = false;
+static int fakeWriteFds[JOYSTICK_MAX_NUMBER_DIRECTIONS] = {-1, -1, -1, -1, -1};
+
+static bool isOnPru(enum joystickDirections direction)
+{
+    return hasPruJoystick && directions[direction].pruBit != 0;
+}
+
+static void readValue(enum joystickDirections direction);
+
+// Act on a gesture. Song changes happen on press and auto-repeat while held;
+// exiting needs a long press so a glitch on down cannot shut us off.
+static void dispatchGesture(const joystickGesture_t *pGesture)
+{
+    enum joystickGestureType type = pGesture->type;
+    switch (pGesture->direction) {
+        case JOYSTICK_CENTER:
+            if (type == GESTURE_PRESS) {
                 printf("Center Pressed\n");
-                break;
-            case JOYSTICK_UP:
+            }
+            break;
+        case JOYSTICK_UP:
+            if (type == GESTURE_PRESS) {
                 printf("Restarting Song\n");
                 // restart song
                 MidiController_setSong(MidiController_getCurrentSong());
-                sleepForMs(300);
-                break;
-            case JOYSTICK_DOWN:
+            }
+            break;
+        case JOYSTICK_DOWN:
+            if (type == GESTURE_PRESS) {
+                printf("Hold down to exit\n");
+            } else if (type == GESTURE_LONG_PRESS) {
                 printf("Exiting Program\n");
                 Shutdown_triggerShutdown();
-                break;
-            case JOYSTICK_LEFT:
+            }
+            break;
+        case JOYSTICK_LEFT:
+            if (type == GESTURE_PRESS || type == GESTURE_REPEAT) {
                 // cycle the songs left
                 printf("Switching song to...\n");
                 MidiController_cycleSongLeft();
-                sleepForMs(300);
-                break;
-            case JOYSTICK_RIGHT:
+            }
+            break;
+        case JOYSTICK_RIGHT:
+            if (type == GESTURE_PRESS || type == GESTURE_REPEAT) {
                 // cycle the songs right
                 printf("Switching song to...\n");
                 MidiController_cycleSongRight();
-                sleepForMs(300);
-                break;
-            default:
-                break;
-        }
+            }
+            break;
+        default:
+            break;
     }
-    return NULL;
 }
 
-// sets the GPIO pins for joystick controls
-static void writePinFile(const char * GPIOFILE, char * mode)
+// When to look at the joystick again without an edge: the next gesture
+// deadline, and no later than PRU_POLL_MS if PRU edges cannot wake us
+static long long getNextWakeNs(long long nowNs)
 {
-    // Makes sure that the argument mode is only called with in or out
-
-    assert(strcmp(mode, "in") == 0 || strcmp(mode, "out") == 0);
-    FILE * writePinFile = fopen(GPIOFILE, "w");
+    bool isPruPolled = hasPruJoystick && pruEventFd < 0;
+    long long wakeNs = isPruPolled ? nowNs + PRU_POLL_MS * NS_PER_MS : -1;
+    long long deadlineNs = JoystickGesture_getNextDeadlineNs();
+    if (deadlineNs >= 0 && (wakeNs < 0 || deadlineNs < wakeNs)) {
+        wakeNs = deadlineNs;
+    }
+    return wakeNs;
+}
 
-    if (writePinFile == NULL) {
+// Feed every direction to the gesture tracker, so timed gestures fire on
+// schedule, and act on what it reports
+static void serviceJoystick(void *pContext)
+{
+    (void) pContext;
+    joystickGesture_t gesture;
 
-        printf("ERROR OPENING %s.\n", GPIOFILE);
-        exit(1);
+    long long nowNs = getMonotonicTimeInNs();
+    for (int x = 0; x < JOYSTICK_MAX_NUMBER_DIRECTIONS; x++) {
+        JoystickGesture_update(x, Joystick_isDirectionPressed(x), nowNs);
+    }
+    while (JoystickGesture_nextEvent(&gesture)) {
+        dispatchGesture(&gesture);
     }
 
-    int charWritten = fprintf(writePinFile, mode);
-    if (charWritten <= 0) {
-        printf("ERROR WRITING DATA\n");
-        exit(1);
+    long long wakeNs = getNextWakeNs(getMonotonicTimeInNs());
+    if (wakeNs >= 0) {
+        Reactor_armTimer(pJoystickTimer, wakeNs, 0);
+    } else {
+        Reactor_disarmTimer(pJoystickTimer);
     }
+}
 
-    fclose(writePinFile);
+// A sysfs direction changed (or a fake one was written)
+static void onValueChanged(int fd, uint32_t events, void *pContext)
+{
+    (void) fd;
+    (void) events;
+    readValue((enum joystickDirections) (intptr_t) pContext);
+    serviceJoystick(NULL);
+}
+
+// The PRU published a joystick edge. Clear the event before reading the
+// state, so an edge published after the read wakes us again.
+static void onPruEvent(int fd, uint32_t events, void *pContext)
+{
+    (void) events;
+    (void) pContext;
+    PruMem_ackEvent(fd, pPruBase);
+    serviceJoystick(NULL);
 }
 
 // init and cleanup
+// Set up a direction as a pipe that Joystick_setFakePressed() writes into
+static void openFakeGpio(enum joystickDirections direction)
+{
+    int pipeFds[2];
+    if (pipe2(pipeFds, O_NONBLOCK | O_CLOEXEC) == -1) {
+        perror("ERROR: Unable to create fake GPIO");
+        exit(EXIT_FAILURE);
+    }
+    valueFds[direction] = pipeFds[0];
+    fakeWriteFds[direction] = pipeFds[1];
+    isPressed[direction] = false;
+}
+
+// Configure a sysfs GPIO as an input that reports both edges, and keep its
+// value file open for the reactor to watch
+static void openSysfsGpio(enum joystickDirections direction)
+{
+    PinConfig_setGpioDirection(directions[direction].pinNumber, "in");
+    PinConfig_setGpioEdge(directions[direction].pinNumber, "both");
+
+    valueFds[direction] = open(directions[direction].pathToReadValue, O_RDONLY | O_CLOEXEC);
+    if (valueFds[direction] == -1) {
+        printf("ERROR: Unable to open file (%s) for read\n", directions[direction].pathToReadValue);
+        exit(EXIT_FAILURE);
+    }
+    // Reading once also clears the edge sysfs reports on open
+    readValue(direction);
+}
+
 void Joystick_init(void)
 {
+    // Fake GPIO leaves the real PRU alone, but takes PRU directions from
+    // simulated PRU memory if there is one
+    hasPruJoystick = false;
+    pPruBase = NULL;
+    if (!isFakeGpio || PruMem_isSimulated()) {
+        pPruBase = getPruMmapAddr();
+        pSharedPru = PRUSHARED_MEM_FROM_BASE(pPruBase);
+        hasPruJoystick = (pSharedPru->pruCaps & PRU_CAP_JOYSTICK) != 0;
+        lastPruEdges = PRU_JOYSTICK_EDGES(pSharedPru->joystickState);
+    }
+    pruTapped = 0;
+
+    pruEventFd = -1;
+    if (hasPruJoystick) {
+        if (pSharedPru->pruCaps & PRU_CAP_JOYSTICK_EVENT) {
+            pruEventFd = PruMem_openEvent(pPruBase);
+        }
+        if (pruEventFd < 0) {
+            printf("Joystick: polling PRU directions every %d ms\n", PRU_POLL_MS);
+        }
+    }
+
+    if (!isFakeGpio) {
+        // PRU-sampled pins go to the PRU, the rest are GPIO
+        pinConfig_t pins[JOYSTICK_MAX_NUMBER_DIRECTIONS];
+        for (int x = 0; x < JOYSTICK_MAX_NUMBER_DIRECTIONS; x++) {
+            pins[x].pin = directions[x].headerPin;
+            pins[x].mode = isOnPru(x) ? "pruin" : "gpio";
+        }
+        PinConfig_apply(pins, JOYSTICK_MAX_NUMBER_DIRECTIONS);
+    }
+
+    for (int x = 0; x < JOYSTICK_MAX_NUMBER_DIRECTIONS; x++) {
+        valueFds[x] = -1;
+        if (isOnPru(x)) {
+            continue;
+        }
+        if (isFakeGpio) {
+            openFakeGpio(x);
+        } else {
+            openSysfsGpio(x);
+        }
+    }
+
+    JoystickGesture_init(getMonotonicTimeInNs());
     for (int x = 0; x < JOYSTICK_MAX_NUMBER_DIRECTIONS; x++) {
-        // Sets pins to GPIO mode
-        runCommand(directions[x].gpioCommand);
-        // Writes pins to input mode
-        writePinFile(directions[x].pathToDirection, "in");
+        // The PRU has already debounced its directions
+        if (isOnPru(x)) {
+            JoystickGesture_setDebounceMs(x, 0);
+        }
     }
 
-    int retStatus = pthread_create(&joystickThread, NULL, &joystickThreadFunction, NULL);
-    if (retStatus != 0){
-        fprintf(stderr, "Error in joystick thread\n");
+    // Take in the starting state before any callback can run, as the
+    // reactor may already be running
+    pJoystickTimer = Reactor_addTimer("joystick", serviceJoystick, NULL);
+    serviceJoystick(NULL);
+    for (int x = 0; x < JOYSTICK_MAX_NUMBER_DIRECTIONS; x++) {
+        if (valueFds[x] >= 0) {
+            // sysfs signals an edge with EPOLLPRI; a pipe just becomes readable
+            uint32_t events = isFakeGpio ? EPOLLIN : EPOLLPRI | EPOLLERR;
+            Reactor_addFd(directions[x].name, valueFds[x], events, onValueChanged, (void *) (intptr_t) x);
+        }
+    }
+    if (pruEventFd >= 0) {
+        Reactor_addFd("joystick pru", pruEventFd, EPOLLIN, onPruEvent, NULL);
     }
 }
 
 void Joystick_cleanup(void) {
-    int retStatus = pthread_join(joystickThread, NULL);
-    printf("Shutting down joystick thread.\n");
-    if (retStatus != 0){
-        fprintf(stderr, "Error in joining thread\n");
+    printf("Shutting down joystick.\n");
+    Reactor_removeTimer(pJoystickTimer);
+    for (int x = 0; x < JOYSTICK_MAX_NUMBER_DIRECTIONS; x++) {
+        if (valueFds[x] >= 0) {
+            Reactor_removeFd(valueFds[x]);
+            close(valueFds[x]);
+            valueFds[x] = -1;
+        }
+        if (fakeWriteFds[x] >= 0) {
+            close(fakeWriteFds[x]);
+            fakeWriteFds[x] = -1;
+        }
+    }
+    if (pruEventFd >= 0) {
+        Reactor_removeFd(pruEventFd);
+        PruMem_closeEvent(pruEventFd);
+        pruEventFd = -1;
+    }
+    if (pPruBase != NULL) {
+        freePruMmapAddr(pPruBase);
+        pPruBase = NULL;
     }
 }
 
-// function to check if something has been pressed in a given path
-static bool isButtonPressed(const char *fileName)
-{   
-    FILE *pFile = fopen(fileName, "r");
-    if (pFile == NULL) {
-        printf("ERROR: Unable to open file (%s) for read\n", fileName);
-        exit(-1);
-    }
-    // Read string (line)
-    const int MAX_LENGTH = 1024;
-    char buff[MAX_LENGTH];
-    fgets(buff, MAX_LENGTH, pFile);
-    // Close
-    fclose(pFile);
-    // printf("Read: '%s'\n", buff);
-    // Return true if button is pressed, else false
-    if (buff[0] == '0') {
-        return true;
+// Update the cached level of a sysfs or fake GPIO direction
+static void readValue(enum joystickDirections direction)
+{
+    char buff[16];
+    ssize_t length;
+    if (isFakeGpio) {
+        // Pipe holds every level written since the last read; keep the newest
+        char newest = 0;
+        while ((length = read(valueFds[direction], buff, sizeof(buff))) > 0) {
+            newest = buff[length - 1];
+        }
+        if (newest == 0) {
+            return;
+        }
+        buff[0] = newest;
+    } else {
+        // sysfs value files must be re-read from the start after each edge
+        length = pread(valueFds[direction], buff, sizeof(buff), 0);
+        if (length <= 0) {
+            perror("ERROR: Unable to read joystick value");
+            exit(EXIT_FAILURE);
+        }
     }
-    return false;
+    // Return true if button is pressed, else false
+    isPressed[direction] = buff[0] == '0';
 }
 
+// Read the PRU's debounced joystick bitmap. If two or more edges went by
+// since the last read and the latest was a release, that button was tapped
+// between reads; remember it so the tap is not lost.
+static uint32_t readPruPressed(void)
+{
+    uint32_t state = pSharedPru->joystickState;
+    uint32_t pressed = PRU_JOYSTICK_PRESSED(state);
+    uint32_t edges = PRU_JOYSTICK_EDGES(state);
+    uint32_t released = PRU_JOYSTICK_LAST_CHANGE(state) & ~pressed;
+    // Counter is 16 bits wide
+    if (((edges - lastPruEdges) & 0xFFFF) >= 2 && released != 0) {
+        atomic_fetch_or(&pruTapped, released);
+    }
+    lastPruEdges = edges;
+    return pressed;
+}
 
 bool Joystick_isDirectionPressed(enum joystickDirections direction)
 {   
-    return isButtonPressed(directions[direction].pathToReadValue);
+    if (isOnPru(direction)) {
+        uint32_t bit = directions[direction].pruBit;
+        bool isDown = (readPruPressed() & bit) != 0;
+        // A missed tap counts as one press
+        bool wasTapped = (atomic_fetch_and(&pruTapped, ~bit) & bit) != 0;
+        return isDown || wasTapped;
+    }
+    return isPressed[direction];
 }
 
 // check if any joystick is pressed
@@ -169,13 +375,16 @@ bool Joystick_isAnyPressed(void)
     return anyButtonPressed;
 }
 
-// get the direction the joystick is pressed in
-static enum joystickDirections Joystick_directionPressed() {
-    for (int joystickDirection = 0; joystickDirection < JOYSTICK_MAX_NUMBER_DIRECTIONS; joystickDirection++) {
-        if(Joystick_isDirectionPressed(joystickDirection)) {
-            return joystickDirection;
-        }
+void Joystick_useFakeGpio(void)
+{
+    isFakeGpio = true;
+}
+
+void Joystick_setFakePressed(enum joystickDirections direction, bool isDown)
+{
+    assert(isFakeGpio && direction < JOYSTICK_MAX_NUMBER_DIRECTIONS && !isOnPru(direction));
+    char level = isDown ? '0' : '1';
+    if (write(fakeWriteFds[direction], &level, 1) != 1) {
+        perror("ERROR: Unable to write fake GPIO");
     }
-    // Else return none if no direction is pressed
-    return JOYSTICK_NONE;
 }
\ No newline at end of file
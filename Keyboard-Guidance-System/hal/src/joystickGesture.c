@@ -0,0 +1,143 @@
+// Module to turn raw joystick levels into gestures
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <assert.h>
+
+#include "hal/joystickGesture.h"
+
+#define NS_PER_MS 1000000LL
+#define NO_DEADLINE -1
+
+// Gestures waiting to be taken; a burst bigger than this drops the oldest
+#define MAX_PENDING 16
+
+typedef struct {
+    long long debounceNs;
+    // Last level fed in, and when it last changed
+    bool rawLevel;
+    long long rawSinceNs;
+    // Debounced level, and when the current press started
+    bool isPressed;
+    long long pressStartNs;
+    bool isLongPressSent;
+    long long nextRepeatNs;
+} directionState_t;
+
+static directionState_t states[JOYSTICK_MAX_NUMBER_DIRECTIONS];
+
+static joystickGesture_t pending[MAX_PENDING];
+static int pendingHead;
+static int pendingCount;
+
+static void pushGesture(enum joystickDirections direction, enum joystickGestureType type, long long timestampNs)
+{
+    if (pendingCount == MAX_PENDING) {
+        printf("Joystick gesture queue full, dropping oldest\n");
+        pendingHead = (pendingHead + 1) % MAX_PENDING;
+        pendingCount--;
+    }
+    joystickGesture_t *pGesture = &pending[(pendingHead + pendingCount) % MAX_PENDING];
+    pGesture->direction = direction;
+    pGesture->type = type;
+    pGesture->timestampNs = timestampNs;
+    pendingCount++;
+}
+
+void JoystickGesture_init(long long nowNs)
+{
+    for (int i = 0; i < JOYSTICK_MAX_NUMBER_DIRECTIONS; i++) {
+        states[i] = (directionState_t) {
+            .debounceNs = GESTURE_DEBOUNCE_MS * NS_PER_MS,
+            .rawSinceNs = nowNs,
+        };
+    }
+    pendingHead = 0;
+    pendingCount = 0;
+}
+
+void JoystickGesture_setDebounceMs(enum joystickDirections direction, int debounceMs)
+{
+    assert(direction < JOYSTICK_MAX_NUMBER_DIRECTIONS && debounceMs >= 0);
+    states[direction].debounceNs = debounceMs * NS_PER_MS;
+}
+
+void JoystickGesture_update(enum joystickDirections direction, bool isPressed, long long nowNs)
+{
+    assert(direction < JOYSTICK_MAX_NUMBER_DIRECTIONS);
+    directionState_t *pState = &states[direction];
+
+    if (isPressed != pState->rawLevel) {
+        pState->rawLevel = isPressed;
+        pState->rawSinceNs = nowNs;
+    }
+
+    // Level has settled: it is a real press or release. Events are stamped
+    // with when the level changed, not when we noticed.
+    if (pState->rawLevel != pState->isPressed
+            && nowNs - pState->rawSinceNs >= pState->debounceNs) {
+        pState->isPressed = pState->rawLevel;
+        if (pState->isPressed) {
+            pState->pressStartNs = pState->rawSinceNs;
+            pState->isLongPressSent = false;
+            pState->nextRepeatNs = pState->pressStartNs + GESTURE_REPEAT_DELAY_MS * NS_PER_MS;
+            pushGesture(direction, GESTURE_PRESS, pState->rawSinceNs);
+        } else {
+            pushGesture(direction, GESTURE_RELEASE, pState->rawSinceNs);
+        }
+    }
+
+    if (!pState->isPressed) {
+        return;
+    }
+    if (!pState->isLongPressSent
+            && nowNs - pState->pressStartNs >= GESTURE_LONG_PRESS_MS * NS_PER_MS) {
+        pState->isLongPressSent = true;
+        pushGesture(direction, GESTURE_LONG_PRESS, nowNs);
+    }
+    // One repeat per call even if we were late, so a stall does not
+    // come out as a burst
+    if (nowNs >= pState->nextRepeatNs) {
+        pushGesture(direction, GESTURE_REPEAT, nowNs);
+        pState->nextRepeatNs += GESTURE_REPEAT_INTERVAL_MS * NS_PER_MS;
+        if (pState->nextRepeatNs <= nowNs) {
+            pState->nextRepeatNs = nowNs + GESTURE_REPEAT_INTERVAL_MS * NS_PER_MS;
+        }
+    }
+}
+
+bool JoystickGesture_nextEvent(joystickGesture_t *pGesture)
+{
+    if (pendingCount == 0) {
+        return false;
+    }
+    *pGesture = pending[pendingHead];
+    pendingHead = (pendingHead + 1) % MAX_PENDING;
+    pendingCount--;
+    return true;
+}
+
+static void keepEarliest(long long *pEarliest, long long deadlineNs)
+{
+    if (*pEarliest == NO_DEADLINE || deadlineNs < *pEarliest) {
+        *pEarliest = deadlineNs;
+    }
+}
+
+long long JoystickGesture_getNextDeadlineNs(void)
+{
+    long long earliest = NO_DEADLINE;
+    for (int i = 0; i < JOYSTICK_MAX_NUMBER_DIRECTIONS; i++) {
+        directionState_t *pState = &states[i];
+        if (pState->rawLevel != pState->isPressed) {
+            keepEarliest(&earliest, pState->rawSinceNs + pState->debounceNs);
+        }
+        if (pState->isPressed) {
+            if (!pState->isLongPressSent) {
+                keepEarliest(&earliest, pState->pressStartNs + GESTURE_LONG_PRESS_MS * NS_PER_MS);
+            }
+            keepEarliest(&earliest, pState->nextRepeatNs);
+        }
+    }
+    return earliest;
+}
@@ -7,6 +7,9 @@
 #include <stdlib.h>
 #include <sys/mman.h>
 #include <assert.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <math.h>
 #include <hal/colours.h>
 #include "timeDelay.h"
 #include <pthread.h>
@@ -15,111 +18,314 @@
 #include "hal/sharedDataStruct.h"
 #include "hal/pruMem.h"
 #include "hal/ledDriver.h"
+#include "hal/ledScheduler.h"
+#include "hal/trace.h"
+#include "hal/statsPage.h"
 
-#define NUM_LEDS 14
-
-#define PRU0_DRAM     0x00000      // Offset to DRAM
-#define PRU_MEM_RESERVED 0x200     // Amount used by stack and heap
-#define PRU0_MEM_FROM_BASE(base) ( (base) + PRU0_DRAM + PRU_MEM_RESERVED)
+#define DEFAULT_GAMMA 1.0
+#define DEFAULT_BRIGHTNESS 100
+#define PRU_CYCLES_PER_US 200
 
 volatile void *pPruBase;
 volatile sharedMemStruct_t *pSharedPru0;
 
-static pthread_t ledThread;
+// True if the PRU firmware renders animations itself; otherwise they are
+// played from ARM by the LED scheduler.
+static bool hasPruAnimations;
+static pthread_mutex_t animationMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// ARM-side copy of the frame being built. Changes are staged here and only
+// pushed to the PRU as a whole frame, so the PRU never sees a partial update.
+static uint32_t stagedFrame[MAX_STR_LEN];
+static int numLeds;
+static uint32_t committedSeq;
+static uint32_t framesCommitted;
+static pthread_mutex_t frameMutex = PTHREAD_MUTEX_INITIALIZER;
 
-// Flags to set for blinking
-bool blink = false;
-int colour;
-int LEDNum;
+// Effects drawn by the LED scheduler on top of the staged frame
+static uint32_t overlayColour[MAX_STR_LEN];
+static bool hasOverlay[MAX_STR_LEN];
+static bool isOverlayDirty;
 
-// blinks red LED if user plays wrong noet
-static void LED_blink(unsigned int colour, int LEDNum)
+// Gamma curve, and the table actually used at commit: gamma followed by
+// global brightness, so each channel costs a single lookup.
+static uint8_t gammaTable[256];
+static uint8_t outputTable[256];
+static double gammaExponent = DEFAULT_GAMMA;
+static int brightness = DEFAULT_BRIGHTNESS;
+
+// Rebuild both tables. A non-zero input never maps to zero unless the
+// brightness is zero, so dim colours stay visible.
+static void buildOutputTable(void)
 {
-    for (int x = 0; x < 3; x++) {
-        changeColourLED(colour, LEDNum);
-        sleepForMs(500);
-        changeColourLED(CLEAR, LEDNum);
-        sleepForMs(200);
+    for (int i = 0; i < 256; i++) {
+        int corrected = (int) lround(255.0 * pow(i / 255.0, gammaExponent));
+        if (i > 0 && corrected == 0) {
+            corrected = 1;
+        }
+        gammaTable[i] = corrected;
+    }
+    for (int i = 0; i < 256; i++) {
+        int scaled = (gammaTable[i] * brightness + 50) / 100;
+        if (gammaTable[i] > 0 && scaled == 0 && brightness > 0) {
+            scaled = 1;
+        }
+        outputTable[i] = scaled;
     }
 }
+
+// Map each GRB channel through the output table
+static uint32_t correctColour(uint32_t colour)
+{
+    return ((uint32_t) outputTable[(colour >> 16) & 0xFF] << 16)
+        | ((uint32_t) outputTable[(colour >> 8) & 0xFF] << 8)
+        | outputTable[colour & 0xFF];
+}
+
+// Copy the staged frame into the buffer the PRU is not latching from,
+// then publish it with a single store to frameSeq.
+// Caller must hold frameMutex.
+static void commitFrame(void)
+{
+    uint32_t nextSeq = committedSeq + 1;
+    volatile uint32_t *pFrame = pSharedPru0->frame[FRAME_BUFFER_FOR_SEQ(nextSeq)];
+    for (int i = 0; i < numLeds; i++) {
+        pFrame[i] = correctColour(hasOverlay[i] ? overlayColour[i] : stagedFrame[i]);
+    }
+    // Frame contents must land before the sequence number does
+    atomic_thread_fence(memory_order_release);
+    pSharedPru0->frameSeq = nextSeq;
+    committedSeq = nextSeq;
+    framesCommitted++;
+    STATS_ADD("led.framesCommitted", 1);
+    isOverlayDirty = false;
+    TRACE_INSTANT("led commit", nextSeq);
+}
+
 // change the led colors according to PRU shared struct
 void changeColourLED(unsigned int colour, int LEDNum)
 {
-    assert(LEDNum >= 0 || LEDNum <= 13);
-    // Get access to shared memory for my uses
-    pSharedPru0->colour[LEDNum] = colour;
+    assert(LEDNum >= 0 && LEDNum < numLeds);
+    pthread_mutex_lock(&frameMutex);
+    // Only send a new frame if something actually changed
+    if (stagedFrame[LEDNum] != colour) {
+        stagedFrame[LEDNum] = colour;
+        commitFrame();
+    }
+    pthread_mutex_unlock(&frameMutex);
+}
+
+// Set every LED to the same colour and commit it as one frame
+static void fillAllLEDs(unsigned int colour)
+{
+    pthread_mutex_lock(&frameMutex);
+    bool isDirty = false;
+    for (int i = 0; i < numLeds; i++) {
+        if (stagedFrame[i] != colour) {
+            stagedFrame[i] = colour;
+            isDirty = true;
+        }
+    }
+    if (isDirty) {
+        commitFrame();
+    }
+    pthread_mutex_unlock(&frameMutex);
 }
 
 void turnOnAllLEDs(unsigned int colour)
 {
-    for (int i = 0; i < NUM_LEDS; i++) {
-        pSharedPru0->colour[i] = colour;
-    }
+    fillAllLEDs(colour);
 }
 
 void turnOffAllLEDs(void)
 {
-    for (int i = 0; i < NUM_LEDS; i++) {
-        pSharedPru0->colour[i] = CLEAR;
+    fillAllLEDs(CLEAR);
+}
+
+void LED_setOverlay(int LEDNum, unsigned int colour)
+{
+    assert(LEDNum >= 0 && LEDNum < numLeds);
+    pthread_mutex_lock(&frameMutex);
+    if (!hasOverlay[LEDNum] || overlayColour[LEDNum] != colour) {
+        hasOverlay[LEDNum] = true;
+        overlayColour[LEDNum] = colour;
+        isOverlayDirty = true;
     }
+    pthread_mutex_unlock(&frameMutex);
 }
 
-static void * ledThreadFunction()
+void LED_clearOverlay(int LEDNum)
 {
-    while(!Shutdown_isShutdown()) {
-        if (blink) {
-            // printf("Will trigger note now hex: %x at %d pos \n", colour, LEDNum);
-            LED_blink(colour, LEDNum);
-            blink = false;
-        }
+    assert(LEDNum >= 0 && LEDNum < numLeds);
+    pthread_mutex_lock(&frameMutex);
+    if (hasOverlay[LEDNum]) {
+        hasOverlay[LEDNum] = false;
+        isOverlayDirty = true;
+    }
+    pthread_mutex_unlock(&frameMutex);
+}
+
+void LED_applyOverlay(void)
+{
+    pthread_mutex_lock(&frameMutex);
+    if (isOverlayDirty) {
+        commitFrame();
     }
+    pthread_mutex_unlock(&frameMutex);
+}
+
+int LED_getStripLength(void)
+{
+    return numLeds;
+}
 
+void LED_setBrightness(int percent)
+{
+    assert(percent >= 0 && percent <= 100);
+    pthread_mutex_lock(&frameMutex);
+    brightness = percent;
+    buildOutputTable();
+    commitFrame();
+    pthread_mutex_unlock(&frameMutex);
+}
+
+void LED_setGamma(double newGamma)
+{
+    assert(newGamma > 0);
+    pthread_mutex_lock(&frameMutex);
+    gammaExponent = newGamma;
+    buildOutputTable();
+    commitFrame();
+    pthread_mutex_unlock(&frameMutex);
+}
+
+int LED_getFrameTransmitUs(void)
+{
+    return pSharedPru0->frameTxCycles / PRU_CYCLES_PER_US;
 }
 
 // init and cleanup functions
-void LED_init()
+void LED_init(int stripLength)
 {
+    assert(stripLength > 0 && stripLength <= MAX_STR_LEN);
+    numLeds = stripLength;
+    buildOutputTable();
+
     pPruBase = getPruMmapAddr();
-    pSharedPru0 = PRU0_MEM_FROM_BASE(pPruBase);
+    pSharedPru0 = PRUSHARED_MEM_FROM_BASE(pPruBase);
+    pSharedPru0->numLeds = numLeds;
 
-    int retStatus = pthread_create(&ledThread, NULL, &ledThreadFunction, NULL);
-    if (retStatus != 0){
-        fprintf(stderr, "Error in ledDriver thread\n");
+    // Carry on from whatever frame the PRU last saw, and start from a blank strip
+    committedSeq = pSharedPru0->frameSeq;
+    memset(stagedFrame, 0, sizeof(stagedFrame));
+    memset(hasOverlay, 0, sizeof(hasOverlay));
+    pthread_mutex_lock(&frameMutex);
+    commitFrame();
+    pthread_mutex_unlock(&frameMutex);
+
+    hasPruAnimations = (pSharedPru0->pruCaps & PRU_CAP_ANIMATION) != 0;
+    if (!hasPruAnimations) {
+        printf("PRU firmware has no animation support, animating from ARM\n");
+        LedScheduler_init();
     }
 }
 
 void LED_cleanup()
 {
     // Cleanup
+    if (!hasPruAnimations) {
+        LedScheduler_cleanup();
+    }
+    memset(hasOverlay, 0, sizeof(hasOverlay));
     turnOffAllLEDs();
-    int retStatus = pthread_join(ledThread, NULL);
-    if (retStatus != 0){
-        fprintf(stderr, "Error in joining thread\n");
+    int transmitUs = LED_getFrameTransmitUs();
+    if (transmitUs > 0) {
+        printf("LED strip of %d: %d us per frame, max refresh %d Hz\n",
+            numLeds, transmitUs, 1000000 / transmitUs);
     }
+    printf("LED frames committed: %u, sent: %u, dropped: %u\n",
+        framesCommitted, pSharedPru0->framesSent, pSharedPru0->framesDropped);
     freePruMmapAddr(pPruBase);
     printf("LED cleanup done!\n");
 }
 
 void LED_finishAnimation(void)
 {
-    // Turn off all LEDs
-    turnOffAllLEDs();
-    for (int z = 0; z < 3; z++) {
-        int y = 13;
-        for (int x = 0; x < 14; x++) {
-            changeColourLED(WHITE, x);
-            changeColourLED(WHITE, y);
-            sleepForMs(50);
-            turnOffAllLEDs();
-            y--;
+    // Two white dots cross the strip three times
+    ledAnimation_t sweep = {
+        .type = LED_ANIM_SWEEP,
+        .repeat = 3,
+        .firstLed = 0,
+        .lastLed = numLeds - 1,
+        .onMs = 50,
+        .colour = WHITE,
+    };
+    LED_playAnimation(&sweep);
+}
+
+// blinks LED if user plays wrong note
+void LED_triggerBlink(unsigned int colourToTrigger, int LEDNumToTrigger)
+{
+    ledAnimation_t blinkAnimation = {
+        .type = LED_ANIM_BLINK,
+        .repeat = 3,
+        .firstLed = LEDNumToTrigger,
+        .lastLed = LEDNumToTrigger,
+        .onMs = 500,
+        .offMs = 200,
+        .colour = colourToTrigger,
+    };
+    LED_playAnimation(&blinkAnimation);
+}
+
+// Pick a slot for a new animation: one already animating the same LEDs is
+// restarted, otherwise the first finished slot, otherwise the oldest.
+static int findAnimationSlot(const ledAnimation_t *pAnimation)
+{
+    static int nextToReplace = 0;
+    int freeSlot = -1;
+    for (int i = 0; i < NUM_ANIMATION_SLOTS; i++) {
+        volatile ledAnimationSlot_t *pSlot = &pSharedPru0->animations[i];
+        bool isDone = pSlot->doneSeq == pSlot->startSeq;
+        if (!isDone
+                && pSlot->animation.firstLed == pAnimation->firstLed
+                && pSlot->animation.lastLed == pAnimation->lastLed) {
+            return i;
+        }
+        if (isDone && freeSlot < 0) {
+            freeSlot = i;
         }
-        turnOffAllLEDs();
     }
+    if (freeSlot >= 0) {
+        return freeSlot;
+    }
+    int slot = nextToReplace;
+    nextToReplace = (nextToReplace + 1) % NUM_ANIMATION_SLOTS;
+    return slot;
 }
 
-void LED_triggerBlink(unsigned int colourToTrigger, int LEDNumToTrigger)
+void LED_playAnimation(const ledAnimation_t *pAnimation)
 {
-    blink = true;
-    LEDNum = LEDNumToTrigger;
-    colour = colourToTrigger;
-}
\ No newline at end of file
+    assert(pAnimation->firstLed <= pAnimation->lastLed);
+    assert(pAnimation->lastLed < numLeds);
+    if (!hasPruAnimations) {
+        if (!LedScheduler_submit(pAnimation)) {
+            printf("LED scheduler queue full, dropping animation\n");
+        }
+        return;
+    }
+
+    // The PRU draws descriptor colours as-is, so correct them here
+    ledAnimation_t corrected = *pAnimation;
+    pthread_mutex_lock(&frameMutex);
+    corrected.colour = correctColour(pAnimation->colour);
+    pthread_mutex_unlock(&frameMutex);
+
+    pthread_mutex_lock(&animationMutex);
+    volatile ledAnimationSlot_t *pSlot = &pSharedPru0->animations[findAnimationSlot(pAnimation)];
+    pSlot->animation = corrected;
+    // Descriptor must land before the PRU sees the new sequence number
+    atomic_thread_fence(memory_order_release);
+    pSlot->startSeq = pSlot->startSeq + 1;
+    pthread_mutex_unlock(&animationMutex);
+}
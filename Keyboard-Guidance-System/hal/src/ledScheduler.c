@@ -0,0 +1,414 @@
+// Module to run timed LED effects on ARM
+// Effects are kept in a timer wheel and drawn through the LED driver's
+// overlay. Requests come in through a lock-free queue, and the scheduler
+// runs on the reactor when the next step is due or a request arrives.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+
+#include "hal/ledScheduler.h"
+#include "hal/ledDriver.h"
+#include "timeDelay.h"
+#include "reactor.h"
+
+#define NS_PER_MS 1000000LL
+
+#define MAX_EFFECTS 32
+#define NO_EFFECT -1
+
+// Timer wheel: one bucket per millisecond. A deadline more than WHEEL_SIZE
+// ticks away waits in its bucket until the wheel comes back around to it.
+#define WHEEL_TICK_NS NS_PER_MS
+#define WHEEL_SIZE 256
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+
+// Fades are redrawn at this interval
+#define FADE_STEP_MS 20
+
+// Bounded multi-producer, single-consumer queue of effect requests.
+// Each cell's seq says whose turn it is: pos when free for the producer
+// claiming pos, pos + 1 once filled for the consumer.
+#define QUEUE_SIZE 64
+#define QUEUE_MASK (QUEUE_SIZE - 1)
+
+typedef struct {
+    _Atomic unsigned int seq;
+    ledAnimation_t animation;
+} requestCell_t;
+
+static requestCell_t requestQueue[QUEUE_SIZE];
+static _Atomic unsigned int enqueuePos;
+static unsigned int dequeuePos;
+
+typedef struct {
+    ledAnimation_t animation;
+    long long startNs;
+    long long deadlineNs;
+    // Wheel bucket this effect is linked into, and the next effect there
+    int bucket;
+    int next;
+    bool isActive;
+} effect_t;
+
+// Only touched on the reactor thread
+static effect_t effects[MAX_EFFECTS];
+static int wheel[WHEEL_SIZE];
+static long long currentTick;
+static _Atomic int activeCount;
+
+static int wakeFd = -1;
+static reactorTimer_t *pStepTimer;
+
+// How late effect steps ran compared to their deadline
+static long long numSteps;
+static long long totalLatenessNs;
+static long long maxLatenessNs;
+
+bool LedScheduler_submit(const ledAnimation_t *pAnimation)
+{
+    unsigned int pos = atomic_load_explicit(&enqueuePos, memory_order_relaxed);
+    requestCell_t *pCell;
+    while (true) {
+        pCell = &requestQueue[pos & QUEUE_MASK];
+        unsigned int seq = atomic_load_explicit(&pCell->seq, memory_order_acquire);
+        int diff = (int) (seq - pos);
+        if (diff == 0) {
+            // Cell is free; claim it (a failed exchange reloads pos)
+            if (atomic_compare_exchange_weak_explicit(&enqueuePos, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // Consumer has not emptied this cell yet: queue is full
+            return false;
+        } else {
+            pos = atomic_load_explicit(&enqueuePos, memory_order_relaxed);
+        }
+    }
+
+    pCell->animation = *pAnimation;
+    atomic_store_explicit(&pCell->seq, pos + 1, memory_order_release);
+
+    // Wake the scheduler
+    uint64_t one = 1;
+    if (write(wakeFd, &one, sizeof(one)) != sizeof(one)) {
+        // Counter is already non-zero; the scheduler will wake anyway
+    }
+    return true;
+}
+
+static bool popRequest(ledAnimation_t *pAnimation)
+{
+    requestCell_t *pCell = &requestQueue[dequeuePos & QUEUE_MASK];
+    unsigned int seq = atomic_load_explicit(&pCell->seq, memory_order_acquire);
+    if (seq != dequeuePos + 1) {
+        return false;
+    }
+    *pAnimation = pCell->animation;
+    atomic_store_explicit(&pCell->seq, dequeuePos + QUEUE_SIZE, memory_order_release);
+    dequeuePos++;
+    return true;
+}
+
+int LedScheduler_getActiveCount(void)
+{
+    return activeCount;
+}
+
+// Link an effect into the bucket for its deadline. Overdue effects go in
+// the current tick's bucket so they are picked up straight away.
+static void wheelInsert(int id)
+{
+    long long tick = effects[id].deadlineNs / WHEEL_TICK_NS;
+    if (tick < currentTick) {
+        tick = currentTick;
+    }
+    int bucket = tick & WHEEL_MASK;
+    effects[id].bucket = bucket;
+    effects[id].next = wheel[bucket];
+    wheel[bucket] = id;
+}
+
+static void wheelRemove(int id)
+{
+    int *pLink = &wheel[effects[id].bucket];
+    while (*pLink != NO_EFFECT) {
+        if (*pLink == id) {
+            *pLink = effects[id].next;
+            return;
+        }
+        pLink = &effects[*pLink].next;
+    }
+}
+
+// Scale each GRB byte of a colour by level/256
+static uint32_t scaleColour(uint32_t colour, uint32_t level)
+{
+    uint32_t g = (((colour >> 16) & 0xFF) * level) >> 8;
+    uint32_t r = (((colour >> 8) & 0xFF) * level) >> 8;
+    uint32_t b = ((colour & 0xFF) * level) >> 8;
+    return (g << 16) | (r << 8) | b;
+}
+
+static void setOverlayRange(const ledAnimation_t *pAnim, uint32_t colour)
+{
+    for (int led = pAnim->firstLed; led <= pAnim->lastLed; led++) {
+        LED_setOverlay(led, colour);
+    }
+}
+
+// Draw an effect as it should look at nowNs. Matches the PRU renderer.
+// Returns ms after the start when it next changes, or -1 once finished.
+static long long renderEffect(effect_t *pEffect, long long nowNs)
+{
+    const ledAnimation_t *pAnim = &pEffect->animation;
+    long long elapsedMs = (nowNs - pEffect->startNs) / NS_PER_MS;
+    long long span = pAnim->lastLed - pAnim->firstLed + 1;
+    long long onMs = pAnim->onMs ? pAnim->onMs : 1;
+
+    switch (pAnim->type) {
+        case LED_ANIM_BLINK: {
+            long long period = onMs + pAnim->offMs;
+            long long cycle = elapsedMs / period;
+            if (cycle >= pAnim->repeat) {
+                return -1;
+            }
+            if (elapsedMs % period < onMs) {
+                setOverlayRange(pAnim, pAnim->colour);
+                return cycle * period + onMs;
+            }
+            setOverlayRange(pAnim, 0);
+            return (cycle + 1) * period;
+        }
+        case LED_ANIM_SWEEP:
+        case LED_ANIM_CHASE: {
+            long long step = elapsedMs / onMs;
+            if (step / span >= pAnim->repeat) {
+                return -1;
+            }
+            int pos = step % span;
+            setOverlayRange(pAnim, 0);
+            LED_setOverlay(pAnim->firstLed + pos, pAnim->colour);
+            if (pAnim->type == LED_ANIM_SWEEP) {
+                LED_setOverlay(pAnim->lastLed - pos, pAnim->colour);
+            }
+            return (step + 1) * onMs;
+        }
+        case LED_ANIM_FADE: {
+            if (elapsedMs / onMs >= pAnim->repeat) {
+                return -1;
+            }
+            // Triangle wave: up for the first half of the cycle, down for the second
+            long long t = elapsedMs % onMs;
+            long long half = onMs / 2 ? onMs / 2 : 1;
+            long long level = t < half ? (t * 255) / half : ((onMs - t) * 255) / half;
+            setOverlayRange(pAnim, scaleColour(pAnim->colour, level));
+            return elapsedMs + FADE_STEP_MS;
+        }
+        default:
+            return -1;
+    }
+}
+
+static bool isOverlapping(const ledAnimation_t *pA, const ledAnimation_t *pB)
+{
+    return pA->firstLed <= pB->lastLed && pB->firstLed <= pA->lastLed;
+}
+
+// Hand an effect's LEDs back to the committed frame. Anything else still
+// running on those LEDs is redrawn so it shows through.
+static void finishEffect(int id, long long nowNs)
+{
+    const ledAnimation_t *pAnim = &effects[id].animation;
+    effects[id].isActive = false;
+    activeCount--;
+    for (int led = pAnim->firstLed; led <= pAnim->lastLed; led++) {
+        LED_clearOverlay(led);
+    }
+    for (int i = 0; i < MAX_EFFECTS; i++) {
+        if (effects[i].isActive && isOverlapping(&effects[i].animation, pAnim)) {
+            renderEffect(&effects[i], nowNs);
+        }
+    }
+}
+
+static void stepEffect(int id, long long nowNs)
+{
+    effect_t *pEffect = &effects[id];
+    long long latenessNs = nowNs - pEffect->deadlineNs;
+    numSteps++;
+    totalLatenessNs += latenessNs;
+    if (latenessNs > maxLatenessNs) {
+        maxLatenessNs = latenessNs;
+    }
+
+    long long nextMs = renderEffect(pEffect, nowNs);
+    if (nextMs < 0) {
+        finishEffect(id, nowNs);
+        return;
+    }
+    pEffect->deadlineNs = pEffect->startNs + nextMs * NS_PER_MS;
+    wheelInsert(id);
+}
+
+// Move queued requests onto the wheel, due immediately
+static void startRequestedEffects(long long nowNs)
+{
+    ledAnimation_t animation;
+    while (popRequest(&animation)) {
+        int id = NO_EFFECT;
+        int freeId = NO_EFFECT;
+        for (int i = 0; i < MAX_EFFECTS; i++) {
+            if (effects[i].isActive
+                    && effects[i].animation.firstLed == animation.firstLed
+                    && effects[i].animation.lastLed == animation.lastLed) {
+                id = i;
+                break;
+            }
+            if (!effects[i].isActive && freeId == NO_EFFECT) {
+                freeId = i;
+            }
+        }
+
+        if (id != NO_EFFECT) {
+            // Restart: same LEDs, new effect
+            wheelRemove(id);
+        } else if (freeId != NO_EFFECT) {
+            id = freeId;
+            effects[id].isActive = true;
+            activeCount++;
+        } else {
+            printf("No free LED effect slots, dropping effect.\n");
+            continue;
+        }
+
+        effects[id].animation = animation;
+        effects[id].startNs = nowNs;
+        effects[id].deadlineNs = nowNs;
+        wheelInsert(id);
+    }
+}
+
+// Step every effect whose deadline has passed. Each bucket between the last
+// visit and now is looked at once; effects from a later lap stay put.
+static void runDueEffects(long long nowNs)
+{
+    long long nowTick = nowNs / WHEEL_TICK_NS;
+    long long firstTick = currentTick;
+    if (nowTick - firstTick >= WHEEL_SIZE) {
+        firstTick = nowTick - WHEEL_SIZE + 1;
+    }
+    currentTick = nowTick;
+
+    for (long long tick = firstTick; tick <= nowTick; tick++) {
+        int bucket = tick & WHEEL_MASK;
+        int id = wheel[bucket];
+        wheel[bucket] = NO_EFFECT;
+        while (id != NO_EFFECT) {
+            int next = effects[id].next;
+            if (effects[id].deadlineNs <= nowNs) {
+                stepEffect(id, nowNs);
+            } else {
+                effects[id].next = wheel[bucket];
+                wheel[bucket] = id;
+            }
+            id = next;
+        }
+    }
+}
+
+// Earliest deadline on the wheel, or -1 if nothing is running
+static long long findNextDeadlineNs(void)
+{
+    for (long long tick = currentTick; tick < currentTick + WHEEL_SIZE; tick++) {
+        long long earliestNs = -1;
+        for (int id = wheel[tick & WHEEL_MASK]; id != NO_EFFECT; id = effects[id].next) {
+            // Skip effects waiting for a later lap of the wheel
+            long long deadlineNs = effects[id].deadlineNs;
+            if (deadlineNs / WHEEL_TICK_NS <= tick && (earliestNs < 0 || deadlineNs < earliestNs)) {
+                earliestNs = deadlineNs;
+            }
+        }
+        if (earliestNs >= 0) {
+            return earliestNs;
+        }
+    }
+    // Only far-off deadlines; check back after one lap
+    return activeCount > 0 ? (currentTick + WHEEL_SIZE) * WHEEL_TICK_NS : -1;
+}
+
+// Start new effects and run due steps, then set the timer for the next one
+static void runScheduler(void *pContext)
+{
+    (void) pContext;
+    long long nowNs = getMonotonicTimeInNs();
+    startRequestedEffects(nowNs);
+    runDueEffects(nowNs);
+    // Everything that changed this pass goes out as one frame
+    LED_applyOverlay();
+
+    long long deadlineNs = findNextDeadlineNs();
+    if (deadlineNs >= 0) {
+        Reactor_armTimer(pStepTimer, deadlineNs, 0);
+    } else {
+        Reactor_disarmTimer(pStepTimer);
+    }
+}
+
+// A request was queued
+static void onWake(int fd, uint32_t events, void *pContext)
+{
+    (void) events;
+    uint64_t count;
+    if (read(fd, &count, sizeof(count)) < 0) {
+        // Nothing queued since the last pass
+    }
+    runScheduler(pContext);
+}
+
+// init and cleanup functions
+void LedScheduler_init(void)
+{
+    for (unsigned int i = 0; i < QUEUE_SIZE; i++) {
+        atomic_init(&requestQueue[i].seq, i);
+    }
+    atomic_init(&enqueuePos, 0);
+    dequeuePos = 0;
+
+    for (int i = 0; i < WHEEL_SIZE; i++) {
+        wheel[i] = NO_EFFECT;
+    }
+    for (int i = 0; i < MAX_EFFECTS; i++) {
+        effects[i].isActive = false;
+    }
+    activeCount = 0;
+    currentTick = getMonotonicTimeInNs() / WHEEL_TICK_NS;
+
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeFd < 0) {
+        perror("LED scheduler: eventfd");
+        exit(EXIT_FAILURE);
+    }
+    pStepTimer = Reactor_addTimer("led scheduler steps", runScheduler, NULL);
+    Reactor_addFd("led scheduler", wakeFd, EPOLLIN, onWake, NULL);
+}
+
+void LedScheduler_cleanup(void)
+{
+    Reactor_removeTimer(pStepTimer);
+    Reactor_removeFd(wakeFd);
+    close(wakeFd);
+    wakeFd = -1;
+
+    if (numSteps > 0) {
+        printf("LED scheduler: %lld steps, mean lateness %lld us, max %lld us\n",
+            numSteps, totalLatenessNs / numSteps / 1000, maxLatenessNs / 1000);
+    }
+}
@@ -1,29 +1,53 @@
-// Continue sampling the midi controller to get the notes being played
+// Read the midi controller output as notes are played, on the reactor
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/time.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/eventfd.h>
 
 #include "hal/midiReader.h"
+#include "midiReader_internal.h"
 #include "midiController.h"
-#include "shutdown.h"
 #include "timeDelay.h"
+#include "reactor.h"
+#include "hal/trace.h"
+#include "hal/statsPage.h"
 
 #define BUFFER_SIZE 4096
 #define MAX_NUM_OF_NOTES 13
+#define NS_PER_MS 1000000LL
 
 // the current note that needs to be played with queue sound
 static enum note noteToPlay;
 // flag to let queue sound know to play new note
 static bool needToPlayNote;
+static long long noteTimeNs;
 
 static FILE *file = NULL;
-static pthread_t midiThread;
-static pthread_mutex_t midiReaderMutex;
+static int amidiFd = -1;
+// amidi output not yet handled: at most one partial line
+static char lineBuffer[BUFFER_SIZE];
+static int lineLength;
+// Signalled each time a note is handed to the controller
+static int noteEventFd = -1;
+static pthread_mutex_t midiReaderMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Recorded MIDI: amidi lines replayed from a file instead of the keyboard.
+// Each line is "<ms since start> <amidi line>", e.g. "500 90 3C 33".
+static bool isRecording = false;
+static const char *recordingPath;
+static FILE *pRecording;
+static reactorTimer_t *pRecordingTimer;
+static long long recordingStartNs;
+// Next line to replay, and when
+static char recordedLine[BUFFER_SIZE];
+static long long recordedLineMs;
+static bool hasRecordedLine;
 
 // variables for chord logic
 struct chord currentChord;
@@ -56,51 +80,133 @@ static struct note_info notes[] = {
     {72, C8,      "C8"},
 };
 
-// gets the midi key when played
-static char *executeAmidi(FILE *pipe);
 // get the midi output
-static int parseMIDIOutput(char *midiOutput);
 
-static void* midiReaderThread() {
-    char* midiOutput;
-    while(!Shutdown_isShutdown()) {
-
-        // Execute amidi and get its output
-        // eg outputs 90 3C 33, then 80 3C 0 when released
-        midiOutput = executeAmidi(file);
-
-        // printf("raw midi output from executeAimidi: %s\n", midiOutput);
-
-        // Parse MIDI output and extract note value
-        int played_key = parseMIDIOutput(midiOutput);
+// amidi outputs 90 3C 33, then 80 3C 0 when released
+static void handleAmidiLine(char *pLine)
+{
+    TRACE_BEGIN("midi decode");
+    // Parse MIDI output and extract note value
+    int played_key = MidiReader_parseLine(pLine);
+    if (played_key != -1) {
+        MidiReader_submitNote(played_key);
+    }
+    TRACE_END("midi decode");
+}
 
-        // if a note is played and it's new (ie flag is set to false)
-        // flag should be set to false when it's 80
-        if (played_key != -1 && !needToPlayNote) {
-            // printf("Note Played: %s, %d\n", MidiReader_noteToString(played_key), MidiReader_intToNote(played_key));
+// Handle each complete line amidi has written
+static void handleAmidiLines(void)
+{
+    char *pLine = lineBuffer;
+    char *pEnd;
+    while ((pEnd = memchr(pLine, '\n', lineBuffer + lineLength - pLine)) != NULL) {
+        *pEnd = '\0';
+        handleAmidiLine(pLine);
+        pLine = pEnd + 1;
+    }
+    // Keep the partial line for next time
+    lineLength -= pLine - lineBuffer;
+    memmove(lineBuffer, pLine, lineLength);
+}
 
-            // reads the note played and sets the note to play
-            // allows for SRC functions to get the note and play it with ALSA
-            if (MidiReader_noteToString(played_key) != "Unknown"){
-                enum note note = MidiReader_intToNote(played_key);
-                MidiReader_setNoteToPlay(note);
-                MidiReader_setNeedToPlayNote(true);
+// Runs on the reactor whenever amidi has written something
+static void readAmidiOutput(int fd, uint32_t events, void *pContext)
+{
+    (void) events;
+    (void) pContext;
+    while (true) {
+        ssize_t length = read(fd, &lineBuffer[lineLength], BUFFER_SIZE - 1 - lineLength);
+        if (length < 0) {
+            if (errno != EAGAIN && errno != EINTR) {
+                perror("MIDI reader: read error");
             }
+            return;
+        }
+        if (length == 0) {
+            // amidi is gone; stop watching, or the reactor would spin on the EOF
+            printf("MIDI reader: amidi exited\n");
+            Reactor_removeFd(fd);
+            amidiFd = -1;
+            return;
+        }
+        lineLength += length;
+        handleAmidiLines();
+        // No newline in a full buffer: not amidi output, drop it
+        if (lineLength == BUFFER_SIZE - 1) {
+            lineLength = 0;
         }
+    }
+}
 
-        // wait for a moment before checking for MIDI events again
-        // prevents multiple input from same note played
-        sleepForMs(10);
+// Read ahead to the next recorded line, skipping blanks and # comments.
+// Returns false at the end of the recording.
+static bool readRecordedLine(void)
+{
+    char line[BUFFER_SIZE];
+    while (fgets(line, sizeof(line), pRecording) != NULL) {
+        int offset = 0;
+        if (line[0] == '#' || sscanf(line, "%lld %n", &recordedLineMs, &offset) != 1) {
+            continue;
+        }
+        line[strcspn(line, "\n")] = '\0';
+        snprintf(recordedLine, sizeof(recordedLine), "%s", &line[offset]);
+        return true;
     }
+    return false;
+}
 
-    // free allocated memory
-    free(midiOutput);
+// Runs on the reactor when the next recorded line is due
+static void replayRecording(void *pContext)
+{
+    (void) pContext;
+    long long elapsedMs = (getMonotonicTimeInNs() - recordingStartNs) / NS_PER_MS;
+    while (hasRecordedLine && recordedLineMs <= elapsedMs) {
+        handleAmidiLine(recordedLine);
+        hasRecordedLine = readRecordedLine();
+    }
+    if (hasRecordedLine) {
+        Reactor_armTimer(pRecordingTimer, recordingStartNs + recordedLineMs * NS_PER_MS, 0);
+    } else {
+        printf("MIDI reader: end of recording\n");
+    }
+}
 
-    return NULL;
+static void openRecording(void)
+{
+    pRecording = fopen(recordingPath, "r");
+    if (pRecording == NULL) {
+        printf("ERROR: Unable to open MIDI recording %s\n", recordingPath);
+        exit(EXIT_FAILURE);
+    }
+    pRecordingTimer = Reactor_addTimer("midi recording", replayRecording, NULL);
+    recordingStartNs = getMonotonicTimeInNs();
+    hasRecordedLine = readRecordedLine();
+    replayRecording(NULL);
 }
 
 // init function
 void MidiReader_init(void) {
+    needToPlayNote = false;
+    lineLength = 0;
+    // So the stats page shows them at 0 rather than not at all
+    STATS_ADD("midi.notesIn", 0);
+    STATS_ADD("midi.notesDropped", 0);
+
+    noteEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (noteEventFd < 0) {
+        perror("MIDI reader: eventfd");
+        exit(1);
+    }
+
+    if (isRecording) {
+        // Without a recording, notes only come from network MIDI
+        if (recordingPath != NULL) {
+            printf("Replaying MIDI from %s\n", recordingPath);
+            openRecording();
+        }
+        return;
+    }
+
     printf("Press a button on the MIDI controller...\n");
 
     // command to be run for continuous input from MIDI controller
@@ -111,24 +217,32 @@ void MidiReader_init(void) {
         exit(1);
     }
 
-    needToPlayNote = false;
-
-    pthread_mutex_init(&midiReaderMutex, NULL);
-
-    pthread_create(&midiThread, NULL, midiReaderThread, NULL);
+    amidiFd = fileno(file);
+    fcntl(amidiFd, F_SETFL, fcntl(amidiFd, F_GETFL) | O_NONBLOCK);
+    Reactor_addFd("midi reader", amidiFd, EPOLLIN, readAmidiOutput, NULL);
 }
 
 void MidiReader_cleanup(void) {
     printf("IN midi reader cleanup \n");
-    pclose(file);
-    pthread_join(midiThread, NULL);
-    pthread_mutex_destroy(&midiReaderMutex);
+    if (amidiFd >= 0) {
+        Reactor_removeFd(amidiFd);
+    }
+    if (file != NULL) {
+        pclose(file);
+        file = NULL;
+    }
+    if (pRecording != NULL) {
+        Reactor_removeTimer(pRecordingTimer);
+        fclose(pRecording);
+        pRecording = NULL;
+    }
+    close(noteEventFd);
     printf("midi reader cleanup done\n");
 }
 
 // function to parse the midi output into int representation
 // consulted chatGPT for tokenizing output
-static int parseMIDIOutput(char *midiOutput) {
+int MidiReader_parseLine(char *midiOutput) {
     // midiOutput should look like this initially 90 3E 31
 
     char *token;
@@ -192,61 +306,32 @@ static int parseMIDIOutput(char *midiOutput) {
     return note;
 }
 
-// function to execute amidi as a pipe to continuously sample the midi output
-// consulted chatGPT on set and select functionalities
-static char *executeAmidi(FILE *pipe) {
-    // initialize output variable with empty string and set it to empty
-    char *output = malloc(BUFFER_SIZE);
-    if (!output) {
-        perror("malloc");
-        exit(1);
-    }
-    output[0] = '\0'; 
-
-    // buffer string to keep track of current input
-    char buffer[BUFFER_SIZE];
-    int i = 0;
-    while(i < BUFFER_SIZE - 1) {
-
-        fd_set set;
-         // clear the set and add our file descriptor to the set
-        FD_ZERO(&set);               
-        FD_SET(fileno(pipe), &set);  
-
-        // 10 ms timeout to prevent blocking from select function
-        struct timeval timeout;
-        timeout.tv_sec = 0;
-        timeout.tv_usec = 10000; 
-
-        // select function to get the output from pipe
-        // waits until file descriptor is ready for reading
-        int relectResult = select(fileno(pipe) + 1, &set, NULL, NULL, &timeout);
-        // return -1 if error
-        if (relectResult == -1) {
-            perror("select error"); 
-            exit(1);
-        } 
-        // returns 0 if no data available
-        else if (relectResult == 0) {
-            break; 
-        } 
-        // data is available, read it
-        else {
-            // gets the input and put it in buffer
-            char c = fgetc(pipe);
-            buffer[i] = c;
-            i++;
-
-            // if it's a new line, add buffer to output
-            if (c == '\n') {
-                buffer[i] = '\0';
-                strcat(output, buffer);
-                break; 
-            }
-        }
+// Both the local keyboard and network MIDI come through here
+bool MidiReader_submitNote(int midiNote) {
+    enum note note = MidiReader_intToNote(midiNote);
+    if (note == NUM_OF_NOTES) {
+        return false;
     }
 
-    return output;
+    // only take a new note once the last one has been played
+    // (the flag is cleared by the controller)
+    pthread_mutex_lock(&midiReaderMutex);
+    bool isAccepted = !needToPlayNote;
+    if (isAccepted) {
+        // allows for SRC functions to get the note and play it with ALSA
+        MidiReader_setNoteToPlay(note);
+        MidiReader_setNeedToPlayNote(true);
+    }
+    pthread_mutex_unlock(&midiReaderMutex);
+    STATS_ADD("midi.notesIn", 1);
+    if (isAccepted) {
+        TRACE_INSTANT("note accepted", midiNote);
+        eventfd_write(noteEventFd, 1);
+    } else {
+        TRACE_INSTANT("note dropped", midiNote);
+        STATS_ADD("midi.notesDropped", 1);
+    }
+    return isAccepted;
 }
 
 // converts an int from midi input to enum note
@@ -279,6 +364,11 @@ int MidiReader_getNoteToPlay(void){
 
 void MidiReader_setNoteToPlay(enum note note) {
     noteToPlay = note;
+    noteTimeNs = getMonotonicTimeInNs();
+}
+
+long long MidiReader_getNoteTimeNs(void) {
+    return noteTimeNs;
 }
 
 // gets and sets variable indicating if a new note has been played
@@ -286,6 +376,15 @@ void MidiReader_setNeedToPlayNote(bool flag){
     needToPlayNote = flag;
 }
 
+void MidiReader_useRecording(const char *path) {
+    isRecording = true;
+    recordingPath = path;
+}
+
+int MidiReader_getNoteEventFd(void) {
+    return noteEventFd;
+}
+
 bool MidiReader_getNeedToPlayNote() {
     return needToPlayNote;
 }
\ No newline at end of file
@@ -0,0 +1,12 @@
+// Internals of midiReader.c that the benchmarks drive directly.
+// Not part of the module's interface: only midiReader.c and benchmarks/
+// include this.
+
+#ifndef _MIDI_READER_INTERNAL_H_
+#define _MIDI_READER_INTERNAL_H_
+
+// Decode one line of amidi output, such as "90 3C 40", in place.
+// Returns the MIDI note pressed, or -1 if the line is not a press.
+int MidiReader_parseLine(char *pLine);
+
+#endif
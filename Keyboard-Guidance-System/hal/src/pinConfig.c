@@ -0,0 +1,106 @@
+// Module to set pin modes and GPIO settings without a shell
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#include "hal/pinConfig.h"
+
+#define PINMUX_PATH "/sys/devices/platform/ocp/ocp:%s_pinmux/state"
+#define GPIO_PATH "/sys/class/gpio/gpio%d/%s"
+#define MAX_PATH_LEN 128
+#define MAX_VALUE_LEN 32
+#define MAX_PINS 32
+
+// Read the first line of a sysfs file. Returns false if it cannot be read.
+static bool readSetting(const char *path, char *value, int maxLength)
+{
+    FILE *pFile = fopen(path, "r");
+    if (pFile == NULL) {
+        return false;
+    }
+    bool isRead = fgets(value, maxLength, pFile) != NULL;
+    fclose(pFile);
+    if (isRead) {
+        value[strcspn(value, "\n")] = '\0';
+    }
+    return isRead;
+}
+
+// Write a setting unless the file already holds it.
+// Returns false if the file cannot be opened or written.
+static bool writeSetting(const char *path, const char *value)
+{
+    char current[MAX_VALUE_LEN];
+    if (readSetting(path, current, sizeof(current)) && strcmp(current, value) == 0) {
+        return true;
+    }
+    FILE *pFile = fopen(path, "w");
+    if (pFile == NULL) {
+        return false;
+    }
+    bool isWritten = fprintf(pFile, "%s", value) > 0;
+    // sysfs reports a rejected value when the write is flushed
+    isWritten = fclose(pFile) == 0 && isWritten;
+    return isWritten;
+}
+
+void PinConfig_apply(const pinConfig_t *pPins, int count)
+{
+    FILE *fallbacks[MAX_PINS];
+    const char *fallbackPins[MAX_PINS];
+    int fallbackCount = 0;
+
+    for (int i = 0; i < count; i++) {
+        char path[MAX_PATH_LEN];
+        snprintf(path, sizeof(path), PINMUX_PATH, pPins[i].pin);
+        if (writeSetting(path, pPins[i].mode)) {
+            continue;
+        }
+
+        // No pinmux file to write (e.g. an older image): let config-pin do
+        // it, starting every fallback before waiting on any of them
+        if (fallbackCount == MAX_PINS) {
+            printf("ERROR: too many pins to configure\n");
+            exit(EXIT_FAILURE);
+        }
+        char command[MAX_PATH_LEN];
+        snprintf(command, sizeof(command), "config-pin %s %s > /dev/null", pPins[i].pin, pPins[i].mode);
+        fallbacks[fallbackCount] = popen(command, "r");
+        if (fallbacks[fallbackCount] == NULL) {
+            perror("Unable to execute command:");
+            printf(" command: %s\n", command);
+            continue;
+        }
+        fallbackPins[fallbackCount++] = pPins[i].pin;
+    }
+
+    for (int i = 0; i < fallbackCount; i++) {
+        int exitCode = WEXITSTATUS(pclose(fallbacks[i]));
+        if (exitCode != 0) {
+            printf("ERROR: config-pin failed for %s, exit code: %d\n", fallbackPins[i], exitCode);
+        }
+    }
+}
+
+static void setGpioSetting(int gpio, const char *setting, const char *value)
+{
+    char path[MAX_PATH_LEN];
+    snprintf(path, sizeof(path), GPIO_PATH, gpio, setting);
+    if (!writeSetting(path, value)) {
+        printf("ERROR: Unable to write %s to %s.\n", value, path);
+        exit(EXIT_FAILURE);
+    }
+}
+
+void PinConfig_setGpioDirection(int gpio, const char *direction)
+{
+    setGpioSetting(gpio, "direction", direction);
+}
+
+void PinConfig_setGpioEdge(int gpio, const char *edge)
+{
+    setGpioSetting(gpio, "edge", edge);
+}
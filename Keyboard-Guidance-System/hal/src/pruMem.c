@@ -1,29 +1,87 @@
+#define _GNU_SOURCE
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
 #include <assert.h>
 
+#include "hal/pruMem.h"
+#include "hal/sharedDataStruct.h"
 
 // General PRU Memomry Sharing Routine
 // ----------------------------------------------------------------
 #define PRU_ADDR      0x4A300000   // Start of PRU memory Page 184 am335x TRM
 #define PRU_LEN       0x80000      // Length of PRU memory
-#define PRU0_DRAM     0x00000      // Offset to DRAM
-#define PRU1_DRAM     0x02000
-#define PRU_SHAREDMEM 0x10000      // Offset to shared memory
-#define PRU_MEM_RESERVED 0x200     // Amount used by stack and heap
 
-// Convert base address to each memory section
-#define PRU0_MEM_FROM_BASE(base) ( (base) + PRU0_DRAM + PRU_MEM_RESERVED)
-#define PRU1_MEM_FROM_BASE(base) ( (base) + PRU1_DRAM + PRU_MEM_RESERVED)
-#define PRUSHARED_MEM_FROM_BASE(base) ( (base) + PRU_SHAREDMEM)
+// PRU-ICSS interrupt controller (AM335x TRM 4.5.5)
+#define PRU_INTC      0x20000
+#define INTC_GER      0x010         // Global enable
+#define INTC_SICR     0x024         // Clear a system event by number
+#define INTC_EISR     0x028         // Enable a system event by number
+#define INTC_HIEISR   0x034         // Enable a host interrupt by number
+#define INTC_CMR(n)   (0x400 + 4 * (n))   // System event to channel, 4 per register
+#define INTC_HMR(n)   (0x800 + 4 * (n))   // Channel to host interrupt, 4 per register
+// Host interrupt 2 is PRU_EVTOUT0, the first one ARM can take
+#define ARM_EVENT_CHANNEL 2
+#define ARM_EVENT_HOST    2
+#define DEFAULT_EVENT_DEV "/dev/uio0"
+
+// Backing file for simulated PRU memory; -1 when mapping the real PRU.
+// Kept open so every mapping sees the same memory.
+static int simulatedFd = -1;
+// Stands in for the PRU's interrupt with simulated memory
+static int simulatedEventFd = -1;
+
+void PruMem_useFileBackend(const char *path)
+{
+    assert(simulatedFd < 0);
+    if (path == NULL) {
+        simulatedFd = memfd_create("pru-mem", 0);
+    } else {
+        simulatedFd = open(path, O_RDWR | O_CREAT, 0644);
+    }
+    if (simulatedFd == -1) {
+        perror("ERROR: could not create simulated PRU memory");
+        exit(EXIT_FAILURE);
+    }
+
+    // Grow the file to the size of PRU memory; new bytes read as zero
+    struct stat fileInfo;
+    if (fstat(simulatedFd, &fileInfo) == -1 || (fileInfo.st_size < PRU_LEN
+            && ftruncate(simulatedFd, PRU_LEN) == -1)) {
+        perror("ERROR: could not size simulated PRU memory");
+        exit(EXIT_FAILURE);
+    }
+
+    simulatedEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (simulatedEventFd == -1) {
+        perror("ERROR: could not create simulated PRU event");
+        exit(EXIT_FAILURE);
+    }
+}
+
+bool PruMem_isSimulated(void)
+{
+    return simulatedFd >= 0;
+}
 
 // Return the address of the PRU's base memory
 volatile void* getPruMmapAddr(void)
 {
+    if (simulatedFd >= 0) {
+        volatile void* pPruBase = mmap(0, PRU_LEN, PROT_READ | PROT_WRITE, MAP_SHARED, simulatedFd, 0);
+        if (pPruBase == MAP_FAILED) {
+            perror("ERROR: could not map simulated PRU memory");
+            exit(EXIT_FAILURE);
+        }
+        return pPruBase;
+    }
+
     // Open device
     int fd = open("/dev/mem", O_RDWR | O_SYNC);
     if (fd == -1) {
@@ -50,5 +108,78 @@ void freePruMmapAddr(volatile void* pPruBase)
     }
 }
 
+static volatile uint32_t *getIntcRegister(volatile void *pPruBase, int offset)
+{
+    return (volatile uint32_t *) ((volatile uint8_t *) pPruBase + PRU_INTC + offset);
+}
+
+// Route the PRU's event to the host interrupt ARM waits on. Registers the
+// PRU's own events share are changed one byte at a time.
+static void routeArmEvent(volatile void *pPruBase)
+{
+    volatile uint32_t *pChannelMap = getIntcRegister(pPruBase, INTC_CMR(PRU_ARM_SYSEVT / 4));
+    int channelShift = (PRU_ARM_SYSEVT % 4) * 8;
+    *pChannelMap = (*pChannelMap & ~(0xFFu << channelShift)) | (ARM_EVENT_CHANNEL << channelShift);
+
+    volatile uint32_t *pHostMap = getIntcRegister(pPruBase, INTC_HMR(ARM_EVENT_CHANNEL / 4));
+    int hostShift = (ARM_EVENT_CHANNEL % 4) * 8;
+    *pHostMap = (*pHostMap & ~(0xFFu << hostShift)) | (ARM_EVENT_HOST << hostShift);
+
+    *getIntcRegister(pPruBase, INTC_SICR) = PRU_ARM_SYSEVT;
+    *getIntcRegister(pPruBase, INTC_EISR) = PRU_ARM_SYSEVT;
+    *getIntcRegister(pPruBase, INTC_HIEISR) = ARM_EVENT_HOST;
+    *getIntcRegister(pPruBase, INTC_GER) = 1;
+}
+
+int PruMem_openEvent(volatile void *pPruBase)
+{
+    if (simulatedFd >= 0) {
+        return simulatedEventFd;
+    }
+
+    const char *path = getenv("KGS_PRU_EVENT_DEV");
+    if (path == NULL) {
+        path = DEFAULT_EVENT_DEV;
+    }
+    int fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1) {
+        printf("PRU event: unable to open %s, is the uio overlay loaded?\n", path);
+        return -1;
+    }
+    routeArmEvent(pPruBase);
+    return fd;
+}
+
+void PruMem_ackEvent(int fd, volatile void *pPruBase)
+{
+    if (simulatedFd >= 0) {
+        eventfd_t count;
+        eventfd_read(fd, &count);
+        return;
+    }
+    // uio reads give the interrupt count; nothing else to do with it
+    uint32_t count;
+    if (read(fd, &count, sizeof(count)) < 0) {
+        // Woken with nothing pending
+    }
+    *getIntcRegister(pPruBase, INTC_SICR) = PRU_ARM_SYSEVT;
+    // Drivers with interrupt control mask the line until re-enabled; the
+    // others refuse the write, which is fine
+    uint32_t enable = 1;
+    if (write(fd, &enable, sizeof(enable)) < 0) {
+    }
+}
 
+void PruMem_closeEvent(int fd)
+{
+    // The simulated event lives as long as the simulated memory
+    if (fd >= 0 && fd != simulatedEventFd) {
+        close(fd);
+    }
+}
 
+void PruMem_raiseEvent(void)
+{
+    assert(simulatedEventFd >= 0);
+    eventfd_write(simulatedEventFd, 1);
+}
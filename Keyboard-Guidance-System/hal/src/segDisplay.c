@@ -3,65 +3,36 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
-#include <pthread.h>
+#include <stdatomic.h>
 #include <unistd.h>
 #include <string.h>
 #include <fcntl.h>
+#include <time.h>
 #include <sys/ioctl.h>
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
 #include <linux/i2c.h>
 #include <linux/i2c-dev.h>
-#include <hal/runCommand.h>
+#include <hal/pinConfig.h>
 #include "timeDelay.h"
-#include <hal/writeFile.h>
-#include <shutdown.h>
 #include <midiController.h>
+#include <reactor.h>
+#include <hal/segGlyphs.h>
+#include <hal/segDisplay.h>
 
 #define I2CDRV_LINUX_BUS0 "/dev/i2c-0"
 #define I2CDRV_LINUX_BUS1 "/dev/i2c-1"
 #define I2CDRV_LINUX_BUS2 "/dev/i2c-2"
 
-static pthread_t segmentDisplayThread;
-
-// Holds the 2 digits
-typedef struct twoNumbers {
-    int leftDigit;
-    int rightDigit;
-} twoNumber;
-
-// Struct to split double digit numbers into individual digits
-static struct twoNumbers splitNum(int x) {
-    char str[100];
-    sprintf(str, "%d", x);
-    twoNumber num;
-    if (x < 10 && x >= 0) {
-        num.leftDigit = 0;
-        num.rightDigit = x;
-    } else {
-        num.leftDigit = str[0] - '0';
-        num.rightDigit = str[1] - '0';
-    }
+# define I2C_DEVICE_ADDRESS 0x20
 
-    return num;
+static reactorTimer_t *pSlotTimer;
+static reactorTimer_t *pIdleTimer;
+static int i2cFileDesc = -1;
 
-}
-
-struct numberLocationCommandNumber {
-    const unsigned char commandLowerHalfB;
-    const unsigned char commandUpperHalfA;
-};
-// Numbers are index to the count i.e. 0 = numCommands[0], 4 = numCommands[4]
-const struct numberLocationCommandNumber numCommands[] = {
-    {0xD0, 0xE1},
-    {0x02, 0x08},
-    {0x98, 0x83},
-    {0xD8, 0x03},
-    {0xC8, 0x22},
-    {0x58, 0x23},
-    {0x58, 0xA3},
-    {0xC0, 0x01},
-    {0xD8, 0xA3},
-    {0xD8, 0x23}
-};
+// Simulated: no I2C or pin setup, and the digit enables go to /dev/null.
+// Writes are still counted, so the refresh cost can be measured off-target.
+static bool isSimulated = false;
 
 static int initI2CBus(char * bus, int address)
 {
@@ -74,11 +45,18 @@ static int initI2CBus(char * bus, int address)
     return i2cFileDesc;
 }
 
+// Syscalls made by the refresh loop, to keep an eye on its cost
+static long long syscallCount;
+
 static void writeI2CReg(int i2cFileDesc, unsigned char regAddr, unsigned char val)
 {
     unsigned char buff[2];
     buff[0] = regAddr;
     buff[1] = val;
+    syscallCount++;
+    if (isSimulated) {
+        return;
+    }
     int res = write(i2cFileDesc, buff, 2);
     if (res != 2) {
         perror("I2C: Unable to write i2c register.");
@@ -86,84 +64,389 @@ static void writeI2CReg(int i2cFileDesc, unsigned char regAddr, unsigned char va
     }
 }
 
+// Write both output registers in one I2C_RDWR transfer: one syscall
+// instead of two, and the pattern changes in a single bus burst.
+static void writeI2CPattern(int i2cFileDesc, unsigned char regA, unsigned char valA,
+    unsigned char regB, unsigned char valB)
+{
+    unsigned char buffA[2] = {regA, valA};
+    unsigned char buffB[2] = {regB, valB};
+    struct i2c_msg messages[2] = {
+        {.addr = I2C_DEVICE_ADDRESS, .flags = 0, .len = 2, .buf = buffA},
+        {.addr = I2C_DEVICE_ADDRESS, .flags = 0, .len = 2, .buf = buffB},
+    };
+    struct i2c_rdwr_ioctl_data transfer = {.msgs = messages, .nmsgs = 2};
+    syscallCount++;
+    if (isSimulated) {
+        return;
+    }
+    int res = ioctl(i2cFileDesc, I2C_RDWR, &transfer);
+    if (res != 2) {
+        perror("I2C: Unable to write i2c registers.");
+        exit(1);
+    }
+}
 
-# define I2C_DEVICE_ADDRESS 0x20
 
 #define REG_DIRA 0x02
 #define REG_DIRB 0x03
 #define REG_OUTB 0x00
 #define REG_OUTA 0x01
 
+#define LEFT_GPIO 61
+#define RIGHT_GPIO 44
 #define LEFT_PATH "/sys/class/gpio/gpio61/value"
 #define RIGHT_PATH "/sys/class/gpio/gpio44/value"
 
 #define OFF "0"
 #define ON "1"
 
-// Displays the numbers on the I2C 14-seg LED
-static void displayNumber(int leftDigit, int rightDigit, int i2cFileDesc) {
-    // Drive left digit
-    writeFile(LEFT_PATH, OFF);
-    writeFile(RIGHT_PATH, OFF);
-    writeI2CReg(i2cFileDesc, REG_OUTA, numCommands[leftDigit].commandUpperHalfA);
-    writeI2CReg(i2cFileDesc, REG_OUTB, numCommands[leftDigit].commandLowerHalfB);
-    writeFile(LEFT_PATH, ON);
-    sleepForMs(5);
-
-    // Drive right digit
-    writeFile(LEFT_PATH, OFF);
-    writeFile(RIGHT_PATH, OFF);
-    writeI2CReg(i2cFileDesc, REG_OUTA, numCommands[rightDigit].commandUpperHalfA);
-    writeI2CReg(i2cFileDesc, REG_OUTB, numCommands[rightDigit].commandLowerHalfB);
-    writeFile(RIGHT_PATH, ON);
-    sleepForMs(5);
-}
-
-static void * segmentDisplayThreadFunction() {
-
-    // configure the pins
-    runCommand("config-pin P9_18 i2c");
-    runCommand("config-pin P9_17 i2c");
-    runCommand("echo out > /sys/class/gpio/gpio61/direction");
-    runCommand("echo out > /sys/class/gpio/gpio44/direction");
-    int i2cFileDesc = initI2CBus(I2CDRV_LINUX_BUS1, I2C_DEVICE_ADDRESS);
-    writeI2CReg(i2cFileDesc, REG_DIRA, 0x00);
-    writeI2CReg(i2cFileDesc, REG_DIRB, 0x00);
+// How long each digit stays lit per refresh while the text moves, and
+// once it holds still, where a slower refresh does not show
+#define DIGIT_ON_MS 5
+#define STATIC_DIGIT_ON_MS 8
+// Scrolling text moves on one character this often
+#define SCROLL_STEP_MS 300
+// Blank the display after this long without a song change or a note
+#define IDLE_BLANK_MS 60000
+#define NS_PER_MS 1000000LL
+// Wakeups later than this are counted as visibly late
+#define LATE_THRESHOLD_NS NS_PER_MS
 
-    bool exitFlag = false;
+enum digit {
+    DIGIT_LEFT = 0,
+    DIGIT_RIGHT,
+    NUM_DIGITS
+};
 
-    while(!Shutdown_isShutdown()) {
+// Digit enable files, opened once; and what was last written to each
+static int digitFds[NUM_DIGITS] = {-1, -1};
+static bool isDigitOn[NUM_DIGITS];
 
-        // Display current song on i2c 
-        int currentSong = MidiController_getCurrentSong();
-        struct twoNumbers twoNum = splitNum(currentSong);
+// Pattern last written to the expander, so unchanged writes are skipped
+static segGlyph_t shownGlyph;
+static bool isPatternShown;
 
-        displayNumber(twoNum.leftDigit,twoNum.rightDigit, i2cFileDesc);
+static int openDigitFile(const char *path)
+{
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd == -1) {
+        printf("ERROR OPENING %s.\n", path);
+        exit(1);
     }
+    return fd;
+}
 
-    // Turns off segmentDisplay when shutting down
-    writeFile(LEFT_PATH, OFF);
-    writeFile(RIGHT_PATH, OFF);
-    
-    close(i2cFileDesc);
+static void setDigit(enum digit whichDigit, bool isOn)
+{
+    if (isDigitOn[whichDigit] == isOn) {
+        return;
+    }
+    // sysfs value files take a write at offset 0 each time
+    int res = pwrite(digitFds[whichDigit], isOn ? ON : OFF, 1, 0);
+    syscallCount++;
+    if (res != 1) {
+        perror("ERROR WRITING DIGIT");
+        exit(1);
+    }
+    isDigitOn[whichDigit] = isOn;
+}
 
-    printf("I2c thread done\n");
-    return NULL;
+static bool isSameGlyph(segGlyph_t first, segGlyph_t second)
+{
+    return first.regA == second.regA && first.regB == second.regB;
+}
+
+static void showPattern(int i2cFileDesc, segGlyph_t glyph)
+{
+    if (isPatternShown && isSameGlyph(shownGlyph, glyph)) {
+        return;
+    }
+    writeI2CPattern(i2cFileDesc, REG_OUTA, glyph.regA, REG_OUTB, glyph.regB);
+    shownGlyph = glyph;
+    isPatternShown = true;
+}
+
+// Multiplex slots run off a periodic timer on CLOCK_MONOTONIC, so time
+// spent on I/O comes out of the slot instead of stretching it, and the
+// refresh rate stays fixed under load.
+static long long nextSlotNs;
+static long long slotNs;
+
+// The slot timer is stopped while there is nothing to refresh: the frame
+// holds still with both digits the same, or the display is blank.
+// SegmentDisplay_wake() starts it again through wakeFd.
+static int wakeFd = -1;
+static _Atomic bool isParked;
+static _Atomic long long lastActivityNs;
+static bool isBlank;
+
+// How late each wakeup was against its deadline
+static long long slotCount;
+static long long totalLatenessNs;
+static long long maxLatenessNs;
+static long long lateSlots;
+// Slots missed entirely because the reactor was busy
+static long long overruns;
+
+// Digit lit in the last slot, when the two digits differ
+static enum digit litDigit;
+
+// Frames are only built again when the song changes: the song name
+// scrolls by once, then the number stays
+static segScroll_t scroll;
+static int shownSong = -1;
+static long long scrollStartNs;
+static long long startMs;
+
+static void recordLateness(void)
+{
+    uint64_t expirations = Reactor_getTimerExpirations(pSlotTimer);
+    // Move on to the deadline of the latest expiry; earlier ones were missed
+    nextSlotNs += expirations * slotNs;
+    long long latenessNs = getMonotonicTimeInNs() - nextSlotNs;
+    slotCount++;
+    totalLatenessNs += latenessNs;
+    if (latenessNs > maxLatenessNs) {
+        maxLatenessNs = latenessNs;
+    }
+    if (latenessNs > LATE_THRESHOLD_NS) {
+        lateSlots++;
+    }
+    overruns += expirations - 1;
+}
+
+static void printSlotStats(void)
+{
+    if (slotCount == 0) {
+        return;
+    }
+    printf("Segment display slots: %lld, lateness mean %lld us max %lld us, "
+        "%lld over %lld us, %lld missed\n",
+        slotCount, totalLatenessNs / slotCount / 1000, maxLatenessNs / 1000,
+        lateSlots, LATE_THRESHOLD_NS / 1000, overruns);
+}
+
+// Shows one slot of a frame on the I2C 14-seg LED
+static void displayFrame(const segFrame_t *pFrame) {
+    // Both digits look the same: light them together and there is nothing
+    // to multiplex, so no I2C traffic until the frame changes
+    if (isSameGlyph(pFrame->left, pFrame->right)) {
+        showPattern(i2cFileDesc, pFrame->left);
+        setDigit(DIGIT_LEFT, true);
+        setDigit(DIGIT_RIGHT, true);
+        return;
+    }
+
+    // Otherwise drive the digits in turn, one per slot
+    litDigit = litDigit == DIGIT_LEFT ? DIGIT_RIGHT : DIGIT_LEFT;
+    enum digit otherDigit = litDigit == DIGIT_LEFT ? DIGIT_RIGHT : DIGIT_LEFT;
+    setDigit(otherDigit, false);
+    showPattern(i2cFileDesc, litDigit == DIGIT_LEFT ? pFrame->left : pFrame->right);
+    setDigit(litDigit, true);
+}
+
+// The song number, after its name if every letter of it can be drawn
+static void buildSongScroll(int song)
+{
+    const char *name = MidiController_getSongName(song);
+    bool canShowName = true;
+    for (const char *pChar = name; *pChar != '\0'; pChar++) {
+        canShowName = canShowName && SegGlyphs_hasGlyph(*pChar);
+    }
+
+    char number[3];
+    char text[SEG_SCROLL_MAX_LEN + 1];
+    snprintf(number, sizeof(number), "%02d", song);
+    if (canShowName) {
+        snprintf(text, sizeof(text), "%s %s", number, name);
+    } else {
+        snprintf(text, sizeof(text), "%s", number);
+    }
+    SegGlyphs_buildScroll(text, number, &scroll);
+}
+
+// Run slots every intervalNs, the first one now
+static void startSlots(long long intervalNs)
+{
+    slotNs = intervalNs;
+    nextSlotNs = getMonotonicTimeInNs() - slotNs;
+    Reactor_armTimer(pSlotTimer, nextSlotNs + slotNs, slotNs);
+}
+
+// Keep to the current slot schedule at a new rate
+static void setSlotRate(long long intervalNs)
+{
+    if (intervalNs != slotNs) {
+        slotNs = intervalNs;
+        Reactor_armTimer(pSlotTimer, nextSlotNs + slotNs, slotNs);
+    }
+}
+
+// Start refreshing again after being parked
+static void resume(void)
+{
+    if (isBlank) {
+        // setDigit() lights the digits again in the first slot
+        isBlank = false;
+        Reactor_armTimer(pIdleTimer, atomic_load(&lastActivityNs) + IDLE_BLANK_MS * NS_PER_MS, 0);
+    }
+    startSlots(DIGIT_ON_MS * NS_PER_MS);
+}
+
+// Stop the slot timer until SegmentDisplay_wake(). A wake that lands while
+// parking either sees isParked and writes wakeFd, or has moved
+// lastActivityNs on from activityNs and is caught here.
+static void park(long long activityNs)
+{
+    Reactor_disarmTimer(pSlotTimer);
+    atomic_store(&isParked, true);
+    if (atomic_load(&lastActivityNs) != activityNs && atomic_exchange(&isParked, false)) {
+        resume();
+    }
+}
+
+// Runs on the reactor at the start of every slot
+static void onSlot(void *pContext) {
+    (void) pContext;
+    recordLateness();
+    long long activityNs = atomic_load(&lastActivityNs);
+
+    // Display current song number and name on i2c
+    int currentSong = MidiController_getCurrentSong();
+    if (currentSong != shownSong) {
+        buildSongScroll(currentSong);
+        shownSong = currentSong;
+        scrollStartNs = nextSlotNs;
+    }
+
+    // The slot schedule doubles as the scroll clock
+    long long step = (nextSlotNs - scrollStartNs) / (SCROLL_STEP_MS * NS_PER_MS);
+    bool isMoving = step < scroll.count - 1;
+    const segFrame_t *pFrame = &scroll.frames[isMoving ? step : scroll.count - 1];
+    displayFrame(pFrame);
+
+    // Only moving text needs the fast refresh, and a frame with both
+    // digits the same needs none: it stays lit without multiplexing
+    if (!isMoving && isSameGlyph(pFrame->left, pFrame->right)) {
+        park(activityNs);
+    } else {
+        setSlotRate((isMoving ? DIGIT_ON_MS : STATIC_DIGIT_ON_MS) * NS_PER_MS);
+    }
+}
+
+// Blank the display once nothing has happened for IDLE_BLANK_MS
+static void onIdle(void *pContext) {
+    (void) pContext;
+    long long activityNs = atomic_load(&lastActivityNs);
+    long long blankNs = activityNs + IDLE_BLANK_MS * NS_PER_MS;
+    if (getMonotonicTimeInNs() < blankNs) {
+        Reactor_armTimer(pIdleTimer, blankNs, 0);
+        return;
+    }
+    setDigit(DIGIT_LEFT, false);
+    setDigit(DIGIT_RIGHT, false);
+    isBlank = true;
+    park(activityNs);
+}
+
+// SegmentDisplay_wake() found the slot timer parked
+static void onWake(int fd, uint32_t events, void *pContext) {
+    (void) events;
+    (void) pContext;
+    eventfd_t count;
+    eventfd_read(fd, &count);
+    resume();
+}
+
+void SegmentDisplay_wake(void)
+{
+    atomic_store(&lastActivityNs, getMonotonicTimeInNs());
+    if (atomic_exchange(&isParked, false)) {
+        eventfd_write(wakeFd, 1);
+    }
 }
 
 // init and cleanup functions
+void SegmentDisplay_useSimulated(void)
+{
+    isSimulated = true;
+}
+
 void SegmentDisplay_init(void)
 {  
-    int retStatus = pthread_create(&segmentDisplayThread, NULL, &segmentDisplayThreadFunction, NULL);
-    if (retStatus != 0){
-        fprintf(stderr, "Error in creating thread\n");
+    if (isSimulated) {
+        digitFds[DIGIT_LEFT] = openDigitFile("/dev/null");
+        digitFds[DIGIT_RIGHT] = openDigitFile("/dev/null");
+    } else {
+        // configure the pins
+        const pinConfig_t pins[] = {
+            {"P9_18", "i2c"},
+            {"P9_17", "i2c"},
+        };
+        PinConfig_apply(pins, sizeof(pins) / sizeof(pins[0]));
+        PinConfig_setGpioDirection(LEFT_GPIO, "out");
+        PinConfig_setGpioDirection(RIGHT_GPIO, "out");
+
+        i2cFileDesc = initI2CBus(I2CDRV_LINUX_BUS1, I2C_DEVICE_ADDRESS);
+        digitFds[DIGIT_LEFT] = openDigitFile(LEFT_PATH);
+        digitFds[DIGIT_RIGHT] = openDigitFile(RIGHT_PATH);
     }
+    writeI2CReg(i2cFileDesc, REG_DIRA, 0x00);
+    writeI2CReg(i2cFileDesc, REG_DIRB, 0x00);
+
+    // Force the first setDigit() calls to write
+    isDigitOn[DIGIT_LEFT] = true;
+    isDigitOn[DIGIT_RIGHT] = true;
+    isPatternShown = false;
+    shownSong = -1;
+    isBlank = false;
+    isParked = false;
+    lastActivityNs = getMonotonicTimeInNs();
+
+    syscallCount = 0;
+    slotCount = 0;
+    totalLatenessNs = 0;
+    maxLatenessNs = 0;
+    lateSlots = 0;
+    overruns = 0;
+    startMs = getTimeInMs();
+
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeFd < 0) {
+        perror("ERROR: Unable to create segment display eventfd");
+        exit(EXIT_FAILURE);
+    }
+    pSlotTimer = Reactor_addTimer("segment display", onSlot, NULL);
+    pIdleTimer = Reactor_addTimer("segment display idle", onIdle, NULL);
+    Reactor_addFd("segment display wake", wakeFd, EPOLLIN, onWake, NULL);
+    Reactor_armTimer(pIdleTimer, lastActivityNs + IDLE_BLANK_MS * NS_PER_MS, 0);
+    startSlots(DIGIT_ON_MS * NS_PER_MS);
 }
 void SegmentDisplay_cleanup(void)
 {
-    int retStatus = pthread_join(segmentDisplayThread, NULL);
-    if (retStatus != 0){
-        fprintf(stderr, "Error in joining thread\n");
+    Reactor_removeFd(wakeFd);
+    Reactor_removeTimer(pIdleTimer);
+    Reactor_removeTimer(pSlotTimer);
+    close(wakeFd);
+    wakeFd = -1;
+
+    long long elapsedMs = getTimeInMs() - startMs;
+    if (elapsedMs > 0) {
+        printf("Segment display: %lld syscalls in %lld ms (%lld/s)\n",
+            syscallCount, elapsedMs, syscallCount * 1000 / elapsedMs);
+    }
+    printSlotStats();
+
+    // Turns off segmentDisplay when shutting down
+    setDigit(DIGIT_LEFT, false);
+    setDigit(DIGIT_RIGHT, false);
+    close(digitFds[DIGIT_LEFT]);
+    close(digitFds[DIGIT_RIGHT]);
+    
+    if (i2cFileDesc >= 0) {
+        close(i2cFileDesc);
+        i2cFileDesc = -1;
     }
     printf("14 seg cleanup done!\n");
 
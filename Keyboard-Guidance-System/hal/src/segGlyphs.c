@@ -0,0 +1,125 @@
+// Module with the 14-segment character set and scrolling text
+
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "hal/segGlyphs.h"
+
+// Expander bit driving each segment: low byte is register A, high byte B.
+//      aaaaa
+//     fh j kb
+//     f hjk b
+//      g1 g2
+//     e lmn c
+//     el m nc
+//      ddddd
+// a-g2, j and m are known from the digit patterns, and the digit 0 lights
+// one diagonal for its slash, called k here. The other diagonals are on
+// A2, B0 and B5 (A4 and B2 are unused), but which is which has not been
+// checked on the cape, so characters that need h, l, n or any other use
+// of k are left out.
+#define SEG_A   0x0001
+#define SEG_G1  0x0002
+#define SEG_J   0x0008
+#define SEG_F   0x0020
+#define SEG_K   0x0040
+#define SEG_E   0x0080
+#define SEG_M   0x0200
+#define SEG_G2  0x0800
+#define SEG_D   0x1000
+#define SEG_C   0x4000
+#define SEG_B   0x8000
+
+#define SEG_G   (SEG_G1 | SEG_G2)
+
+static const uint16_t glyphSegments[128] = {
+    [' '] = 0,
+    ['0'] = SEG_A | SEG_B | SEG_C | SEG_D | SEG_E | SEG_F | SEG_K,
+    ['1'] = SEG_J | SEG_M,
+    ['2'] = SEG_A | SEG_B | SEG_G | SEG_E | SEG_D,
+    ['3'] = SEG_A | SEG_B | SEG_C | SEG_D | SEG_G,
+    ['4'] = SEG_F | SEG_G | SEG_B | SEG_C,
+    ['5'] = SEG_A | SEG_F | SEG_G | SEG_C | SEG_D,
+    ['6'] = SEG_A | SEG_F | SEG_G | SEG_E | SEG_C | SEG_D,
+    ['7'] = SEG_A | SEG_B | SEG_C,
+    ['8'] = SEG_A | SEG_B | SEG_C | SEG_D | SEG_E | SEG_F | SEG_G,
+    ['9'] = SEG_A | SEG_B | SEG_C | SEG_D | SEG_F | SEG_G,
+    ['A'] = SEG_A | SEG_B | SEG_C | SEG_E | SEG_F | SEG_G,
+    ['B'] = SEG_A | SEG_B | SEG_C | SEG_D | SEG_G2 | SEG_J | SEG_M,
+    ['C'] = SEG_A | SEG_D | SEG_E | SEG_F,
+    ['D'] = SEG_A | SEG_B | SEG_C | SEG_D | SEG_J | SEG_M,
+    ['E'] = SEG_A | SEG_D | SEG_E | SEG_F | SEG_G1,
+    ['F'] = SEG_A | SEG_E | SEG_F | SEG_G1,
+    ['G'] = SEG_A | SEG_C | SEG_D | SEG_E | SEG_F | SEG_G2,
+    ['H'] = SEG_B | SEG_C | SEG_E | SEG_F | SEG_G,
+    ['I'] = SEG_A | SEG_D | SEG_J | SEG_M,
+    ['J'] = SEG_B | SEG_C | SEG_D | SEG_E,
+    ['L'] = SEG_D | SEG_E | SEG_F,
+    ['O'] = SEG_A | SEG_B | SEG_C | SEG_D | SEG_E | SEG_F,
+    ['P'] = SEG_A | SEG_B | SEG_E | SEG_F | SEG_G,
+    ['S'] = SEG_A | SEG_C | SEG_D | SEG_F | SEG_G,
+    ['T'] = SEG_A | SEG_J | SEG_M,
+    ['U'] = SEG_B | SEG_C | SEG_D | SEG_E | SEG_F,
+    ['-'] = SEG_G,
+    ['_'] = SEG_D,
+    ['='] = SEG_G | SEG_D,
+    ['+'] = SEG_G | SEG_J | SEG_M,
+    ['\''] = SEG_J,
+    ['"'] = SEG_J | SEG_B,
+    ['['] = SEG_A | SEG_D | SEG_E | SEG_F,
+    [']'] = SEG_A | SEG_B | SEG_C | SEG_D,
+    ['?'] = SEG_A | SEG_B | SEG_G2 | SEG_M,
+};
+
+bool SegGlyphs_hasGlyph(char c)
+{
+    unsigned char index = toupper((unsigned char) c);
+    return c == ' ' || (index < 128 && glyphSegments[index] != 0);
+}
+
+segGlyph_t SegGlyphs_forChar(char c)
+{
+    unsigned char index = toupper((unsigned char) c);
+    uint16_t segments = index < 128 ? glyphSegments[index] : 0;
+    segGlyph_t glyph = {
+        .regA = segments & 0xFF,
+        .regB = segments >> 8,
+    };
+    return glyph;
+}
+
+// Frame showing up to two characters
+static segFrame_t buildStill(const char *text)
+{
+    int length = strlen(text);
+    segFrame_t frame = {
+        .left = SegGlyphs_forChar(length > 0 ? text[0] : ' '),
+        .right = SegGlyphs_forChar(length > 1 ? text[1] : ' '),
+    };
+    return frame;
+}
+
+void SegGlyphs_buildScroll(const char *text, const char *holdText, segScroll_t *pScroll)
+{
+    int length = strlen(text);
+    if (length > SEG_SCROLL_MAX_LEN) {
+        length = SEG_SCROLL_MAX_LEN;
+    }
+
+    if (length <= 2) {
+        pScroll->frames[0] = buildStill(text);
+        pScroll->count = 1;
+        return;
+    }
+
+    // Frame i shows characters i and i + 1 of the text, with blanks past
+    // its end, until the gap; then it comes to rest on holdText
+    int scrollLength = length + SEG_SCROLL_GAP - 1;
+    for (int i = 0; i < scrollLength; i++) {
+        pScroll->frames[i].left = SegGlyphs_forChar(i < length ? text[i] : ' ');
+        pScroll->frames[i].right = SegGlyphs_forChar(i + 1 < length ? text[i + 1] : ' ');
+    }
+    pScroll->frames[scrollLength] = buildStill(holdText);
+    pScroll->count = scrollLength + 1;
+}
@@ -0,0 +1,102 @@
+// Shared memory page of live counters and gauges
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "hal/statsPage.h"
+
+// Used until StatsPage_init(), and if the shared page cannot be made
+static statsPage_t privatePage;
+static statsPage_t *pPage = &privatePage;
+static bool isShared;
+
+// Entries are added from module init on several threads
+static pthread_mutex_t registerMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void fillHeader(statsPage_t *pNewPage)
+{
+    memcpy(pNewPage->magic, STATS_PAGE_MAGIC, sizeof(pNewPage->magic));
+    pNewPage->version = STATS_PAGE_VERSION;
+    pNewPage->pid = getpid();
+    atomic_store(&pNewPage->isRunning, 1);
+}
+
+void StatsPage_init(void)
+{
+    fillHeader(&privatePage);
+
+    // A page left by an earlier run is cut back to nothing, then regrown
+    int fd = shm_open(STATS_PAGE_NAME, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        perror("Stats page: unable to create " STATS_PAGE_NAME ", stats stay private");
+        return;
+    }
+    if (ftruncate(fd, sizeof(statsPage_t)) < 0) {
+        perror("Stats page: unable to size " STATS_PAGE_NAME ", stats stay private");
+        close(fd);
+        shm_unlink(STATS_PAGE_NAME);
+        return;
+    }
+    statsPage_t *pSharedPage = mmap(NULL, sizeof(statsPage_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (pSharedPage == MAP_FAILED) {
+        perror("Stats page: unable to map " STATS_PAGE_NAME ", stats stay private");
+        shm_unlink(STATS_PAGE_NAME);
+        return;
+    }
+
+    pthread_mutex_lock(&registerMutex);
+    if (atomic_load(&privatePage.numEntries) > 0) {
+        printf("ERROR: Stats page entries were added before StatsPage_init()\n");
+        exit(EXIT_FAILURE);
+    }
+    fillHeader(pSharedPage);
+    pPage = pSharedPage;
+    isShared = true;
+    pthread_mutex_unlock(&registerMutex);
+}
+
+void StatsPage_cleanup(void)
+{
+    atomic_store(&pPage->isRunning, 0);
+    if (isShared) {
+        // Readers keep their mapping; they see isRunning go to 0
+        shm_unlink(STATS_PAGE_NAME);
+    }
+}
+
+statsEntry_t *StatsPage_register(const char *name, enum statsKind kind)
+{
+    pthread_mutex_lock(&registerMutex);
+    uint32_t numEntries = atomic_load_explicit(&pPage->numEntries, memory_order_relaxed);
+    statsEntry_t *pEntry = NULL;
+    for (uint32_t i = 0; i < numEntries; i++) {
+        if (strcmp(pPage->entries[i].name, name) == 0) {
+            pEntry = &pPage->entries[i];
+            break;
+        }
+    }
+    if (pEntry != NULL && pEntry->kind != kind) {
+        printf("ERROR: Stats entry %s is used as both a counter and a gauge\n", name);
+        exit(EXIT_FAILURE);
+    }
+    if (pEntry == NULL) {
+        if (numEntries == STATS_MAX_ENTRIES) {
+            printf("ERROR: Stats page is full adding %s\n", name);
+            exit(EXIT_FAILURE);
+        }
+        pEntry = &pPage->entries[numEntries];
+        pEntry->kind = kind;
+        snprintf(pEntry->name, sizeof(pEntry->name), "%s", name);
+        // Publishes the name and kind to readers
+        atomic_store_explicit(&pPage->numEntries, numEntries + 1, memory_order_release);
+    }
+    pthread_mutex_unlock(&registerMutex);
+    return pEntry;
+}
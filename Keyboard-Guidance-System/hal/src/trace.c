@@ -0,0 +1,216 @@
+// Module to trace where time goes between a key press and the sound
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/signalfd.h>
+
+#include "hal/trace.h"
+#include "timeDelay.h"
+#include "reactor.h"
+#include "worker.h"
+
+#define TRACE_BUFFER_MASK (TRACE_BUFFER_EVENTS - 1)
+_Static_assert((TRACE_BUFFER_EVENTS & TRACE_BUFFER_MASK) == 0, "TRACE_BUFFER_EVENTS must be a power of 2");
+
+// Written only by its thread; the dump reads it from wherever it runs
+struct TraceBuffer {
+    // Events ever recorded; the next one goes at head & TRACE_BUFFER_MASK
+    _Atomic uint32_t head;
+    int tid;
+    char threadName[TRACE_THREAD_NAME_LEN];
+    traceEvent_t events[TRACE_BUFFER_EVENTS];
+};
+
+static struct TraceBuffer buffers[TRACE_MAX_THREADS];
+static _Atomic int numBuffers;
+static __thread struct TraceBuffer *pThreadBuffer;
+// Set for threads that came after the buffers ran out
+static __thread bool isUntraced;
+
+static const char *names[TRACE_MAX_NAMES + 1];
+static int numNames;
+static pthread_mutex_t namesMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int signalFd = -1;
+
+uint16_t Trace_registerName(const char *name)
+{
+    pthread_mutex_lock(&namesMutex);
+    uint16_t id = 0;
+    for (int i = 1; i <= numNames; i++) {
+        if (strcmp(names[i], name) == 0) {
+            id = i;
+            break;
+        }
+    }
+    if (id == 0) {
+        if (numNames == TRACE_MAX_NAMES) {
+            printf("ERROR: Too many trace names adding %s\n", name);
+            exit(EXIT_FAILURE);
+        }
+        id = ++numNames;
+        names[id] = name;
+    }
+    pthread_mutex_unlock(&namesMutex);
+    return id;
+}
+
+// First event from a thread: give it a buffer of its own
+static struct TraceBuffer *claimBuffer(void)
+{
+    int index = atomic_fetch_add(&numBuffers, 1);
+    if (index >= TRACE_MAX_THREADS) {
+        isUntraced = true;
+        return NULL;
+    }
+    struct TraceBuffer *pBuffer = &buffers[index];
+    pBuffer->tid = gettid();
+    pthread_getname_np(pthread_self(), pBuffer->threadName, TRACE_THREAD_NAME_LEN);
+    pThreadBuffer = pBuffer;
+    return pBuffer;
+}
+
+void Trace_record(uint16_t nameId, uint8_t phase, uint32_t arg)
+{
+    struct TraceBuffer *pBuffer = pThreadBuffer;
+    if (pBuffer == NULL) {
+        if (isUntraced || (pBuffer = claimBuffer()) == NULL) {
+            return;
+        }
+    }
+    uint32_t head = atomic_load_explicit(&pBuffer->head, memory_order_relaxed);
+    traceEvent_t *pEvent = &pBuffer->events[head & TRACE_BUFFER_MASK];
+    pEvent->timestampNs = getMonotonicTimeInNs();
+    pEvent->nameId = nameId;
+    pEvent->phase = phase;
+    pEvent->arg = arg;
+    // Publishes the event to the dump
+    atomic_store_explicit(&pBuffer->head, head + 1, memory_order_release);
+}
+
+// Copy out the events of a buffer, oldest first. The owner keeps writing,
+// so anything it may have overwritten during the copy is dropped.
+static uint32_t copyEvents(struct TraceBuffer *pBuffer, traceEvent_t *pEvents)
+{
+    uint32_t head = atomic_load_explicit(&pBuffer->head, memory_order_acquire);
+    uint32_t count = head < TRACE_BUFFER_EVENTS ? head : TRACE_BUFFER_EVENTS;
+    uint32_t first = head - count;
+    for (uint32_t i = 0; i < count; i++) {
+        pEvents[i] = pBuffer->events[(first + i) & TRACE_BUFFER_MASK];
+    }
+
+    atomic_thread_fence(memory_order_acquire);
+    uint32_t newHead = atomic_load_explicit(&pBuffer->head, memory_order_relaxed);
+    // Slots of events before this were reused (or are being written)
+    uint32_t firstIntact = newHead - TRACE_BUFFER_EVENTS + 1;
+    if (newHead >= TRACE_BUFFER_EVENTS && (int32_t) (firstIntact - first) > 0) {
+        uint32_t lost = firstIntact - first;
+        if (lost >= count) {
+            return 0;
+        }
+        memmove(pEvents, &pEvents[lost], (count - lost) * sizeof(*pEvents));
+        count -= lost;
+    }
+    return count;
+}
+
+int Trace_dump(const char *path)
+{
+    if (path == NULL) {
+        path = TRACE_DEFAULT_PATH;
+    }
+    FILE *pFile = fopen(path, "wb");
+    if (pFile == NULL) {
+        printf("ERROR: Unable to open trace file %s\n", path);
+        return -1;
+    }
+
+    int threads = atomic_load(&numBuffers);
+    if (threads > TRACE_MAX_THREADS) {
+        threads = TRACE_MAX_THREADS;
+    }
+    pthread_mutex_lock(&namesMutex);
+    uint32_t header[3] = {TRACE_FILE_VERSION, numNames, threads};
+    fwrite(TRACE_FILE_MAGIC, 1, strlen(TRACE_FILE_MAGIC), pFile);
+    fwrite(header, sizeof(header), 1, pFile);
+    for (int i = 1; i <= numNames; i++) {
+        uint16_t length = strlen(names[i]);
+        fwrite(&length, sizeof(length), 1, pFile);
+        fwrite(names[i], 1, length, pFile);
+    }
+    pthread_mutex_unlock(&namesMutex);
+
+    // Only the worker dumps, so one copy buffer is enough
+    static traceEvent_t events[TRACE_BUFFER_EVENTS];
+    int totalEvents = 0;
+    for (int i = 0; i < threads; i++) {
+        struct TraceBuffer *pBuffer = &buffers[i];
+        uint32_t count = copyEvents(pBuffer, events);
+        int32_t tid = pBuffer->tid;
+        fwrite(&tid, sizeof(tid), 1, pFile);
+        fwrite(pBuffer->threadName, 1, TRACE_THREAD_NAME_LEN, pFile);
+        fwrite(&count, sizeof(count), 1, pFile);
+        fwrite(events, sizeof(*events), count, pFile);
+        totalEvents += count;
+    }
+
+    if (fclose(pFile) != 0) {
+        printf("ERROR: Unable to write trace file %s\n", path);
+        return -1;
+    }
+    printf("Trace: %d events from %d threads to %s\n", totalEvents, threads, path);
+    return totalEvents;
+}
+
+// Runs on the worker
+static void dumpToDefaultPath(void *pContext)
+{
+    (void) pContext;
+    Trace_dump(NULL);
+}
+
+// Runs on the reactor when SIGUSR1 arrives. Signals sent before the dump
+// is written all land in the one dump.
+static void onDumpSignal(int fd, uint32_t events, void *pContext)
+{
+    (void) events;
+    (void) pContext;
+    struct signalfd_siginfo info;
+    bool isSignalled = false;
+    while (read(fd, &info, sizeof(info)) == sizeof(info)) {
+        isSignalled = true;
+    }
+    if (isSignalled && !Worker_post(dumpToDefaultPath, NULL, 0)) {
+        printf("ERROR: Trace dump dropped, worker busy\n");
+    }
+}
+
+// init and cleanup functions
+void Trace_init(void)
+{
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    // Threads inherit the mask, so SIGUSR1 only ever reaches the signalfd
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    signalFd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signalFd < 0) {
+        perror("ERROR: Unable to create trace signalfd");
+        exit(EXIT_FAILURE);
+    }
+    Reactor_addFd("trace dump", signalFd, EPOLLIN, onDumpSignal, NULL);
+}
+
+void Trace_cleanup(void)
+{
+    Reactor_removeFd(signalFd);
+    close(signalFd);
+    signalFd = -1;
+}
@@ -0,0 +1,16 @@
+// Host stand-in for the TI pru_cfg.h, just what the firmware touches
+
+#ifndef _PRU_CFG_H_
+#define _PRU_CFG_H_
+
+#include <stdint.h>
+
+typedef struct {
+    struct {
+        uint32_t STANDBY_INIT;
+    } SYSCFG_bit;
+} pruCfg;
+
+extern volatile pruCfg CT_CFG;
+
+#endif
@@ -0,0 +1,18 @@
+// Host stand-in for the TI pru_ctrl.h, just what the firmware touches
+// CYCLE is advanced by the simulator while CTR_EN is set.
+
+#ifndef _PRU_CTRL_H_
+#define _PRU_CTRL_H_
+
+#include <stdint.h>
+
+typedef struct {
+    struct {
+        uint32_t CTR_EN;
+    } CTRL_bit;
+    uint32_t CYCLE;
+} pruCtrl;
+
+extern volatile pruCtrl PRU0_CTRL;
+
+#endif
@@ -0,0 +1,99 @@
+// Simulator for running the PRU firmware on a Linux host
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pruHostSim.h"
+#include "pru_cfg.h"
+#include "pru_ctrl.h"
+#include "sharedDataStruct.h"
+
+// The layout ARM and PRU share must fit in the PRU shared RAM
+_Static_assert(sizeof(sharedMemStruct_t) <= PRU_SIM_SHARED_RAM_LEN,
+    "sharedMemStruct_t does not fit in PRU shared RAM");
+
+#define MAX_EDGES (MAX_STR_LEN * 24 * 2 + 16)
+
+volatile uint32_t __R30;
+volatile uint32_t __R31;
+_Alignas(32) uint8_t pruSim_sharedRam[PRU_SIM_SHARED_RAM_LEN];
+
+volatile pruCfg CT_CFG;
+volatile pruCtrl PRU0_CTRL;
+
+static uint64_t cycles;
+static uint32_t lastR30;
+static pruSimEdge_t edges[MAX_EDGES];
+static int edgeCount;
+static int armEvents;
+
+void pruSim_reset(void)
+{
+    __R30 = 0;
+    // Inputs idle high, as the cape's pull-ups hold them
+    __R31 = ~0u;
+    lastR30 = 0;
+    memset(pruSim_sharedRam, 0, sizeof(pruSim_sharedRam));
+    memset((void *) &CT_CFG, 0, sizeof(CT_CFG));
+    memset((void *) &PRU0_CTRL, 0, sizeof(PRU0_CTRL));
+    cycles = 0;
+    edgeCount = 0;
+    armEvents = 0;
+}
+
+void pruSim_advanceCycles(uint64_t count)
+{
+    cycles += count;
+    if (PRU0_CTRL.CTRL_bit.CTR_EN) {
+        // The real counter stops at its maximum rather than wrapping
+        uint64_t counter = (uint64_t) PRU0_CTRL.CYCLE + count;
+        PRU0_CTRL.CYCLE = counter > UINT32_MAX ? UINT32_MAX : counter;
+    }
+}
+
+void pruSim_delayCycles(uint32_t count)
+{
+    if (__R30 != lastR30) {
+        if (edgeCount == MAX_EDGES) {
+            fprintf(stderr, "pruSim: edge buffer full\n");
+            exit(EXIT_FAILURE);
+        }
+        edges[edgeCount].cycle = cycles;
+        edges[edgeCount].r30 = __R30;
+        edgeCount++;
+        lastR30 = __R30;
+    }
+    // One cycle for the __R30 write, then the delay itself
+    pruSim_advanceCycles((uint64_t) count + 1);
+}
+
+void pruSim_signalArm(void)
+{
+    armEvents++;
+}
+
+int pruSim_getArmEvents(void)
+{
+    return armEvents;
+}
+
+uint64_t pruSim_getCycles(void)
+{
+    return cycles;
+}
+
+int pruSim_getEdgeCount(void)
+{
+    return edgeCount;
+}
+
+const pruSimEdge_t *pruSim_getEdges(void)
+{
+    return edges;
+}
+
+void pruSim_clearEdges(void)
+{
+    edgeCount = 0;
+}
@@ -0,0 +1,47 @@
+// Simulator for running the PRU firmware on a Linux host
+// Stands in for __R30/__R31 and __delay_cycles(), counts PRU cycles, and
+// records every change of __R30 with the cycle it happened on.
+//
+// Timing model: each __delay_cycles(n) costs n cycles plus one for the
+// __R30 write just before it. Other instructions are free, so loop and
+// branch overhead of the real compiled code (a cycle or two) is not seen.
+
+#ifndef _PRU_HOST_SIM_H_
+#define _PRU_HOST_SIM_H_
+
+#include <stdint.h>
+
+#define PRU_SIM_NS_PER_CYCLE 5
+// Size of the PRU shared RAM the firmware's struct lives in
+#define PRU_SIM_SHARED_RAM_LEN 0x3000
+
+extern volatile uint32_t __R30;
+extern volatile uint32_t __R31;
+extern uint8_t pruSim_sharedRam[PRU_SIM_SHARED_RAM_LEN];
+
+void pruSim_delayCycles(uint32_t cycles);
+#define __delay_cycles(cycles) pruSim_delayCycles(cycles)
+
+typedef struct {
+    uint64_t cycle;
+    uint32_t r30;
+} pruSimEdge_t;
+
+// Clear registers, shared RAM, the cycle count, raised events and recorded edges
+void pruSim_reset(void);
+// Cycles since reset
+uint64_t pruSim_getCycles(void);
+// Let time pass without touching any pins (e.g. the PRU spinning idle)
+void pruSim_advanceCycles(uint64_t cycles);
+
+// Stands in for the firmware raising its event towards ARM
+void pruSim_signalArm(void);
+// Events raised since reset
+int pruSim_getArmEvents(void);
+
+// Edges recorded since the last clear
+int pruSim_getEdgeCount(void);
+const pruSimEdge_t *pruSim_getEdges(void);
+void pruSim_clearEdges(void);
+
+#endif
@@ -0,0 +1,328 @@
+// Host-side check of the PRU LED firmware
+// Builds sharedMem-PRU.c against the simulator in pruHostSim.c, drives it
+// through shared RAM the way ARM does, and checks the recorded pin
+// transitions against the WS2812 timing windows. Also decodes the bits
+// back into colours, and reports bit rate and frame time per strip length.
+// Joystick debouncing is checked by driving __R31.
+// Exits non-zero if anything is off, so it can gate firmware changes.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "pruHostSim.h"
+
+// Pull the firmware in whole; its main() never returns, so rename it
+#define main pruFirmwareMain
+#include "../sharedMem-PRU.c"
+#undef main
+
+// WS2812 windows, in ns. Datasheets vary between WS2812 and WS2812B parts,
+// these are the ranges both accept.
+#define T0H_MIN_NS      200
+#define T0H_MAX_NS      500
+#define T1H_MIN_NS      550
+#define T1H_MAX_NS      1000
+#define TLOW_MIN_NS     450
+#define TLOW_MAX_NS     5000    // Longer lows risk being taken as a reset
+#define RESET_MIN_NS    50000
+
+#define CYCLES_TO_NS(cycles) ((cycles) * PRU_SIM_NS_PER_CYCLE)
+
+static int failures = 0;
+
+#define CHECK(condition, ...) \
+    do { \
+        if (!(condition)) { \
+            printf("FAIL: " __VA_ARGS__); \
+            printf("\n"); \
+            failures++; \
+        } \
+    } while (0)
+
+typedef struct {
+    uint32_t colour[MAX_STR_LEN];
+    int numLeds;
+    uint64_t frameCycles;
+    double bitsPerSecond;
+} decodedFrame_t;
+
+// Publish a frame the same way ledDriver.c does
+static void commitFrame(const uint32_t *pColours, int length)
+{
+    uint32_t nextSeq = pSharedMemStruct->frameSeq + 1;
+    pSharedMemStruct->numLeds = length;
+    for (int i = 0; i < length; i++) {
+        pSharedMemStruct->frame[FRAME_BUFFER_FOR_SEQ(nextSeq)][i] = pColours[i];
+    }
+    pSharedMemStruct->frameSeq = nextSeq;
+}
+
+// Walk the recorded edges from one write_LED() call, check every bit and the
+// reset around them, and rebuild the colours that were sent.
+// startCycle and endCycle bound the write_LED() call.
+static bool decodeFrame(uint64_t startCycle, uint64_t endCycle, decodedFrame_t *pFrame)
+{
+    const pruSimEdge_t *pEdges = pruSim_getEdges();
+    int edgeCount = pruSim_getEdgeCount();
+    uint32_t mask = 0x1 << DATA_PIN;
+    int violations = 0;
+    int bits = 0;
+
+    pFrame->numLeds = 0;
+    pFrame->frameCycles = endCycle - startCycle;
+    if (edgeCount == 0 || edgeCount % 2 != 0) {
+        printf("FAIL: expected rising/falling pairs, got %d edges\n", edgeCount);
+        return false;
+    }
+
+    uint64_t leadingLow = pEdges[0].cycle - startCycle;
+    CHECK(CYCLES_TO_NS(leadingLow) >= RESET_MIN_NS,
+        "reset before frame %llu ns", (unsigned long long) CYCLES_TO_NS(leadingLow));
+
+    for (int i = 0; i < edgeCount; i += 2) {
+        const pruSimEdge_t *pRise = &pEdges[i];
+        const pruSimEdge_t *pFall = &pEdges[i + 1];
+        if (!(pRise->r30 & mask) || (pFall->r30 & mask)) {
+            printf("FAIL: edge %d is not a high pulse on pin %d\n", i, DATA_PIN);
+            return false;
+        }
+
+        uint64_t highNs = CYCLES_TO_NS(pFall->cycle - pRise->cycle);
+        bool isLast = i + 2 >= edgeCount;
+        uint64_t lowEnd = isLast ? endCycle : pEdges[i + 2].cycle;
+        uint64_t lowNs = CYCLES_TO_NS(lowEnd - pFall->cycle);
+
+        bool isOne = highNs >= T1H_MIN_NS;
+        bool isHighOk = isOne
+            ? highNs <= T1H_MAX_NS
+            : highNs >= T0H_MIN_NS && highNs <= T0H_MAX_NS;
+        // The last bit's low runs straight into the reset
+        bool isLowOk = isLast
+            ? lowNs >= RESET_MIN_NS
+            : lowNs >= TLOW_MIN_NS && lowNs <= TLOW_MAX_NS;
+        if ((!isHighOk || !isLowOk) && violations++ < 5) {
+            printf("FAIL: bit %d high %llu ns low %llu ns\n", bits,
+                (unsigned long long) highNs, (unsigned long long) lowNs);
+        }
+
+        int led = bits / 24;
+        if (led < MAX_STR_LEN) {
+            if (bits % 24 == 0) {
+                pFrame->colour[led] = 0;
+            }
+            pFrame->colour[led] = (pFrame->colour[led] << 1) | isOne;
+        }
+        bits++;
+    }
+
+    failures += violations;
+    CHECK(bits % 24 == 0, "%d bits is not a whole number of LEDs", bits);
+    pFrame->numLeds = bits / 24;
+
+    // Bit rate over the data itself, first rising edge to last rising edge
+    uint64_t dataCycles = pEdges[edgeCount - 2].cycle - pEdges[0].cycle;
+    pFrame->bitsPerSecond = bits > 1
+        ? (bits - 1) * 1e9 / CYCLES_TO_NS((double) dataCycles)
+        : 0;
+    return violations == 0;
+}
+
+// Run one pass of the firmware loop and decode whatever it streamed.
+// Returns false if nothing was sent.
+static bool serviceAndDecode(decodedFrame_t *pFrame)
+{
+    pruSim_clearEdges();
+    uint64_t startCycle = pruSim_getCycles();
+    bool isSent = service_LED();
+    if (!isSent) {
+        CHECK(pruSim_getEdgeCount() == 0, "pin toggled without a frame being sent");
+        return false;
+    }
+    decodeFrame(startCycle, pruSim_getCycles(), pFrame);
+    return true;
+}
+
+static void checkColours(const decodedFrame_t *pFrame, const uint32_t *pExpected, int length)
+{
+    CHECK(pFrame->numLeds == length, "sent %d LEDs, expected %d", pFrame->numLeds, length);
+    int mismatches = 0;
+    for (int i = 0; i < length && i < pFrame->numLeds; i++) {
+        if ((pExpected[i] & 0xFFFFFF) != pFrame->colour[i] && mismatches++ < 5) {
+            printf("FAIL: LED %d sent %06x, expected %06x\n",
+                i, pFrame->colour[i], pExpected[i] & 0xFFFFFF);
+        }
+    }
+    failures += mismatches;
+}
+
+static void checkBoot(void)
+{
+    pruSim_reset();
+    pSharedMemStruct->numLeds = 14;
+    initialize();
+
+    // Boot frame is the latched blue strip
+    uint32_t expected[14];
+    for (int i = 0; i < 14; i++) {
+        expected[i] = 0x00000f;
+    }
+    decodedFrame_t frame;
+    decodeFrame(0, pruSim_getCycles(), &frame);
+    checkColours(&frame, expected, 14);
+    CHECK(pSharedMemStruct->pruCaps & PRU_CAP_ANIMATION, "animation capability not set");
+    CHECK(pSharedMemStruct->framesSent == 1, "boot frame not counted");
+}
+
+static void checkStripLength(int length)
+{
+    static uint32_t colours[MAX_STR_LEN];
+    static decodedFrame_t frame;
+    static uint32_t seed = 12345;
+
+    for (int i = 0; i < length; i++) {
+        seed = seed * 1103515245 + 12345;
+        colours[i] = (seed >> 8) & 0xFFFFFF;
+    }
+    // Make sure both all-zero and all-one bytes go out too
+    colours[0] = 0x000000;
+    colours[length - 1] = 0xFFFFFF;
+
+    commitFrame(colours, length);
+    if (!serviceAndDecode(&frame)) {
+        CHECK(false, "%d LED frame was not sent", length);
+        return;
+    }
+    checkColours(&frame, colours, length);
+
+    uint64_t frameNs = CYCLES_TO_NS(frame.frameCycles);
+    CHECK(pSharedMemStruct->frameTxCycles == frame.frameCycles,
+        "firmware measured %u cycles, simulator %llu",
+        pSharedMemStruct->frameTxCycles, (unsigned long long) frame.frameCycles);
+    printf("%3d LEDs: %.0f bits/s, frame %llu us (incl. resets), max %llu fps\n",
+        length, frame.bitsPerSecond, (unsigned long long) frameNs / 1000,
+        (unsigned long long) (1000000000ULL / frameNs));
+}
+
+static void checkNoResend(void)
+{
+    decodedFrame_t frame;
+    uint32_t sentBefore = pSharedMemStruct->framesSent;
+    CHECK(!serviceAndDecode(&frame), "unchanged frame was sent again");
+    CHECK(pSharedMemStruct->framesSent == sentBefore, "framesSent moved without a frame");
+}
+
+static void checkDroppedFrames(void)
+{
+    uint32_t colours[14];
+    decodedFrame_t frame;
+    uint32_t droppedBefore = pSharedMemStruct->framesDropped;
+
+    // Three commits between passes: only the newest goes out
+    for (int round = 1; round <= 3; round++) {
+        for (int i = 0; i < 14; i++) {
+            colours[i] = round * 0x010101;
+        }
+        commitFrame(colours, 14);
+    }
+    CHECK(serviceAndDecode(&frame), "newest frame was not sent");
+    checkColours(&frame, colours, 14);
+    CHECK(pSharedMemStruct->framesDropped - droppedBefore == 2,
+        "%u frames dropped, expected 2", pSharedMemStruct->framesDropped - droppedBefore);
+}
+
+static void checkBlinkAnimation(void)
+{
+    uint32_t colours[14];
+    decodedFrame_t frame;
+    for (int i = 0; i < 14; i++) {
+        colours[i] = 0x000010;
+    }
+    commitFrame(colours, 14);
+    service_LED();
+
+    volatile ledAnimationSlot_t *pSlot = &pSharedMemStruct->animations[0];
+    pSlot->animation = (ledAnimation_t) {
+        .type = LED_ANIM_BLINK,
+        .repeat = 1,
+        .firstLed = 2,
+        .lastLed = 2,
+        .onMs = 100,
+        .offMs = 100,
+        .colour = 0x00ff00,
+    };
+    pSlot->startSeq = pSlot->startSeq + 1;
+
+    CHECK(serviceAndDecode(&frame), "blink did not start");
+    CHECK(frame.colour[2] == 0x00ff00, "blink on sent %06x", frame.colour[2]);
+    CHECK(frame.colour[1] == 0x000010, "blink drew outside its range");
+
+    pruSim_advanceCycles(150ULL * CYCLES_PER_MS);
+    CHECK(serviceAndDecode(&frame), "blink did not turn off");
+    CHECK(frame.colour[2] == 0, "blink off sent %06x", frame.colour[2]);
+
+    pruSim_advanceCycles(100ULL * CYCLES_PER_MS);
+    CHECK(serviceAndDecode(&frame), "blink did not finish");
+    CHECK(frame.colour[2] == 0x000010, "LED not restored after blink, sent %06x", frame.colour[2]);
+    CHECK(pSlot->doneSeq == pSlot->startSeq, "finished blink not reported");
+}
+
+static void checkJoystick(void)
+{
+    CHECK(pSharedMemStruct->pruCaps & PRU_CAP_JOYSTICK, "joystick capability not set");
+    CHECK(pSharedMemStruct->pruCaps & PRU_CAP_JOYSTICK_EVENT, "joystick event capability not set");
+    uint32_t edgesBefore = PRU_JOYSTICK_EDGES(pSharedMemStruct->joystickState);
+    int eventsBefore = pruSim_getArmEvents();
+
+    // A bounce shorter than the debounce time is ignored
+    __R31 &= ~JOYSTICK_RIGHT_MASK;
+    service_LED();
+    pruSim_advanceCycles((DEBOUNCE_MS - 2) * CYCLES_PER_MS);
+    __R31 |= JOYSTICK_RIGHT_MASK;
+    service_LED();
+    pruSim_advanceCycles(DEBOUNCE_MS * CYCLES_PER_MS);
+    service_LED();
+    CHECK(pSharedMemStruct->joystickState == (uint32_t) (edgesBefore << 16),
+        "bounce was published: %08x", pSharedMemStruct->joystickState);
+    CHECK(pruSim_getArmEvents() == eventsBefore, "bounce signalled ARM");
+
+    // A held press shows up once it has been stable long enough
+    __R31 &= ~JOYSTICK_DOWN_MASK;
+    service_LED();
+    pruSim_advanceCycles(DEBOUNCE_MS * CYCLES_PER_MS);
+    service_LED();
+    uint32_t state = pSharedMemStruct->joystickState;
+    CHECK(PRU_JOYSTICK_PRESSED(state) == PRU_JOYSTICK_DOWN, "down not pressed: %08x", state);
+    CHECK(PRU_JOYSTICK_LAST_CHANGE(state) == PRU_JOYSTICK_DOWN, "down not the last change: %08x", state);
+    CHECK(PRU_JOYSTICK_EDGES(state) == edgesBefore + 1, "press not counted: %08x", state);
+    CHECK(pruSim_getArmEvents() == eventsBefore + 1, "press did not signal ARM once");
+
+    __R31 |= JOYSTICK_DOWN_MASK;
+    service_LED();
+    pruSim_advanceCycles(DEBOUNCE_MS * CYCLES_PER_MS);
+    service_LED();
+    state = pSharedMemStruct->joystickState;
+    CHECK(PRU_JOYSTICK_PRESSED(state) == 0, "down not released: %08x", state);
+    CHECK(PRU_JOYSTICK_EDGES(state) == edgesBefore + 2, "release not counted: %08x", state);
+    CHECK(pruSim_getArmEvents() == eventsBefore + 2, "release did not signal ARM once");
+}
+
+int main(void)
+{
+    checkBoot();
+    checkStripLength(14);
+    checkStripLength(88);
+    checkStripLength(MAX_STR_LEN);
+    checkNoResend();
+    checkDroppedFrames();
+    checkBlinkAnimation();
+    checkJoystick();
+
+    if (failures > 0) {
+        printf("PRU timing check: %d failures\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("PRU timing check passed\n");
+    return EXIT_SUCCESS;
+}
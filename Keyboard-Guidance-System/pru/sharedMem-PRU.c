@@ -1,15 +1,22 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <pru_cfg.h>
+#include <pru_ctrl.h>
+#ifdef PRU_HOST_SIM
+// Host build: registers and __delay_cycles come from the simulator
+#include "pruHostSim.h"
+#else
 #include "resource_table_empty.h"
+#endif
 #include "sharedDataStruct.h"
 
-#define STR_LEN         14       // # LEDs in our string
 #define oneCyclesOn     700/5   // Stay on 700ns
 #define oneCyclesOff    800/5
 #define zeroCyclesOn    350/5
 #define zeroCyclesOff   600/5
 #define resetCycles     60000/5 // Must be at least 50u, use 60u
+#define CYCLES_PER_MS   200000  // PRU runs at 200MHz
+#define DEBOUNCE_MS     5       // Input must hold this long to count
 
 // #define STR_LEN         14       // # LEDs in our string
 // #define oneCyclesOn     900/5   // Stay on 700ns
@@ -24,42 +31,318 @@
 
 // GPIO Configuration
 // ----------------------------------------------------------
+#ifndef PRU_HOST_SIM
 volatile register uint32_t __R30;   // output GPIO register
 volatile register uint32_t __R31;   // input GPIO register
+#endif
 
 // GPIO Output: P8_12 = pru0_pru_r30_14 
 //   = LEDDP2 (Turn on/off right 14-seg digit) on Zen cape
 #define DIGIT_ON_OFF_MASK (1 << 14)
 // GPIO Input: P8_15 = pru0_pru_r31_15 
 //   = JSRT (Joystick Right) on Zen Cape
+#define JOYSTICK_RIGHT_MASK (1 << 15)
+// GPIO Input: P8_16 = pru0_pru_r31_14
+//   = JSDN (Joystick Down) on Zen Cape
+#define JOYSTICK_DOWN_MASK (1 << 14)
+
+// Raise PRU_ARM_SYSEVT: bit 5 strobes an event, the low bits pick one of
+// system events 16-31
+#ifdef PRU_HOST_SIM
+#define SIGNAL_ARM() pruSim_signalArm()
+#else
+#define SIGNAL_ARM() (__R31 = (1 << 5) | (PRU_ARM_SYSEVT - 16))
+#endif
 
 
 
 // Shared Memory Configuration
 // -----------------------------------------------------------
-#define THIS_PRU_DRAM       0x00000         // Address of DRAM
-#define OFFSET              0x200           // Skip 0x100 for Stack, 0x100 for Heap (from makefile)
-#define THIS_PRU_DRAM_USABLE (THIS_PRU_DRAM + OFFSET)
+// The struct lives in the 12kB PRU shared RAM: full-length frames do not fit
+// in this PRU's 8kB DRAM next to our own stack, heap and globals.
+#define PRU_SHARED_RAM      0x10000         // Address of shared RAM
+
+// This works for both PRU0 and PRU1 as both map shared RAM to 0x0010000
+#ifdef PRU_HOST_SIM
+volatile sharedMemStruct_t *pSharedMemStruct = (volatile void *)pruSim_sharedRam;
+#else
+volatile sharedMemStruct_t *pSharedMemStruct = (volatile void *)PRU_SHARED_RAM;
+#endif
+
+// Last frame latched from shared memory, and the strip length it was for
+uint32_t latchedFrame[MAX_STR_LEN];
+uint32_t latchedSeq;
+uint32_t numLeds;
+// Frame actually streamed: the latched frame with any running animations on
+// top. write_LED() only reads this copy, so an ARM commit in the middle of a
+// transmit cannot tear the frame.
+uint32_t outFrame[MAX_STR_LEN];
+
+// Animations copied out of shared memory, and when each one started
+ledAnimation_t activeAnimation[NUM_ANIMATION_SLOTS];
+uint32_t activeSeq[NUM_ANIMATION_SLOTS];
+uint32_t animationStartMs[NUM_ANIMATION_SLOTS];
+bool isAnimationRunning[NUM_ANIMATION_SLOTS];
+// What each running animation looks like this pass: its colour, and for
+// sweep/chase the one or two positions lit (others in range are dark)
+uint32_t animationColour[NUM_ANIMATION_SLOTS];
+uint32_t animationDotA[NUM_ANIMATION_SLOTS];
+uint32_t animationDotB[NUM_ANIMATION_SLOTS];
+
+// Milliseconds since boot, kept from the PRU cycle counter
+uint32_t nowMs;
+uint32_t leftoverCycles;
+
+// Joystick debounce: the last raw reading and when it last changed, and
+// what has been published to ARM
+uint32_t joystickRaw;
+uint32_t joystickRawSinceMs;
+uint32_t joystickPressed;
+uint32_t joystickEdges;
 
-// This works for both PRU0 and PRU1 as both map their own memory to 0x0000000
-volatile sharedMemStruct_t *pSharedMemStruct = (volatile void *)THIS_PRU_DRAM_USABLE;
+// The cycle counter stops at 0xFFFFFFFF rather than wrapping, so fold it
+// into nowMs and restart it every time through the main loop.
+void update_clock()
+{
+    leftoverCycles += PRU0_CTRL.CYCLE;
+    PRU0_CTRL.CTRL_bit.CTR_EN = 0;
+    PRU0_CTRL.CYCLE = 0;
+    PRU0_CTRL.CTRL_bit.CTR_EN = 1;
+    while (leftoverCycles >= CYCLES_PER_MS) {
+        leftoverCycles -= CYCLES_PER_MS;
+        nowMs++;
+    }
+}
+
+// Strip length as set by ARM, kept in range
+uint32_t read_num_leds()
+{
+    uint32_t length = pSharedMemStruct->numLeds;
+    if (length == 0 || length > MAX_STR_LEN) {
+        length = MAX_STR_LEN;
+    }
+    return length;
+}
 
 void initialize_LED()
 {
-    for (int i = 0; i < STR_LEN; i++) {
+    numLeds = read_num_leds();
+    for (int i = 0; i < numLeds; i++) {
  
         // RGB
-        pSharedMemStruct->colour[i] = 0x00000f; // Blue
+        latchedFrame[i] = 0x00000f; // Blue
+    }
+    // Anything ARM committed before we booted is stale
+    latchedSeq = pSharedMemStruct->frameSeq;
+
+    for (int i = 0; i < NUM_ANIMATION_SLOTS; i++) {
+        volatile ledAnimationSlot_t *pSlot = &pSharedMemStruct->animations[i];
+        activeSeq[i] = pSlot->startSeq;
+        pSlot->doneSeq = pSlot->startSeq;
+        isAnimationRunning[i] = false;
+    }
+}
+
+// Joystick pins read 0 while pressed
+uint32_t read_joystick_pins()
+{
+    uint32_t pressed = 0;
+    if (!(__R31 & JOYSTICK_RIGHT_MASK)) {
+        pressed |= PRU_JOYSTICK_RIGHT;
+    }
+    if (!(__R31 & JOYSTICK_DOWN_MASK)) {
+        pressed |= PRU_JOYSTICK_DOWN;
+    }
+    return pressed;
+}
+
+// Publish the pressed bitmap once the pins have held steady for DEBOUNCE_MS.
+// Everything goes out in one store so ARM never sees a half update, then
+// ARM is signalled so it need not poll for edges.
+void sample_joystick()
+{
+    uint32_t raw = read_joystick_pins();
+    if (raw != joystickRaw) {
+        joystickRaw = raw;
+        joystickRawSinceMs = nowMs;
+        return;
+    }
+    if (raw == joystickPressed || nowMs - joystickRawSinceMs < DEBOUNCE_MS) {
+        return;
+    }
+    uint32_t changed = raw ^ joystickPressed;
+    joystickPressed = raw;
+    joystickEdges++;
+    pSharedMemStruct->joystickState = (joystickEdges << 16) | (changed << 8) | joystickPressed;
+    SIGNAL_ARM();
+}
+
+// Copy the newest committed frame if ARM has published one since the last latch.
+// Returns true if a new frame was latched.
+bool latch_frame()
+{
+    uint32_t seq = pSharedMemStruct->frameSeq;
+    if (seq == latchedSeq) {
+        return false;
+    }
+
+    while (true) {
+        volatile uint32_t *pFrame = pSharedMemStruct->frame[FRAME_BUFFER_FOR_SEQ(seq)];
+        numLeds = read_num_leds();
+        for (int i = 0; i < numLeds; i++) {
+            latchedFrame[i] = pFrame[i];
+        }
+        // If ARM committed again while we copied, it may be reusing the
+        // buffer we just read; retry with the newer frame instead.
+        uint32_t newSeq = pSharedMemStruct->frameSeq;
+        if (newSeq == seq) {
+            break;
+        }
+        seq = newSeq;
     }
+
+    pSharedMemStruct->framesDropped += seq - latchedSeq - 1;
+    latchedSeq = seq;
+    return true;
+}
+
+// Pick up any animation ARM has (re)started since we last looked
+void latch_animations()
+{
+    for (int i = 0; i < NUM_ANIMATION_SLOTS; i++) {
+        volatile ledAnimationSlot_t *pSlot = &pSharedMemStruct->animations[i];
+        uint32_t seq = pSlot->startSeq;
+        if (seq == activeSeq[i]) {
+            continue;
+        }
+        // Same retry as latch_frame() in case ARM rewrites the slot mid-copy
+        while (true) {
+            activeAnimation[i] = pSlot->animation;
+            uint32_t newSeq = pSlot->startSeq;
+            if (newSeq == seq) {
+                break;
+            }
+            seq = newSeq;
+        }
+        activeSeq[i] = seq;
+        animationStartMs[i] = nowMs;
+        isAnimationRunning[i] = true;
+    }
+}
+
+// Scale each GRB byte of a colour by level/256
+uint32_t scale_colour(uint32_t colour, uint32_t level)
+{
+    uint32_t g = (((colour >> 16) & 0xFF) * level) >> 8;
+    uint32_t r = (((colour >> 8) & 0xFF) * level) >> 8;
+    uint32_t b = ((colour & 0xFF) * level) >> 8;
+    return (g << 16) | (r << 8) | b;
+}
+
+// Work out how an animation looks at elapsedMs into it.
+// Returns false once it has finished.
+bool prepare_animation(int slot, uint32_t elapsedMs)
+{
+    ledAnimation_t *pAnim = &activeAnimation[slot];
+    uint32_t first = pAnim->firstLed;
+    uint32_t last = pAnim->lastLed;
+    uint32_t span = last - first + 1;
+    uint32_t onMs = pAnim->onMs ? pAnim->onMs : 1;
+
+    if (last >= numLeds || first > last) {
+        return false;
+    }
+
+    // Sweep and chase light only their dots; blink and fade light every LED
+    animationDotA[slot] = first;
+    animationDotB[slot] = last;
+
+    switch (pAnim->type) {
+        case LED_ANIM_BLINK: {
+            uint32_t period = onMs + pAnim->offMs;
+            if (elapsedMs / period >= pAnim->repeat) {
+                return false;
+            }
+            animationColour[slot] = (elapsedMs % period) < onMs ? pAnim->colour : 0;
+            return true;
+        }
+        case LED_ANIM_SWEEP:
+        case LED_ANIM_CHASE: {
+            uint32_t step = elapsedMs / onMs;
+            if (step / span >= pAnim->repeat) {
+                return false;
+            }
+            uint32_t pos = step % span;
+            animationColour[slot] = pAnim->colour;
+            animationDotA[slot] = first + pos;
+            animationDotB[slot] = pAnim->type == LED_ANIM_SWEEP ? last - pos : first + pos;
+            return true;
+        }
+        case LED_ANIM_FADE: {
+            if (elapsedMs / onMs >= pAnim->repeat) {
+                return false;
+            }
+            // Triangle wave: up for the first half of the cycle, down for the second
+            uint32_t t = elapsedMs % onMs;
+            uint32_t half = onMs / 2 ? onMs / 2 : 1;
+            uint32_t level = t < half ? (t * 255) / half : ((onMs - t) * 255) / half;
+            animationColour[slot] = scale_colour(pAnim->colour, level);
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+// Colour of one LED under a running animation that covers it
+uint32_t animation_pixel(int slot, uint32_t led)
+{
+    uint8_t type = activeAnimation[slot].type;
+    if (type == LED_ANIM_SWEEP || type == LED_ANIM_CHASE) {
+        if (led != animationDotA[slot] && led != animationDotB[slot]) {
+            return 0;
+        }
+    }
+    return animationColour[slot];
+}
+
+// Build outFrame in place from the latched frame plus running animations.
+// Returns true if it differs from what is on the LEDs now.
+bool render_frame()
+{
+    for (int i = 0; i < NUM_ANIMATION_SLOTS; i++) {
+        if (isAnimationRunning[i] && !prepare_animation(i, nowMs - animationStartMs[i])) {
+            isAnimationRunning[i] = false;
+            pSharedMemStruct->animations[i].doneSeq = activeSeq[i];
+        }
+    }
+
+    bool isChanged = false;
+    for (uint32_t led = 0; led < numLeds; led++) {
+        uint32_t colour = latchedFrame[led];
+        // Later slots draw over earlier ones
+        for (int i = 0; i < NUM_ANIMATION_SLOTS; i++) {
+            if (isAnimationRunning[i]
+                    && led >= activeAnimation[i].firstLed
+                    && led <= activeAnimation[i].lastLed) {
+                colour = animation_pixel(i, led);
+            }
+        }
+        if (colour != outFrame[led]) {
+            outFrame[led] = colour;
+            isChanged = true;
+        }
+    }
+    return isChanged;
 }
 
 void write_LED()
 {
     __delay_cycles(resetCycles);
 
-        for(int j = 0; j < STR_LEN; j++) {
+        for(int j = 0; j < numLeds; j++) {
             for(int i = 23; i >= 0; i--) {
-                if(pSharedMemStruct->colour[j] & ((uint32_t)0x1 << i)) {
+                if(outFrame[j] & ((uint32_t)0x1 << i)) {
                     __R30 |= 0x1<<DATA_PIN;      // Set the GPIO pin to 1
                     __delay_cycles(oneCyclesOn-1);
                     __R30 &= ~(0x1<<DATA_PIN);   // Clear the GPIO pin
@@ -79,21 +362,57 @@ void write_LED()
 }
 
 
-void main(void)
-{   
+void initialize()
+{
     // Clear SYSCFG[STANDBY_INIT] to enable OCP master port
     CT_CFG.SYSCFG_bit.STANDBY_INIT = 0;
 
     // Initialize:
     pSharedMemStruct->isLedOn = true;
-
+    pSharedMemStruct->framesSent = 0;
+    pSharedMemStruct->framesDropped = 0;
 
     initialize_LED();
+    joystickRaw = read_joystick_pins();
+    joystickPressed = joystickRaw;
+    joystickEdges = 0;
+    pSharedMemStruct->joystickState = joystickPressed;
+    update_clock();
+    render_frame();
+    write_LED();
+    pSharedMemStruct->framesSent++;
+    pSharedMemStruct->pruCaps = PRU_CAP_ANIMATION | PRU_CAP_JOYSTICK | PRU_CAP_JOYSTICK_EVENT;
+}
+
+// One pass of the main loop. Returns true if a frame was streamed.
+bool service_LED()
+{
+    update_clock();
+    // Sampled once per pass: a long frame only slows the debounce down
+    sample_joystick();
+    latch_frame();
+    latch_animations();
+
+    // Only stream when the picture actually changed; the LEDs
+    // hold their colour on their own between updates.
+    if (!render_frame()) {
+        return false;
+    }
+    // update_clock() just restarted the counter, so it has room
+    uint32_t startCycles = PRU0_CTRL.CYCLE;
+    write_LED();
+    pSharedMemStruct->frameTxCycles = PRU0_CTRL.CYCLE - startCycles;
+    pSharedMemStruct->framesSent++;
+    return true;
+}
+
+void main(void)
+{   
+    initialize();
 
     while(true) {
-        write_LED();
+        service_LED();
 
         // __halt();
     }
 }
-
@@ -0,0 +1,175 @@
+// Watch the app's live counters (hal/statsPage.h) from another process
+// The page is mapped read only and sampled on a fixed clock: the app is
+// never asked for anything and never waits on the reader.
+//
+// Build on the host or the board:
+//   gcc -O2 -Wall -Ihal/include -o kgsStats tools/kgsStats.c -lrt
+// Usage:
+//   kgsStats [-i ms] [-n samples] [-f text] [-c]
+// Every -i ms (default 1000) prints each entry with text in its name:
+// counters with their rate over the interval, gauges as they are. With -c
+// it prints one CSV line per sample instead, for sampling fast (-i 1) into
+// a file. Stops after -n samples, or when the app exits.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#include "hal/statsPage.h"
+
+#define NS_PER_SECOND 1000000000LL
+#define NS_PER_MS 1000000LL
+
+static long long getMonotonicTimeInNs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * NS_PER_SECOND + now.tv_nsec;
+}
+
+static void printUsage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [-i ms] [-n samples] [-f text] [-c]\n", program);
+    exit(EXIT_FAILURE);
+}
+
+static const statsPage_t *openPage(void)
+{
+    int fd = shm_open(STATS_PAGE_NAME, O_RDONLY, 0);
+    if (fd < 0) {
+        perror("ERROR: Unable to open " STATS_PAGE_NAME " (is the app running?)");
+        exit(EXIT_FAILURE);
+    }
+    const statsPage_t *pPage = mmap(NULL, sizeof(statsPage_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (pPage == MAP_FAILED) {
+        perror("ERROR: Unable to map " STATS_PAGE_NAME);
+        exit(EXIT_FAILURE);
+    }
+    if (memcmp(pPage->magic, STATS_PAGE_MAGIC, sizeof(pPage->magic)) != 0
+            || pPage->version != STATS_PAGE_VERSION) {
+        fprintf(stderr, "ERROR: " STATS_PAGE_NAME " is not a version %d stats page\n", STATS_PAGE_VERSION);
+        exit(EXIT_FAILURE);
+    }
+    return pPage;
+}
+
+static void sleepUntil(long long deadlineNs)
+{
+    struct timespec deadline = {
+        .tv_sec = deadlineNs / NS_PER_SECOND,
+        .tv_nsec = deadlineNs % NS_PER_SECOND,
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {
+    }
+}
+
+static void printCsvHeader(const statsPage_t *pPage, uint32_t numEntries, const char *filter)
+{
+    printf("ms");
+    for (uint32_t i = 0; i < numEntries; i++) {
+        if (strstr(pPage->entries[i].name, filter) != NULL) {
+            printf(",%s", pPage->entries[i].name);
+        }
+    }
+    printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+    long long intervalMs = 1000;
+    long long maxSamples = -1;
+    const char *filter = "";
+    bool isCsv = false;
+    int option;
+    while ((option = getopt(argc, argv, "i:n:f:c")) != -1) {
+        switch (option) {
+        case 'i':
+            intervalMs = atoll(optarg);
+            break;
+        case 'n':
+            maxSamples = atoll(optarg);
+            break;
+        case 'f':
+            filter = optarg;
+            break;
+        case 'c':
+            isCsv = true;
+            break;
+        default:
+            printUsage(argv[0]);
+        }
+    }
+    if (intervalMs <= 0 || optind != argc) {
+        printUsage(argv[0]);
+    }
+
+    const statsPage_t *pPage = openPage();
+    uint64_t values[STATS_MAX_ENTRIES];
+    uint64_t lastValues[STATS_MAX_ENTRIES] = {0};
+    uint32_t lastNumEntries = 0;
+    long long startNs = getMonotonicTimeInNs();
+    long long lastNs = startNs;
+    long long nextNs = startNs;
+
+    for (long long sample = 0; maxSamples < 0 || sample < maxSamples; sample++) {
+        // Names of entries below numEntries are filled in
+        uint32_t numEntries = atomic_load_explicit(&pPage->numEntries, memory_order_acquire);
+        if (numEntries > STATS_MAX_ENTRIES) {
+            fprintf(stderr, "ERROR: Stats page is corrupt\n");
+            return EXIT_FAILURE;
+        }
+        long long nowNs = getMonotonicTimeInNs();
+        for (uint32_t i = 0; i < numEntries; i++) {
+            values[i] = atomic_load_explicit(&pPage->entries[i].value, memory_order_relaxed);
+        }
+
+        if (isCsv) {
+            if (numEntries != lastNumEntries) {
+                printCsvHeader(pPage, numEntries, filter);
+            }
+            printf("%lld", (nowNs - startNs) / NS_PER_MS);
+            for (uint32_t i = 0; i < numEntries; i++) {
+                if (strstr(pPage->entries[i].name, filter) != NULL) {
+                    printf(",%llu", (unsigned long long) values[i]);
+                }
+            }
+            printf("\n");
+        } else if (sample > 0) {
+            double seconds = (double) (nowNs - lastNs) / NS_PER_SECOND;
+            printf("--- %.3f s, pid %u\n", (double) (nowNs - startNs) / NS_PER_SECOND, pPage->pid);
+            for (uint32_t i = 0; i < numEntries; i++) {
+                const statsEntry_t *pEntry = &pPage->entries[i];
+                if (strstr(pEntry->name, filter) == NULL) {
+                    continue;
+                }
+                printf("%-28s %14llu", pEntry->name, (unsigned long long) values[i]);
+                // Entries new since the last sample have no rate yet
+                if (pEntry->kind == STATS_KIND_COUNTER && i < lastNumEntries) {
+                    printf("  %12.1f/s", (values[i] - lastValues[i]) / seconds);
+                }
+                printf("\n");
+            }
+        }
+        fflush(stdout);
+
+        memcpy(lastValues, values, numEntries * sizeof(values[0]));
+        lastNumEntries = numEntries;
+        lastNs = nowNs;
+        if (!atomic_load_explicit(&pPage->isRunning, memory_order_relaxed)) {
+            fprintf(stderr, "App has exited\n");
+            break;
+        }
+        nextNs += intervalMs * NS_PER_MS;
+        sleepUntil(nextNs);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,236 @@
+// Loopback test client for network MIDI (app/src/netMidi.c)
+// Sends note-ons to the board through a simulated network, with added
+// delay, jitter and loss, and times each packet until the board's jitter
+// buffer acks playing it out. Reports latency percentiles and loss.
+//
+// Build on the host or the board:
+//   gcc -O2 -Wall -o netMidiLoopback tools/netMidiLoopback.c
+// Usage:
+//   netMidiLoopback [-h host] [-n packets] [-r packetsPerSecond]
+//                   [-d delayMs] [-j jitterMs] [-l lossPercent]
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "../app/include/netMidi.h"
+
+#define NS_PER_US 1000LL
+#define NS_PER_MS 1000000LL
+#define NS_PER_SECOND 1000000000LL
+// How long to wait for acks after the last packet goes out
+#define DRAIN_MS 1000
+// Notes the guidance system knows, C to C8
+#define FIRST_NOTE 60
+#define NUM_NOTES 13
+
+struct PendingSend {
+    long long sendAtNs;
+    int seq;
+};
+
+struct Options {
+    const char *host;
+    int numPackets;
+    int packetsPerSecond;
+    int delayMs;
+    int jitterMs;
+    int lossPercent;
+};
+
+static long long getMonotonicTimeInNs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * NS_PER_SECOND + now.tv_nsec;
+}
+
+static void parseOptions(int argc, char *argv[], struct Options *pOptions)
+{
+    *pOptions = (struct Options) {
+        .host = "127.0.0.1",
+        .numPackets = 1000,
+        .packetsPerSecond = 50,
+    };
+    int option;
+    while ((option = getopt(argc, argv, "h:n:r:d:j:l:")) != -1) {
+        switch (option) {
+        case 'h': pOptions->host = optarg; break;
+        case 'n': pOptions->numPackets = atoi(optarg); break;
+        case 'r': pOptions->packetsPerSecond = atoi(optarg); break;
+        case 'd': pOptions->delayMs = atoi(optarg); break;
+        case 'j': pOptions->jitterMs = atoi(optarg); break;
+        case 'l': pOptions->lossPercent = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-h host] [-n packets] [-r packetsPerSecond] "
+                "[-d delayMs] [-j jitterMs] [-l lossPercent]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (pOptions->numPackets <= 0 || pOptions->packetsPerSecond <= 0) {
+        fprintf(stderr, "Packets and rate must be positive\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static int buildPacket(unsigned char *pPacket, int seq, long long createdNs)
+{
+    uint32_t senderUs = createdNs / NS_PER_US;
+    int note = FIRST_NOTE + seq % NUM_NOTES;
+    unsigned char header[NET_MIDI_HEADER_LEN] = {
+        NET_MIDI_MAGIC, NET_MIDI_VERSION, NET_MIDI_FLAG_ACK, 1,
+        seq & 0xFF, (seq >> 8) & 0xFF, 0, 0,
+        senderUs & 0xFF, (senderUs >> 8) & 0xFF, (senderUs >> 16) & 0xFF, senderUs >> 24,
+    };
+    memcpy(pPacket, header, sizeof(header));
+    pPacket[NET_MIDI_HEADER_LEN] = 0x90;
+    pPacket[NET_MIDI_HEADER_LEN + 1] = note;
+    pPacket[NET_MIDI_HEADER_LEN + 2] = 64;
+    return NET_MIDI_HEADER_LEN + NET_MIDI_EVENT_LEN;
+}
+
+static int compareLongLong(const void *pFirst, const void *pSecond)
+{
+    long long first = *(const long long *) pFirst;
+    long long second = *(const long long *) pSecond;
+    return (first > second) - (first < second);
+}
+
+static int comparePending(const void *pFirst, const void *pSecond)
+{
+    return compareLongLong(&((const struct PendingSend *) pFirst)->sendAtNs,
+        &((const struct PendingSend *) pSecond)->sendAtNs);
+}
+
+static long long percentile(const long long *pSorted, int count, int percent)
+{
+    int index = (count - 1) * percent / 100;
+    return pSorted[index];
+}
+
+int main(int argc, char *argv[])
+{
+    struct Options options;
+    parseOptions(argc, argv, &options);
+    srand(time(NULL));
+
+    int socketFd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_in board = {.sin_family = AF_INET, .sin_port = htons(NET_MIDI_PORT)};
+    if (socketFd < 0 || inet_pton(AF_INET, options.host, &board.sin_addr) != 1
+            || connect(socketFd, (struct sockaddr *) &board, sizeof(board)) < 0) {
+        perror("Unable to reach board");
+        return EXIT_FAILURE;
+    }
+
+    int numPackets = options.numPackets;
+    long long *pCreatedNs = calloc(numPackets, sizeof(long long));
+    long long *pLatencyNs = calloc(numPackets, sizeof(long long));
+    bool *pIsAcked = calloc(numPackets, sizeof(bool));
+    struct PendingSend *pPending = calloc(numPackets, sizeof(struct PendingSend));
+    if (!pCreatedNs || !pLatencyNs || !pIsAcked || !pPending) {
+        perror("calloc");
+        return EXIT_FAILURE;
+    }
+
+    // Each packet is created on schedule, then held back by the simulated
+    // network; packets with more jitter are overtaken, as on a real one
+    long long intervalNs = NS_PER_SECOND / options.packetsPerSecond;
+    long long startNs = getMonotonicTimeInNs() + 10 * NS_PER_MS;
+    int numPending = 0;
+    int numInjectedLost = 0;
+    for (int seq = 0; seq < numPackets; seq++) {
+        pCreatedNs[seq] = startNs + seq * intervalNs;
+        if (rand() % 100 < options.lossPercent) {
+            numInjectedLost++;
+            continue;
+        }
+        long long jitterNs = options.jitterMs > 0
+            ? (long long) rand() % (options.jitterMs * NS_PER_MS) : 0;
+        pPending[numPending].sendAtNs = pCreatedNs[seq] + options.delayMs * NS_PER_MS + jitterNs;
+        pPending[numPending].seq = seq;
+        numPending++;
+    }
+    if (numPending == 0) {
+        printf("Every packet was dropped by the simulated network\n");
+        return EXIT_SUCCESS;
+    }
+    qsort(pPending, numPending, sizeof(struct PendingSend), comparePending);
+
+    int nextToSend = 0;
+    int numAcks = 0;
+    long long lastSendNs = pPending[numPending - 1].sendAtNs;
+    while (true) {
+        long long nowNs = getMonotonicTimeInNs();
+        while (nextToSend < numPending && pPending[nextToSend].sendAtNs <= nowNs) {
+            int seq = pPending[nextToSend].seq;
+            unsigned char packet[NET_MIDI_MAX_PACKET_LEN];
+            int length = buildPacket(packet, seq, pCreatedNs[seq]);
+            send(socketFd, packet, length, 0);
+            nextToSend++;
+        }
+
+        long long untilNs = nextToSend < numPending
+            ? pPending[nextToSend].sendAtNs - nowNs
+            : lastSendNs + DRAIN_MS * NS_PER_MS - nowNs;
+        if (untilNs <= 0 && nextToSend == numPending) {
+            break;
+        }
+        struct pollfd ackFd = {.fd = socketFd, .events = POLLIN};
+        struct timespec timeout = {
+            .tv_sec = untilNs > 0 ? untilNs / NS_PER_SECOND : 0,
+            .tv_nsec = untilNs > 0 ? untilNs % NS_PER_SECOND : 0,
+        };
+        if (ppoll(&ackFd, 1, &timeout, NULL) <= 0) {
+            continue;
+        }
+
+        unsigned char ack[NET_MIDI_MAX_PACKET_LEN];
+        int length = recv(socketFd, ack, sizeof(ack), MSG_DONTWAIT);
+        long long ackNs = getMonotonicTimeInNs();
+        if (length < NET_MIDI_HEADER_LEN || ack[0] != NET_MIDI_ACK_MAGIC) {
+            continue;
+        }
+        // Sequence numbers are 16 bits; find the packet this one was
+        int seq = ack[4] | (ack[5] << 8);
+        for (int candidate = seq; candidate < numPackets; candidate += 1 << 16) {
+            if (!pIsAcked[candidate] && (uint32_t) (pCreatedNs[candidate] / NS_PER_US)
+                    == (uint32_t) (ack[8] | (ack[9] << 8) | (ack[10] << 16) | ((uint32_t) ack[11] << 24))) {
+                pIsAcked[candidate] = true;
+                pLatencyNs[numAcks++] = ackNs - pCreatedNs[candidate];
+                break;
+            }
+        }
+    }
+
+    int numSent = numPending;
+    printf("Sent %d of %d packets (%d dropped by the simulated network), "
+        "delay %d ms, jitter %d ms\n",
+        numSent, numPackets, numInjectedLost, options.delayMs, options.jitterMs);
+    printf("Played out: %d, lost after sending: %d (%.2f%%)\n",
+        numAcks, numSent - numAcks, 100.0 * (numSent - numAcks) / numSent);
+    if (numAcks > 0) {
+        qsort(pLatencyNs, numAcks, sizeof(long long), compareLongLong);
+        printf("Latency, created to played out (us): min %lld p50 %lld p95 %lld p99 %lld max %lld\n",
+            pLatencyNs[0] / NS_PER_US,
+            percentile(pLatencyNs, numAcks, 50) / NS_PER_US,
+            percentile(pLatencyNs, numAcks, 95) / NS_PER_US,
+            percentile(pLatencyNs, numAcks, 99) / NS_PER_US,
+            pLatencyNs[numAcks - 1] / NS_PER_US);
+    }
+
+    free(pCreatedNs);
+    free(pLatencyNs);
+    free(pIsAcked);
+    free(pPending);
+    close(socketFd);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,54 @@
+#!/bin/bash
+# Training run for profile-guided optimisation (KGS_PGO in CMakeLists.txt)
+# Plays a MIDI recording through the app on the simulated HAL backend, pokes
+# the UDP command server, then stops the app so it writes its profiles.
+#
+# Usage, from Keyboard-Guidance-System:
+#   cmake -S . -B build -DCMAKE_BUILD_TYPE=Release -DKGS_PGO=generate
+#   cmake --build build
+#   tools/pgoTrain.sh build/app/kgs [recording] [seconds]
+#   cmake -S . -B build -DKGS_PGO=use && cmake --build build
+# The recording defaults to txt_files/twinkle_recording.txt, the run to 10 s.
+
+set -e
+
+if [ $# -lt 1 ] || [ $# -gt 3 ]; then
+    echo "Usage: $0 <app binary> [recording] [seconds]" >&2
+    exit 1
+fi
+app="$1"
+recording="${2:-txt_files/twinkle_recording.txt}"
+seconds="${3:-10}"
+
+if [ ! -x "$app" ]; then
+    echo "ERROR: $app is not an executable" >&2
+    exit 1
+fi
+if [ ! -r "$recording" ]; then
+    echo "ERROR: Unable to read recording $recording" >&2
+    exit 1
+fi
+
+udpCommand() {
+    echo -n "$1" > /dev/udp/127.0.0.1/12345
+}
+
+KGS_HAL_BACKEND=sim KGS_SIM_MIDI="$recording" "$app" > /dev/null &
+pid=$!
+sleep 1
+
+# The recording drives midi, the controller, LEDs and audio; also cover
+# the status stream and a stored song. Each command comes from a new port,
+# so the subscriber simply goes stale.
+udpCommand "subscribe 50"
+udpCommand "twinkle"
+udpCommand "stats"
+sleep $((seconds - 1))
+
+# Profiles are only written on a normal exit
+udpCommand "stop"
+if ! wait $pid; then
+    echo "ERROR: $app did not exit cleanly, profiles may be missing" >&2
+    exit 1
+fi
+echo "Training done"
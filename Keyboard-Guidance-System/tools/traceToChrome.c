@@ -0,0 +1,137 @@
+// Convert a trace dump (hal/trace.h) to Chrome trace JSON, for
+// chrome://tracing or https://ui.perfetto.dev
+//
+// Get a dump from the running app with the UDP "trace" command or
+// `kill -USR1 <pid>`, copy it off the board, then:
+//   gcc -O2 -Wall -Ihal/include -o traceToChrome tools/traceToChrome.c
+//   traceToChrome kgs-trace.bin > kgs-trace.json
+// Times are in us from the first event in the dump.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "hal/trace.h"
+
+static char *names[TRACE_MAX_NAMES + 1];
+
+static void readOrDie(void *pData, size_t size, FILE *pFile)
+{
+    if (size > 0 && fread(pData, size, 1, pFile) != 1) {
+        fprintf(stderr, "ERROR: Trace file is truncated\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Names are ours, but may still hold a quote or backslash
+static void printJsonString(const char *text)
+{
+    putchar('"');
+    for (; *text != '\0'; text++) {
+        if (*text == '"' || *text == '\\') {
+            putchar('\\');
+        }
+        if ((unsigned char) *text >= ' ') {
+            putchar(*text);
+        }
+    }
+    putchar('"');
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <trace dump>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    FILE *pFile = fopen(argv[1], "rb");
+    if (pFile == NULL) {
+        perror("ERROR: Unable to open trace file");
+        return EXIT_FAILURE;
+    }
+
+    char magic[sizeof(TRACE_FILE_MAGIC) - 1];
+    uint32_t header[3];
+    readOrDie(magic, sizeof(magic), pFile);
+    readOrDie(header, sizeof(header), pFile);
+    if (memcmp(magic, TRACE_FILE_MAGIC, sizeof(magic)) != 0 || header[0] != TRACE_FILE_VERSION) {
+        fprintf(stderr, "ERROR: %s is not a version %d trace dump\n", argv[1], TRACE_FILE_VERSION);
+        return EXIT_FAILURE;
+    }
+    uint32_t numNames = header[1];
+    uint32_t numThreads = header[2];
+    if (numNames > TRACE_MAX_NAMES || numThreads > TRACE_MAX_THREADS) {
+        fprintf(stderr, "ERROR: Trace file header is corrupt\n");
+        return EXIT_FAILURE;
+    }
+    for (uint32_t i = 1; i <= numNames; i++) {
+        uint16_t length;
+        readOrDie(&length, sizeof(length), pFile);
+        names[i] = malloc(length + 1);
+        readOrDie(names[i], length, pFile);
+        names[i][length] = '\0';
+    }
+
+    // Read every thread first: the time origin is the earliest event of all
+    int32_t tids[TRACE_MAX_THREADS];
+    char threadNames[TRACE_MAX_THREADS][TRACE_THREAD_NAME_LEN + 1];
+    uint32_t counts[TRACE_MAX_THREADS];
+    traceEvent_t *events[TRACE_MAX_THREADS];
+    uint64_t originNs = UINT64_MAX;
+    for (uint32_t t = 0; t < numThreads; t++) {
+        readOrDie(&tids[t], sizeof(tids[t]), pFile);
+        readOrDie(threadNames[t], TRACE_THREAD_NAME_LEN, pFile);
+        threadNames[t][TRACE_THREAD_NAME_LEN] = '\0';
+        readOrDie(&counts[t], sizeof(counts[t]), pFile);
+        if (counts[t] > TRACE_BUFFER_EVENTS) {
+            fprintf(stderr, "ERROR: Trace file thread %d is corrupt\n", t);
+            return EXIT_FAILURE;
+        }
+        events[t] = malloc(counts[t] * sizeof(traceEvent_t));
+        readOrDie(events[t], counts[t] * sizeof(traceEvent_t), pFile);
+        if (counts[t] > 0 && events[t][0].timestampNs < originNs) {
+            originNs = events[t][0].timestampNs;
+        }
+    }
+    fclose(pFile);
+
+    printf("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    bool isFirst = true;
+    for (uint32_t t = 0; t < numThreads; t++) {
+        printf("%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":",
+            isFirst ? "" : ",\n", tids[t]);
+        printJsonString(threadNames[t]);
+        printf("}}");
+        isFirst = false;
+
+        // A buffer that wrapped can start inside a slice; Chrome copes
+        // with an unmatched end, so leave those in
+        for (uint32_t i = 0; i < counts[t]; i++) {
+            const traceEvent_t *pEvent = &events[t][i];
+            if (pEvent->nameId == 0 || pEvent->nameId > numNames) {
+                continue;
+            }
+            uint64_t sinceOriginNs = pEvent->timestampNs - originNs;
+            printf(",\n{\"name\":");
+            printJsonString(names[pEvent->nameId]);
+            printf(",\"ph\":\"%c\",\"ts\":%llu.%03llu,\"pid\":1,\"tid\":%d",
+                pEvent->phase, (unsigned long long) (sinceOriginNs / 1000),
+                (unsigned long long) (sinceOriginNs % 1000), tids[t]);
+            if (pEvent->phase == TRACE_PHASE_COUNTER) {
+                printf(",\"args\":{\"value\":%u}", pEvent->arg);
+            } else if (pEvent->phase == TRACE_PHASE_INSTANT) {
+                printf(",\"s\":\"t\",\"args\":{\"arg\":%u}", pEvent->arg);
+            }
+            printf("}");
+        }
+        free(events[t]);
+    }
+    printf("\n]}\n");
+
+    for (uint32_t i = 1; i <= numNames; i++) {
+        free(names[i]);
+    }
+    return EXIT_SUCCESS;
+}
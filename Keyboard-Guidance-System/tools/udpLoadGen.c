@@ -0,0 +1,304 @@
+// Load generator for the UDP command server (app/src/udp.c)
+// Sends a weighted mix of commands from several client sockets, each with
+// one command in flight, and reports throughput and reply latency. Reads
+// the server's "stats" before and after, so audio underruns caused by the
+// load show up next to the numbers.
+//
+// Build on the host or the board:
+//   gcc -O2 -Wall -o udpLoadGen tools/udpLoadGen.c
+// Usage:
+//   udpLoadGen [-h host] [-c clients] [-t seconds] [-r commandsPerSecond]
+//              [-m command:weight,...]
+// With -r 0 (the default) each client sends again as soon as it has a
+// reply. With a rate, latency counts from when a command was due, so a
+// stalled server is not hidden by commands that were never sent.
+// The server does not answer unknown commands; they count as timeouts.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define PORT 12345
+#define MAX_CLIENTS 64
+#define MAX_MIX 16
+#define MAX_REPLY_LEN 4096
+#define REPLY_TIMEOUT_MS 1000
+#define NS_PER_US 1000LL
+#define NS_PER_MS 1000000LL
+#define NS_PER_SECOND 1000000000LL
+#define DEFAULT_MIX "help:8,twinkle:1,bach:1"
+
+struct MixEntry {
+    char command[32];
+    int weight;
+};
+
+struct Client {
+    int fd;
+    bool isWaiting;
+    // When the command in flight was due, and when the next one is
+    long long dueNs;
+    long long nextDueNs;
+};
+
+struct ServerStats {
+    long long commands;
+    long long audioPeriods;
+    long long audioXruns;
+};
+
+static struct MixEntry mix[MAX_MIX];
+static int numMix;
+static int totalWeight;
+
+static long long getMonotonicTimeInNs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * NS_PER_SECOND + now.tv_nsec;
+}
+
+static void parseMix(const char *pText)
+{
+    char copy[256];
+    snprintf(copy, sizeof(copy), "%s", pText);
+    for (char *pEntry = strtok(copy, ","); pEntry && numMix < MAX_MIX; pEntry = strtok(NULL, ",")) {
+        int weight = 1;
+        char *pColon = strchr(pEntry, ':');
+        if (pColon) {
+            *pColon = '\0';
+            weight = atoi(pColon + 1);
+        }
+        // stop ends the server, and gets no reply anyway
+        if (weight <= 0 || strcmp(pEntry, "stop") == 0) {
+            fprintf(stderr, "Skipping mix entry '%s'\n", pEntry);
+            continue;
+        }
+        snprintf(mix[numMix].command, sizeof(mix[numMix].command), "%s\n", pEntry);
+        mix[numMix].weight = weight;
+        totalWeight += weight;
+        numMix++;
+    }
+    if (numMix == 0) {
+        fprintf(stderr, "No commands in the mix\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static const char *pickCommand(void)
+{
+    int pick = rand() % totalWeight;
+    for (int i = 0; i < numMix; i++) {
+        pick -= mix[i].weight;
+        if (pick < 0) {
+            return mix[i].command;
+        }
+    }
+    return mix[0].command;
+}
+
+static int openClient(const char *pHost)
+{
+    struct sockaddr_in server = {.sin_family = AF_INET, .sin_port = htons(PORT)};
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || inet_pton(AF_INET, pHost, &server.sin_addr) != 1
+            || connect(fd, (struct sockaddr *) &server, sizeof(server)) < 0) {
+        perror("Unable to reach server");
+        exit(EXIT_FAILURE);
+    }
+    return fd;
+}
+
+static long long findStat(const char *pReply, const char *pName)
+{
+    size_t nameLength = strlen(pName);
+    for (const char *pLine = pReply; pLine; pLine = strchr(pLine, '\n')) {
+        if (*pLine == '\n') {
+            pLine++;
+        }
+        if (strncmp(pLine, pName, nameLength) == 0 && pLine[nameLength] == ' ') {
+            return atoll(pLine + nameLength + 1);
+        }
+    }
+    return -1;
+}
+
+static bool readServerStats(int fd, struct ServerStats *pStats)
+{
+    char reply[MAX_REPLY_LEN];
+    send(fd, "stats\n", 6, 0);
+    struct pollfd replyFd = {.fd = fd, .events = POLLIN};
+    if (poll(&replyFd, 1, REPLY_TIMEOUT_MS) <= 0) {
+        return false;
+    }
+    int length = recv(fd, reply, sizeof(reply) - 1, 0);
+    if (length <= 0) {
+        return false;
+    }
+    reply[length] = '\0';
+    pStats->commands = findStat(reply, "commands");
+    pStats->audioPeriods = findStat(reply, "audioPeriods");
+    pStats->audioXruns = findStat(reply, "audioXruns");
+    return true;
+}
+
+static int compareLongLong(const void *pFirst, const void *pSecond)
+{
+    long long first = *(const long long *) pFirst;
+    long long second = *(const long long *) pSecond;
+    return (first > second) - (first < second);
+}
+
+static long long percentile(const long long *pSorted, int count, double percent)
+{
+    int index = (int) ((count - 1) * percent / 100.0);
+    return pSorted[index];
+}
+
+int main(int argc, char *argv[])
+{
+    const char *pHost = "127.0.0.1";
+    int numClients = 8;
+    int seconds = 5;
+    int rate = 0;
+    const char *pMix = DEFAULT_MIX;
+    int option;
+    while ((option = getopt(argc, argv, "h:c:t:r:m:")) != -1) {
+        switch (option) {
+        case 'h': pHost = optarg; break;
+        case 'c': numClients = atoi(optarg); break;
+        case 't': seconds = atoi(optarg); break;
+        case 'r': rate = atoi(optarg); break;
+        case 'm': pMix = optarg; break;
+        default:
+            fprintf(stderr, "Usage: %s [-h host] [-c clients] [-t seconds] "
+                "[-r commandsPerSecond] [-m command:weight,...]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (numClients <= 0 || numClients > MAX_CLIENTS || seconds <= 0 || rate < 0) {
+        fprintf(stderr, "Clients must be 1-%d, seconds positive, rate not negative\n", MAX_CLIENTS);
+        return EXIT_FAILURE;
+    }
+    parseMix(pMix);
+    srand(time(NULL));
+
+    int statsFd = openClient(pHost);
+    struct ServerStats before;
+    struct ServerStats after;
+    bool hasStats = readServerStats(statsFd, &before);
+    if (!hasStats) {
+        printf("Server did not answer 'stats'; reporting client side only\n");
+    }
+
+    struct Client clients[MAX_CLIENTS];
+    struct pollfd fds[MAX_CLIENTS];
+    long long intervalNs = rate > 0 ? NS_PER_SECOND * numClients / rate : 0;
+    long long startNs = getMonotonicTimeInNs();
+    long long endNs = startNs + seconds * NS_PER_SECOND;
+    for (int i = 0; i < numClients; i++) {
+        clients[i].fd = openClient(pHost);
+        clients[i].isWaiting = false;
+        // Spread the clients over one interval
+        clients[i].nextDueNs = startNs + intervalNs * i / numClients;
+        fds[i].fd = clients[i].fd;
+        fds[i].events = POLLIN;
+    }
+
+    size_t maxSamples = 1 << 20;
+    long long *pLatencyNs = malloc(maxSamples * sizeof(long long));
+    if (!pLatencyNs) {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+    size_t numReplies = 0;
+    long long numSent = 0;
+    long long numTimeouts = 0;
+
+    while (true) {
+        long long nowNs = getMonotonicTimeInNs();
+        bool isAnyWaiting = false;
+        long long wakeNs = endNs;
+        for (int i = 0; i < numClients; i++) {
+            struct Client *pClient = &clients[i];
+            if (pClient->isWaiting && nowNs - pClient->dueNs > REPLY_TIMEOUT_MS * NS_PER_MS) {
+                pClient->isWaiting = false;
+                numTimeouts++;
+            }
+            if (!pClient->isWaiting && nowNs < endNs && nowNs >= pClient->nextDueNs) {
+                const char *pCommand = pickCommand();
+                pClient->dueNs = rate > 0 ? pClient->nextDueNs : nowNs;
+                pClient->nextDueNs += intervalNs;
+                send(pClient->fd, pCommand, strlen(pCommand), 0);
+                pClient->isWaiting = true;
+                numSent++;
+            }
+            if (pClient->isWaiting) {
+                isAnyWaiting = true;
+                long long timeoutNs = pClient->dueNs + REPLY_TIMEOUT_MS * NS_PER_MS;
+                wakeNs = timeoutNs < wakeNs ? timeoutNs : wakeNs;
+            } else if (pClient->nextDueNs < wakeNs) {
+                wakeNs = pClient->nextDueNs;
+            }
+        }
+        if (nowNs >= endNs && !isAnyWaiting) {
+            break;
+        }
+
+        long long waitNs = wakeNs > nowNs ? wakeNs - nowNs : 0;
+        struct timespec timeout = {.tv_sec = waitNs / NS_PER_SECOND, .tv_nsec = waitNs % NS_PER_SECOND};
+        if (ppoll(fds, numClients, &timeout, NULL) <= 0) {
+            continue;
+        }
+        long long replyNs = getMonotonicTimeInNs();
+        for (int i = 0; i < numClients; i++) {
+            if (!(fds[i].revents & POLLIN)) {
+                continue;
+            }
+            char reply[MAX_REPLY_LEN];
+            if (recv(clients[i].fd, reply, sizeof(reply), MSG_DONTWAIT) <= 0 || !clients[i].isWaiting) {
+                continue;
+            }
+            clients[i].isWaiting = false;
+            if (numReplies < maxSamples) {
+                pLatencyNs[numReplies++] = replyNs - clients[i].dueNs;
+            }
+        }
+    }
+    long long elapsedNs = getMonotonicTimeInNs() - startNs;
+
+    printf("%d clients, %s, mix %s\n", numClients,
+        rate > 0 ? "rate limited" : "closed loop", pMix);
+    printf("Sent %lld, replies %zu, timeouts %lld, %lld replies/s\n",
+        numSent, numReplies, numTimeouts, (long long) numReplies * NS_PER_SECOND / elapsedNs);
+    if (numReplies > 0) {
+        qsort(pLatencyNs, numReplies, sizeof(long long), compareLongLong);
+        printf("Reply latency (us): p50 %lld p90 %lld p99 %lld p99.9 %lld max %lld\n",
+            percentile(pLatencyNs, numReplies, 50) / NS_PER_US,
+            percentile(pLatencyNs, numReplies, 90) / NS_PER_US,
+            percentile(pLatencyNs, numReplies, 99) / NS_PER_US,
+            percentile(pLatencyNs, numReplies, 99.9) / NS_PER_US,
+            pLatencyNs[numReplies - 1] / NS_PER_US);
+    }
+    if (hasStats && readServerStats(statsFd, &after)) {
+        printf("Server: %lld commands handled, audio %lld periods, %lld xruns during the run\n",
+            after.commands - before.commands,
+            after.audioPeriods - before.audioPeriods,
+            after.audioXruns - before.audioXruns);
+    }
+
+    for (int i = 0; i < numClients; i++) {
+        close(clients[i].fd);
+    }
+    close(statsFd);
+    free(pLatencyNs);
+    return EXIT_SUCCESS;
+}